@@ -0,0 +1,126 @@
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <atomic>
+#include <vector>
+#include "b_plus_tree.hh"
+
+/*
+ * Checks that point operations on warmed up tree don't allocate memory from heap. Global operator new is replaced
+ * by one counting calls, the count has to stay the same during a batch of creates, reads, updates and deletes.
+ */
+
+namespace {
+    std::atomic<uint64_t> allocationsCount = 0;
+
+    auto CountedAllocate(size_t size, size_t alignment) -> void * {
+        ++allocationsCount;
+        if (size == 0) size = 1;
+        auto memory = alignment <= alignof(std::max_align_t)
+                      ? std::malloc(size)
+                      : std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+        if (!memory) throw std::bad_alloc();
+        return memory;
+    }
+}
+
+auto operator new(size_t size) -> void * { return CountedAllocate(size, alignof(std::max_align_t)); }
+auto operator new[](size_t size) -> void * { return CountedAllocate(size, alignof(std::max_align_t)); }
+auto operator new(size_t size, std::align_val_t alignment) -> void * {
+    return CountedAllocate(size, static_cast<size_t>(alignment));
+}
+auto operator new[](size_t size, std::align_val_t alignment) -> void * {
+    return CountedAllocate(size, static_cast<size_t>(alignment));
+}
+auto operator delete(void *memory) noexcept -> void { std::free(memory); }
+auto operator delete[](void *memory) noexcept -> void { std::free(memory); }
+auto operator delete(void *memory, size_t) noexcept -> void { std::free(memory); }
+auto operator delete[](void *memory, size_t) noexcept -> void { std::free(memory); }
+auto operator delete(void *memory, std::align_val_t) noexcept -> void { std::free(memory); }
+auto operator delete[](void *memory, std::align_val_t) noexcept -> void { std::free(memory); }
+auto operator delete(void *memory, size_t, std::align_val_t) noexcept -> void { std::free(memory); }
+auto operator delete[](void *memory, size_t, std::align_val_t) noexcept -> void { std::free(memory); }
+
+
+namespace {
+    using TestTree = BPlusTree<int64_t, Record, 4, 4>;
+    constexpr int64_t RecordsCount = 1000;
+    constexpr int Rounds = 3;
+
+    /**
+     * Runs the same batch of point operations on records with even keys. Record with the next odd key is created
+     * and deleted at once, so leaves get back their records count. All leaves are read with single batch at the end,
+     * those evicted from small buffer pool are read from file together
+     */
+    auto RunBatch(TestTree &tree, std::vector<NodeOffset> const &leaves,
+                  std::vector<std::shared_ptr<Node<int64_t, Record>>> &nodes) -> bool {
+        auto ok = true;
+        for (int64_t key = 0; key < 2 * RecordsCount; key += 2) {
+            ok &= tree.readRecord(key).has_value();
+            tree.updateRecord(key, Record(key % 100, 50, 50));
+            ok &= tree.createRecord(key + 1, Record(1, 2, 3)) == InsertStatus::INSERTED;
+            ok &= tree.readRecord(key + 1).has_value();
+            tree.deleteRecord(key + 1);
+        }
+        tree.readNodes(leaves, nodes);
+        ok &= nodes.size() == leaves.size();
+        nodes.clear();
+        return ok;
+    }
+
+
+    /**
+     * @param expectMisses nodes have to be read from file during batch
+     * @return true if batch run after warm up allocated no memory from heap
+     */
+    auto CheckTree(char const *name, TreeOptions const &options, bool expectMisses = false) -> bool {
+        auto path = fs::temp_directory_path() / "sbd2_allocations_test.bin";
+        auto passed = true;
+        {
+            TestTree tree(path, OpenMode::CREATE_NEW, options);
+            // nodes are filled in 3/4, so every leaf can take and give one record without being restructured
+            std::vector<std::pair<int64_t, Record>> records;
+            for (int64_t key = 0; key < 2 * RecordsCount; key += 2) records.emplace_back(key, Record(1, 2, 3));
+            tree.bulkLoad(records.begin(), records.end(), 0.75);
+            std::vector<NodeOffset> leaves;
+            for (int64_t key = 0; key < 2 * RecordsCount; key += 2) {
+                auto offset = tree.findProperLeaf(key)->fileOffset;
+                if (leaves.empty() || leaves.back() != offset) leaves.push_back(offset);
+            }
+            std::vector<std::shared_ptr<Node<int64_t, Record>>> nodes;
+            for (int round = 0; round < Rounds; ++round) RunBatch(tree, leaves, nodes);
+
+            auto missesBefore = tree.getSessionCacheMissesCount();
+            auto before = allocationsCount.load();
+            auto ok = RunBatch(tree, leaves, nodes);
+            auto allocations = allocationsCount.load() - before;
+            auto misses = tree.getSessionCacheMissesCount() - missesBefore;
+            passed = ok && allocations == 0 && (!expectMisses || misses >= leaves.size() / 2);
+            std::printf("%s %s: %lu heap allocations, %lu cache misses\n", passed ? "PASSED" : "FAILED", name,
+                        static_cast<unsigned long>(allocations), static_cast<unsigned long>(misses));
+            if (!ok) std::printf("records of batch weren't found\n");
+        }
+        fs::remove(path);
+        return passed;
+    }
+}
+
+
+int main() {
+    auto passed = true;
+    TreeOptions options;
+    passed &= CheckTree("buffer pool", options);
+    options.bufferPoolSize = 0;
+    passed &= CheckTree("no buffer pool", options);
+    // only a few nodes fit in pool, so most of them are read from file
+    options.bufferPoolSize = 2u << 10u;
+    passed &= CheckTree("small buffer pool", options, true);
+    options.bufferPoolSize = 1u << 20u;
+    options.durability = Durability::BATCH;
+    passed &= CheckTree("log of batches", options);
+    options.durability = Durability::OPERATION;
+    passed &= CheckTree("log of operations", options);
+    options.durability = Durability::SHADOW;
+    passed &= CheckTree("shadow paging", options);
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,72 @@
+#include "async_file_backend.hh"
+
+
+AsyncFileBackend::AsyncFileBackend(fs::path const &path, std::ios::openmode const &mode, bool useIoUring)
+        : PositionalFileBackend(path, mode) {
+    if (this->bad()) return;
+    if (useIoUring) {
+        this->ring = std::make_unique<IoUringQueue>();
+        if (this->ring->available()) return;
+        this->ring = nullptr;
+    }
+    this->startWorkers();
+}
+
+
+AsyncFileBackend::~AsyncFileBackend() {
+    {
+        std::lock_guard lock(this->mutex);
+        this->stopping = true;
+    }
+    this->batchReady.notify_all();
+    for (auto &worker : this->workers) worker.join();
+}
+
+
+void AsyncFileBackend::submit(IoRequest *requests, size_t count) {
+    if (count == 0) return;
+    if (this->ring) {
+        try {
+            this->ring->execute(this->fd, requests, count);
+        } catch (std::runtime_error const &) {
+            this->failed = true;
+            throw;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            if (requests[i].type == IoRequest::Type::WRITE) this->updateSize(requests[i].offset + requests[i].result);
+        }
+        return;
+    }
+    if (this->workers.empty()) {
+        FileBackend::submit(requests, count);
+        return;
+    }
+    std::unique_lock lock(this->mutex);
+    this->batch = requests;
+    this->batchSize = count;
+    this->nextRequest = 0;
+    this->finishedRequests = 0;
+    this->batchReady.notify_all();
+    this->batchDone.wait(lock, [this] { return this->finishedRequests == this->batchSize; });
+    this->batch = nullptr;
+    this->batchSize = 0;
+}
+
+
+void AsyncFileBackend::startWorkers() {
+    for (size_t i = 0; i < WorkersCount; ++i) this->workers.emplace_back([this] { this->workerLoop(); });
+}
+
+
+void AsyncFileBackend::workerLoop() {
+    std::unique_lock lock(this->mutex);
+    while (true) {
+        this->batchReady.wait(lock, [this] { return this->stopping || this->nextRequest < this->batchSize; });
+        if (this->stopping) return;
+        auto &request = this->batch[this->nextRequest++];
+        lock.unlock();
+        this->execute(request);
+        lock.lock();
+        if (++this->finishedRequests == this->batchSize) this->batchDone.notify_one();
+    }
+}
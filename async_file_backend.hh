@@ -0,0 +1,43 @@
+#ifndef SBD2_ASYNC_FILE_BACKEND_HH
+#define SBD2_ASYNC_FILE_BACKEND_HH
+
+#include "positional_file_backend.hh"
+#include "io_uring_queue.hh"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+/**
+ * Positional backend executing batches asynchronously with io_uring or - when it is not available
+ * (or not requested) - by small pool of worker threads
+ */
+class AsyncFileBackend final : public PositionalFileBackend {
+public:
+    static constexpr size_t WorkersCount = 4;
+
+    AsyncFileBackend(fs::path const &path, std::ios::openmode const &mode, bool useIoUring);
+    ~AsyncFileBackend() override;
+
+    void submit(IoRequest *requests, size_t count) override;
+    bool usesIoUring() const { return this->ring && this->ring->available(); }
+
+private:
+    void startWorkers();
+    void workerLoop();
+
+    std::unique_ptr<IoUringQueue> ring;
+
+    // worker threads fallback, one batch is processed at a time
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable batchReady;
+    std::condition_variable batchDone;
+    IoRequest *batch = nullptr;
+    size_t batchSize = 0;
+    size_t nextRequest = 0;
+    size_t finishedRequests = 0;
+    bool stopping = false;
+};
+
+
+#endif //SBD2_ASYNC_FILE_BACKEND_HH
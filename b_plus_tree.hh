@@ -10,8 +10,25 @@
 #include <filesystem>
 #include <fstream>
 #include <algorithm>
+#include <array>
+#include <map>
+#include <cstring>
+#include <cstddef>
+#include <optional>
 #include <memory>
 #include <utility>
+#include <cmath>
+#include <span>
+#include <numeric>
+#include <thread>
+#include <mutex>
+#include <shared_mutex>
+#include <exception>
+#include <set>
+#include <deque>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
 #include <graphviz/gvc.h>
 #include "node.hh"
 #include "inner_node.hh"
@@ -19,6 +36,10 @@
 #include "record.hh"
 #include "tools.hh"
 #include "file.hh"
+#include "buffer_pool.hh"
+#include "node_pool.hh"
+#include "write_ahead_log.hh"
+#include "readahead.hh"
 
 using namespace std::string_literals;
 namespace fs = std::filesystem;
@@ -27,11 +48,72 @@ class Dbms;
 
 enum class OpenMode { USE_EXISTING, CREATE_NEW };
 enum class IteratorT { BEGIN, END };
+enum class InsertStatus { INSERTED, DUPLICATE };
+
+// SLOTTED - packed node slots, PAGED - every node occupies its own page (required by direct IO)
+enum class FileFormat { SLOTTED, PAGED };
+
+struct TreeOptions {
+    size_t bufferPoolSize = 1u << 20u;
+    FileBackendType fileBackend = FileBackendType::PREAD;
+    FileFormat fileFormat = FileFormat::SLOTTED; // used for new files
+    Durability durability = Durability::NONE;
+    size_t readaheadWindow = 64; // max number of pages prefetched ahead of scan, 0 disables readahead
+    size_t scanThreads = 1; // threads used by full scans and counting of records, 1 means scan with iterator
+    bool hugePages = false; // memory of nodes is taken in chunks backed by transparent huge pages
+};
+
+
+/**
+ * @return max degree of leaf node which (together with its header) fits in page of given size
+ */
+template<typename TKey, typename TValue>
+constexpr auto LeafDegreeForPage(size_t pageSize) -> size_t {
+    return (pageSize - 1 - 2 * sizeof(NodeOffset) - sizeof(TKey) - sizeof(uint16_t) - sizeof(uint32_t)) /
+           (2 * (sizeof(TKey) + sizeof(TValue)));
+}
+
+
+/**
+ * @return max degree of inner node which (together with its header) fits in page of given size
+ */
+template<typename TKey>
+constexpr auto InnerDegreeForPage(size_t pageSize) -> size_t {
+    return (pageSize - 1 - 2 * sizeof(uint16_t) - 2 * sizeof(NodeOffset) - sizeof(TKey) - sizeof(uint32_t)) /
+           (2 * (sizeof(TKey) + sizeof(NodeOffset)));
+}
+
+
+// Region at the beginning of every db file, it has the same layout in all versions of program
+struct ConfigHeader {
+    uint64_t rootOffset = 0;
+    uint64_t innerNodeDegree = 0;
+    uint64_t leafNodeDegree = 0;
+};
+
+// Shadow files begin with two superblocks instead of headers, each in its own sector (or page in paged files).
+// They are written alternately, the valid one with greater sequence is the current one
+struct Superblock {
+    static constexpr size_t SlotSize = 512;
+    ConfigHeader configHeader;
+    uint64_t magic = 0; // placed like magic of free space header
+    uint64_t fileEnd = 0; // slots beyond it were written by uncommitted operation, headers of others are valid
+    uint64_t sequence = 0;
+    uint32_t checksum = 0;
+
+    auto computeChecksum() const {
+        return Crc32c(reinterpret_cast<char const *>(this), offsetof(Superblock, checksum));
+    }
+    auto valid() const { return this->checksum == this->computeChecksum(); }
+};
 
 
 template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
 class BPlusTree;
 
+template<size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+class TypedTree;
+
 
 template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
 std::ostream &operator<<(std::ostream &o, BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree> const &t) {
@@ -41,28 +123,61 @@ std::ostream &operator<<(std::ostream &o, BPlusTree<TKey, TValue, TInnerNodeDegr
 
 template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
 class BPlusTree final {
-    struct ConfigHeader {
-        uint64_t rootOffset = 0;
-        uint64_t innerNodeDegree = 0;
-        uint64_t leafNodeDegree = 0;
+    static constexpr size_t BulkLoadBatchSize = 256; // nodes written by bulk load with single batch
+    static constexpr size_t CreateRecordsNodesLimit = 256; // nodes used by batched insert before they are committed
+    static constexpr size_t ScanPartitionsPerThread = 4; // subtrees are taken by scan threads one by one
+    static constexpr size_t LatchesCount = 1024; // every node is latched by one of them chosen by its offset
+    static constexpr size_t EpochSlotsCount = 128; // threads which can read tree without latches at the same time
+    static constexpr size_t MaxKeptWriteBufferSize = 1u << 20u; // bigger buffers of written nodes are released
+
+    // Region placed right after ConfigHeader, its magic identifies format of the file.
+    // In paged files both headers fill the first page.
+    struct FreeSpaceHeader {
+        static constexpr uint64_t Magic = 0x534e454432444253; // "SBD2DENS"
+        static constexpr uint64_t PagedMagic = 0x4741504432444253; // "SBD2DPAG"
+        static constexpr uint64_t ShadowMagic = 0x5744485332444253; // "SBD2SHDW"
+        static constexpr uint64_t PagedShadowMagic = 0x4750485332444253; // "SBD2SHPG"
+        // files written by older versions of program don't have any magic, they are read only by ReadOlderFile
+        uint64_t magic = Magic;
+        uint64_t leafNodesHead = 0; // 0 means empty list (config header is always at 0)
+        uint64_t innerNodesHead = 0;
     };
 
     class Iterator;
     class ForwardIterator;
     class ReverseIterator;
+    class Range;
+    class ScanWorker;
+    class EpochGuard;
+    class VersionedWrite;
 
     using ANode = Node<TKey, TValue>;
     using AInnerNode = InnerNode<TKey, TValue, TInnerNodeDegree>;
     using ALeafNode = LeafNode<TKey, TValue, TLeafNodeDegree>;
+    // offsets (or latch indices) collected by every operation, nodes of set are taken from pool
+    using OffsetsSet = std::set<NodeOffset, std::less<>, PoolAllocator<NodeOffset>>;
+
+    // Node read without latch, its data can be used only if version of its latch is the same after it is read.
+    // Root is kept alive by epoch of reader (see EpochGuard), other nodes by owner
+    struct OptimisticNode {
+        std::shared_ptr<ANode> owner;
+        ANode *node = nullptr;
+        uint64_t version = 0;
+    };
+    // version of OptimisticNode which is saved version of node (see Snapshot), its data never changes
+    static constexpr uint64_t SavedNodeVersion = 1;
 
     friend Iterator;
     friend Dbms;
+    friend TypedTree<TInnerNodeDegree, TLeafNodeDegree>;
     friend std::ostream &operator<<<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>(
             std::ostream &os,
             BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree> const &bPlusTree);
 
 
 public:
+    class Snapshot;
+
     BPlusTree() = delete;
     BPlusTree(BPlusTree &&) = delete;
     BPlusTree(BPlusTree const &) = delete;
@@ -70,19 +185,47 @@ public:
     BPlusTree &operator=(BPlusTree const &) = delete;
     ~BPlusTree();
 
-    explicit BPlusTree(fs::path filePath, OpenMode openMode = OpenMode::USE_EXISTING);
+    explicit BPlusTree(fs::path filePath, OpenMode openMode = OpenMode::USE_EXISTING,
+                       TreeOptions const &options = {});
+
+    static auto ReadOlderFile(fs::path const &filePath,
+                              std::function<void(TKey const &, TValue const &)> const &consumer) -> void;
 
     auto readNode(size_t fileOffset) -> std::shared_ptr<ANode>;
+    auto readNodes(std::span<NodeOffset const> fileOffsets, std::vector<std::shared_ptr<ANode>> &result) -> void;
+    auto makeNode(size_t fileOffset, char const *readData, size_t readSize) -> std::shared_ptr<ANode>;
+    auto getCachedNode(size_t fileOffset) -> std::shared_ptr<ANode>;
+    auto readOptimisticNode(NodeOffset fileOffset, uint64_t version, bool mayBeFreed = false) -> OptimisticNode;
+    auto createNode(NodeType nodeType) -> std::shared_ptr<ANode>;
     auto AllocateDiskMemory(NodeType nodeType) -> size_t;
+    auto freeNode(std::shared_ptr<ANode> const &node) -> void;
 
     // CRUD operations
-    auto createRecord(TKey const &key, TValue const &value) -> void;
+    auto createRecord(TKey const &key, TValue const &value) -> InsertStatus;
+    auto createRecords(std::span<std::pair<TKey, TValue> const> records) -> std::vector<InsertStatus>;
     auto readRecord(TKey const &key) -> std::optional<TValue>;
     auto updateRecord(TKey const &key, TValue const &value) -> void;
     auto deleteRecord(TKey const &key) -> void;
+    template<typename TIterator> auto bulkLoad(TIterator first, TIterator last, double fillFactor = 1.0) -> uint64_t;
 
     auto findProperDescendantOffset(std::shared_ptr<ANode> node, TKey const &key) -> NodeOffset;
-    auto findProperLeaf(TKey const &key) -> std::shared_ptr<ALeafNode>;
+    // change done by operation in found leaf, decides whether ancestors of leaf can be released before it ends
+    enum class LeafChange { INSERT, INSERT_MANY, DELETE, UPDATE };
+    auto findProperLeaf(TKey const &key, LeafChange change = LeafChange::INSERT_MANY,
+                        std::optional<TKey> *upperBound = nullptr) -> std::shared_ptr<ALeafNode>;
+    auto findLeafOptimistic(TKey const &key, bool after = false, std::optional<TKey> *upperBound = nullptr,
+                            std::vector<OptimisticNode> *path = nullptr) -> OptimisticNode;
+    template<typename TConsumer> auto scanRange(TKey const &lowKey, TKey const &highKey, TConsumer &&consumer) -> void;
+    auto lowerBound(TKey const &key) -> ForwardIterator { return seek(key, false); }
+    auto upperBound(TKey const &key) -> ForwardIterator { return seek(key, true); }
+    auto range(TKey const &lowKey, TKey const &highKey) -> Range;
+    auto snapshot() -> Snapshot;
+
+    using RecordConsumer = std::function<void(TKey const &key, TValue const &value)>;
+    // called concurrently by parallel scan with index of calling thread
+    using WorkerRecordConsumer = std::function<void(size_t worker, TKey const &key, TValue const &value)>;
+    auto parallelScan(size_t threadsCount, WorkerRecordConsumer const &consumer) -> void;
+    auto forEachRecordParallel(size_t threadsCount, RecordConsumer const &consumer) -> void;
 
     auto tryCompensateAndAdd(std::shared_ptr<ANode> node,
                              TKey const *key = nullptr,
@@ -91,11 +234,17 @@ public:
 
     auto splitAndAddRecord(std::shared_ptr<ANode> node,
                            TKey const &key, TValue const &value, size_t addedNodeOffset = 0) -> void;
-    auto merge(std::shared_ptr<ANode> node, TKey const *key = nullptr) -> void;
+    auto addRecords(std::shared_ptr<ALeafNode> const &leaf, std::vector<std::pair<TKey, TValue>> const &records) -> void;
+    auto addEntries(std::shared_ptr<AInnerNode> const &node, std::vector<std::pair<TKey, NodeOffset>> const &entries)
+    -> void;
+    auto addEntriesToParent(std::shared_ptr<ANode> const &node, std::vector<std::pair<TKey, NodeOffset>> const &entries)
+    -> void;
+    auto merge(std::shared_ptr<ANode> node) -> void;
     auto getNodeNeighbours(std::shared_ptr<ANode> node) -> std::pair<std::shared_ptr<ANode>, std::shared_ptr<ANode>>;
+    auto parentOf(ANode const &node) -> std::shared_ptr<AInnerNode>;
     auto getFirstLeaf() -> std::shared_ptr<ALeafNode>;
     auto getLastLeaf() -> std::shared_ptr<ALeafNode>;
-    auto unload() -> void { root->unload(), updateConfigHeader(); }
+    auto unload() -> void;
 
 
     auto draw() -> void;
@@ -113,9 +262,27 @@ public:
     auto getSessionDiskWritesCount() const -> uint64_t { return sessionDiskWritesCount; }
     auto getCurrentOperationDiskReadsCount() const -> uint64_t { return currentOperationDiskReadsCount; }
     auto getCurrentOperationDiskWritesCount() const -> uint64_t { return currentOperationDiskWritesCount; }
+    auto getSessionNodeWritesCount() const -> uint64_t { return sessionNodeWritesCount; }
+    auto getCurrentOperationNodeWritesCount() const -> uint64_t { return currentOperationNodeWritesCount; }
+    // hits and misses are counted by shards of buffer pool, counters of tree keep their values from the beginning
+    auto getSessionCacheHitsCount() const -> uint64_t { return bufferPool.getHitsCount() - sessionCacheHitsStart; }
+    auto getSessionCacheMissesCount() const -> uint64_t {
+        return bufferPool.getMissesCount() - sessionCacheMissesStart;
+    }
+    auto getCurrentOperationCacheHitsCount() const -> uint64_t {
+        return bufferPool.getHitsCount() - operationCacheHitsStart;
+    }
+    auto getCurrentOperationCacheMissesCount() const -> uint64_t {
+        return bufferPool.getMissesCount() - operationCacheMissesStart;
+    }
+    auto getSessionChecksumFailuresCount() const -> uint64_t { return sessionChecksumFailuresCount; }
+    auto getReadaheadStats() const -> ReadaheadStats const & { return readaheadStats; }
+    auto getBufferPool() const -> BufferPool<ANode> const & { return bufferPool; }
+    auto getFileSize() const -> size_t { return file.size(); }
     auto getHeight() -> uint64_t;
     auto getRecordsNumber() -> uint64_t;
     auto getNodesCount() -> std::pair<uint64_t, uint64_t>;
+    auto empty() const -> bool { return root->nodeType() == NodeType::LEAF && root->fillKeysSize() == 0; }
     auto disableCounters() -> void { countersEnabled = false; }
     auto enableCounters() -> void { countersEnabled = true; }
 
@@ -127,22 +294,200 @@ public:
 
 private:
     auto getNodesCount(std::shared_ptr<ANode> node, std::pair<uint64_t, uint64_t> &counters) -> void;
-    auto resetOpCounters() -> void { currentOperationDiskWritesCount = currentOperationDiskReadsCount = 0; }
+    auto resetOpCounters() -> void {
+        currentOperationDiskWritesCount = currentOperationDiskReadsCount = currentOperationNodeWritesCount = 0;
+        operationCacheHitsStart = bufferPool.getHitsCount();
+        operationCacheMissesStart = bufferPool.getMissesCount();
+    }
     auto incrementWriteOperationsCounters() -> void;
+    auto incrementNodeWritesCounters(size_t count) -> void;
     auto incrementReadOperationsCounters() -> void;
     auto resetCounters() -> void;
     auto updateConfigHeader() -> void;
+    auto updateFreeSpaceHeader() -> void;
+    auto freeListHead(NodeType nodeType) -> uint64_t &;
+    auto firstNodeOffset() const -> NodeOffset;
+    auto nodeSlotSize(NodeType nodeType) const -> size_t;
+    static auto nodeDataSize(NodeType nodeType) -> size_t;
+    auto writeHeadersPage() -> void;
+    template<typename TNode> auto newNode(NodeOffset offset) -> std::shared_ptr<TNode>;
+    static auto CheckDegrees(ConfigHeader const &configHeader) -> void;
+    template<typename TOperation> auto runOperation(TOperation &&operation) -> void;
+    auto beginOperation() -> void;
+    auto abortOperation() -> void;
+    auto trackNode(std::shared_ptr<ANode> const &node) -> void;
+    static auto LatchIndex(NodeOffset offset) -> size_t;
+    auto latchNode(NodeOffset offset) -> void;
+    auto releaseLatches(std::initializer_list<NodeOffset> keptNodes) -> void;
+    auto readVersion(NodeOffset offset) -> uint64_t;
+    auto versionValid(NodeOffset offset, uint64_t version) -> bool;
+    auto isNodeSafe(ANode const &node, LeafChange change) const -> bool;
+    template<typename TChange> auto tryChangeLeaf(TKey const &key, LeafChange change, TChange &&changeLeaf) -> bool;
+    auto splitLeaf(TKey const &key, TValue const &value) -> std::optional<InsertStatus>;
+    static auto WaitForSplit(ANode const &node) -> void;
+    static auto RightLinkFor(ANode const &node, TKey const &key, bool after) -> NodeOffset;
+    auto readRecordAlongLeaves(TKey const &key, NodeOffset leafOffset) -> std::optional<TValue>;
+    auto setRoot(std::shared_ptr<ANode> const &node) -> void;
+    auto readersActive() const -> bool;
+    auto reclaimNodes() -> void;
+    auto saveVersion(std::shared_ptr<ANode> const &node) -> void;
+    auto addVersion(ANode &node) -> void;
+    auto commitVersions(OffsetsSet const &offsets, bool withRoot = true) -> void;
+    auto collectVersions() -> void;
+    auto snapshotRootOffset(uint64_t timestamp) -> NodeOffset;
+    auto readSnapshotNode(NodeOffset fileOffset, uint64_t timestamp) -> OptimisticNode;
+    auto snapshotNodeValid(OptimisticNode const &node) -> bool;
+    auto findLeafInSnapshot(TKey const &key, uint64_t timestamp, bool after = false,
+                            std::optional<TKey> *upperBound = nullptr) -> OptimisticNode;
+    static auto SuperblockOffset(FileFormat format, uint64_t sequence) -> NodeOffset;
+    static auto ReadSuperblock(File &file, NodeOffset offset) -> std::optional<Superblock>;
+    auto writeSuperblock() -> void;
+    auto findFreeSlots() -> void;
+    auto freeSlots(NodeType nodeType) -> std::vector<NodeOffset> &;
+    static auto CopyNode(ANode &source, ANode &target) -> void;
+    auto shadowNode(std::shared_ptr<ANode> const &node) -> std::shared_ptr<ANode>;
+    auto releaseShadowNodes() -> void;
+    auto adjacentLeafOffset(ALeafNode const &leaf, bool next) -> NodeOffset;
+    auto seek(TKey const &key, bool skipEqual) -> ForwardIterator;
+    auto scanPartitions(size_t minCount) -> std::vector<NodeOffset>;
+    auto makeScanWorkers(size_t count) -> std::vector<std::unique_ptr<ScanWorker>>;
+    auto finishScan(std::vector<std::unique_ptr<ScanWorker>> const &workers) -> void;
+    static auto NodeTypeOf(size_t fileOffset, char const *readData, size_t readSize) -> NodeType;
+    auto linkLeafAfter(std::shared_ptr<ANode> const &leaf, std::shared_ptr<ANode> const &newLeaf) -> void;
+    auto linkInnerAfter(AInnerNode &node, AInnerNode &newNode) -> void;
+    auto updateHighKeys(AInnerNode &node, TKey const *highKey, bool boundsChanged) -> void;
+    auto unlinkLeaf(std::shared_ptr<ANode> const &leaf) -> void;
+    auto flushOperation() -> void;
+    auto writeNodes(std::span<std::shared_ptr<ANode> const> nodes, bool withHeaders) -> void;
+    auto attachLog(Durability durability) -> void;
+    auto commitOperation() -> void;
+    auto commitChanges(std::span<std::shared_ptr<ANode> const> nodes, bool withHeaders) -> void;
 
 
     uint64_t sessionDiskReadsCount = 0;
     uint64_t sessionDiskWritesCount = 0;
     uint64_t currentOperationDiskReadsCount = 0;
     uint64_t currentOperationDiskWritesCount = 0;
+    uint64_t sessionNodeWritesCount = 0;
+    uint64_t currentOperationNodeWritesCount = 0;
+    uint64_t sessionCacheHitsStart = 0;
+    uint64_t sessionCacheMissesStart = 0;
+    uint64_t operationCacheHitsStart = 0;
+    uint64_t operationCacheMissesStart = 0;
+    uint64_t sessionChecksumFailuresCount = 0;
     bool countersEnabled = true;
     fs::path filePath;
+    std::unique_ptr<WriteAheadLog> log;
     File file;
+    BufferPool<ANode> bufferPool;
     std::shared_ptr<ANode> root;
     ConfigHeader configHeader;
+    FreeSpaceHeader freeSpaceHeader;
+    FileFormat format = FileFormat::SLOTTED;
+    NodeOffset fileEnd = 0;
+    // nodes used by current operation, changed ones are written when it ends
+    std::map<NodeOffset, std::shared_ptr<ANode>, std::less<>,
+             PoolAllocator<std::pair<NodeOffset const, std::shared_ptr<ANode>>>> operationNodes;
+    bool operationActive = false;
+    bool headersChanged = false;
+    // state of tree kept only in memory when current operation began, it is restored if operation fails
+    struct OperationStart {
+        ConfigHeader configHeader;
+        FreeSpaceHeader freeSpaceHeader;
+        NodeOffset fileEnd = 0;
+        size_t retiredNodesCount = 0;
+        std::vector<NodeOffset> freeLeafSlots;
+        std::vector<NodeOffset> freeInnerSlots;
+    };
+    OperationStart operationStart;
+    // buffers reused by every write of nodes, they are guarded by nodesMutex
+    std::vector<std::shared_ptr<ANode>> changedNodes;
+    std::vector<ANode *> writtenNodes;
+    std::vector<char> writeBuffer;
+    std::vector<IoRequest> writeRequests;
+    // buffers reused by batched reads of nodes, they are guarded by nodesMutex
+    std::vector<size_t> readMissing;
+    std::vector<char> readBuffer;
+    std::vector<IoRequest> readRequests;
+    // neighbours read by current operation
+    std::vector<std::shared_ptr<ANode>> neighbourNodes;
+    size_t readaheadWindow = 0;
+    size_t scanThreads = 1;
+    ReadaheadStats readaheadStats;
+
+    // Records are read without latches (readRecord and scanRange) and changed within single leaf by many threads,
+    // full leaves are split by many threads as well (B-link tree, see splitLeaf), while one thread at a time does
+    // operations changing structure of tree otherwise. Other functions require exclusive access to tree. Readers
+    // check that versions of latches of nodes they read didn't change meanwhile.
+    struct alignas(64) Latch {
+        std::mutex mutex;
+        std::atomic<uint64_t> version = 0; // odd while latch is held
+        bool held = false; // held by current operation, used only by thread running it
+    };
+    std::array<Latch, LatchesCount> latches;
+    std::atomic<ANode *> rootNode = nullptr; // root used by threads which don't hold its latch
+    std::vector<size_t> heldLatches; // indices of latches kept by operation, its capacity is reused
+    std::shared_mutex structureMutex; // held exclusively by operations, splits of leaves share it
+    std::recursive_mutex nodesMutex; // guards buffer pool, file, counters and retired nodes
+
+    // Nodes changed outside of operations are committed in groups: thread which finds no commit in progress writes
+    // nodes of all threads waiting for commit with single batch and commits them to log at once, the rest wait for
+    // it. Once a commit fails, all later ones fail with the same error
+    std::mutex commitMutex;
+    std::condition_variable commitDone;
+    std::vector<std::shared_ptr<ANode>> pendingNodes; // nodes of next group, capacities of both vectors are reused
+    std::vector<std::shared_ptr<ANode>> committedNodes; // nodes of group being committed, used by its committer only
+    bool pendingHeaders = false;
+    bool commitRunning = false;
+    uint64_t pendingGroup = 1; // number of group which collects changes
+    uint64_t committedGroup = 0;
+    uint64_t failedGroup = std::numeric_limits<uint64_t>::max();
+    std::exception_ptr commitError;
+
+    // Nodes which threads reading without latches may still use are retired instead of being freed, they are
+    // reclaimed once every thread which could reach them leaves its epoch
+    struct alignas(64) EpochSlot { std::atomic<uint64_t> epoch = 0; }; // 0 if slot isn't used by any thread
+    struct RetiredNode {
+        uint64_t epoch;
+        std::shared_ptr<ANode> node;
+        bool freed; // slot of freed node is put on free list when node is reclaimed, other nodes are only kept
+    };
+    std::array<EpochSlot, EpochSlotsCount> epochSlots;
+    std::atomic<uint64_t> globalEpoch = 1;
+    std::vector<RetiredNode> retiredNodes;
+
+    // Versions of nodes saved for snapshots by writes done while any snapshot exists. Saved version is content of
+    // node before write which ended it, versions of every node are kept in order of end timestamps of their writes
+    // (timestamp is assigned when write is committed, the last version of node may still be pending).
+    // Version is collected once no snapshot is older than its end timestamp
+    static constexpr uint64_t PendingTimestamp = std::numeric_limits<uint64_t>::max();
+    struct NodeVersion {
+        uint64_t endTimestamp;
+        std::shared_ptr<ANode> node;
+    };
+    struct RootVersion {
+        uint64_t endTimestamp;
+        NodeOffset rootOffset;
+    };
+    std::map<NodeOffset, std::deque<NodeVersion>> nodeVersions;
+    std::vector<RootVersion> rootVersions;
+    std::deque<std::pair<uint64_t, NodeOffset>> committedVersions; // in order of commits, oldest are collected first
+    std::multiset<uint64_t> snapshotTimestamps;
+    uint64_t lastCommitTimestamp = 0;
+    std::mutex versionsMutex; // guards versions and timestamps, it is locked after nodesMutex
+    std::atomic<size_t> snapshotsCount = 0;
+    std::atomic<size_t> unversionedWritesCount = 0; // writes which don't save versions, snapshot waits for them
+    OffsetsSet versionedNodes; // nodes whose versions were saved by current operation
+    bool operationVersioned = false;
+
+    // Shadow paging (see Durability::SHADOW): nodes of committed tree are never overwritten, so leaves aren't linked
+    // and free slots are kept only in memory (slots not reachable from committed root are found when file is opened)
+    bool shadowPaging = false;
+    uint64_t superblockSequence = 0;
+    OffsetsSet shadowSlots; // slots allocated by current operation, nodes in them are written in place
+    std::vector<std::shared_ptr<ANode>> shadowReleasedNodes; // nodes replaced by copies, released after commit
+    std::vector<NodeOffset> freeLeafSlots;
+    std::vector<NodeOffset> freeInnerSlots;
 };
 
 
@@ -173,11 +518,15 @@ protected:
     auto dec() -> void; // x++
 
 
+    auto readLeaf(NodeOffset offset) -> void;
+
+
     bool afterEnd = false;
     bool beforeBegin = false;
     std::shared_ptr<ALeafNode> node = nullptr;
     size_t i = 0;
     BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree> *tree = nullptr;
+    std::shared_ptr<Readahead> readahead; // shared by copies of iterator
 };
 
 
@@ -253,6 +602,261 @@ public:
 };
 
 
+/**
+ * Records with keys from closed range, can be iterated with range based for loop
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+class BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::Range {
+public:
+    Range(ForwardIterator first, ForwardIterator last) : first(std::move(first)), last(std::move(last)) {}
+
+    auto begin() const -> ForwardIterator { return first; }
+    auto end() const -> ForwardIterator { return last; }
+    auto empty() const -> bool { return first == last; }
+
+private:
+    ForwardIterator first;
+    ForwardIterator last;
+};
+
+
+/**
+ * Reads subtrees for parallel scan with its own descriptor of db file, nodes aren't put into buffer pool.
+ * Nodes have to be constructed by thread which creates worker (they update global counters of nodes)
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+class BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::ScanWorker {
+public:
+    explicit ScanWorker(fs::path const &filePath)
+            : file(filePath, std::ios::binary | std::ios::in, [this] { ++this->readsCount; }, [] {}),
+              leaf(0, file), innerNode(0, file) {
+        if (file.bad()) throw std::runtime_error("Couldn't open file: " + fs::absolute(filePath).string());
+    }
+
+    template<typename TConsumer> auto scan(std::vector<NodeOffset> const &offsets, TConsumer const &consumer) -> void;
+
+    uint64_t readsCount = 0;
+
+private:
+    File file;
+    ALeafNode leaf;
+    AInnerNode innerNode; // used by all levels, its descendants are copied before they are scanned
+};
+
+
+/**
+ * Calls consumer for all records of subtrees in order by key, nodes of each level are read with single batch
+ * @param offsets roots of subtrees
+ * @param consumer
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+template<typename TConsumer>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::ScanWorker::scan(std::vector<NodeOffset> const &offsets,
+                                                                                  TConsumer const &consumer) -> void {
+    auto const slotSize = sizeof(char) + std::max(AInnerNode::BytesSize(), ALeafNode::BytesSize());
+    std::vector<char> buffer(slotSize * offsets.size());
+    std::vector<IoRequest> batch;
+    for (size_t i = 0; i < offsets.size(); ++i)
+        batch.push_back({IoRequest::Type::READ, offsets[i], buffer.data() + i * slotSize, slotSize});
+    this->file.submit(batch);
+    this->file.clear();
+    for (auto const &request : batch) {
+        auto nodeType = BPlusTree::NodeTypeOf(request.offset, request.data, request.result);
+        if (!ANode::ChecksumValid(request.data, BPlusTree::nodeDataSize(nodeType)))
+            throw std::runtime_error("Checksum mismatch, node at: " + std::to_string(request.offset) + " is corrupted");
+        if (nodeType == NodeType::LEAF) {
+            this->leaf.load(request.data + sizeof(char));
+            for (size_t i = 0; i < this->leaf.fillKeysSize(); ++i)
+                consumer(this->leaf.getKey(i), this->leaf.getValue(i));
+        } else {
+            this->innerNode.load(request.data + sizeof(char));
+            this->scan(this->innerNode.getEntries().second, consumer);
+        }
+    }
+}
+
+
+/**
+ * Announces that thread reads tree without latches, nodes retired after guard is created are not reclaimed until
+ * it is destroyed. Guard occupies one of epoch slots of tree, thread waits if all of them are used
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+class BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::EpochGuard {
+public:
+    explicit EpochGuard(BPlusTree *tree);
+    EpochGuard(EpochGuard const &) = delete;
+    EpochGuard &operator=(EpochGuard const &) = delete;
+    ~EpochGuard() { this->slot->epoch.store(0); }
+
+private:
+    EpochSlot *slot = nullptr;
+};
+
+
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::EpochGuard::EpochGuard(BPlusTree *tree) {
+    // threads start looking for free slot at different ones
+    thread_local auto const firstSlot = std::hash<std::thread::id>()(std::this_thread::get_id());
+    for (size_t i = 0;; ++i) {
+        auto &candidate = tree->epochSlots[(firstSlot + i) % EpochSlotsCount];
+        uint64_t unused = 0;
+        if (candidate.epoch.load() == 0 && candidate.epoch.compare_exchange_strong(unused, tree->globalEpoch.load())) {
+            this->slot = &candidate;
+            return;
+        }
+        if ((i + 1) % EpochSlotsCount == 0) std::this_thread::yield();
+    }
+}
+
+
+/**
+ * Marks write to tree done by current thread. Write saves versions of nodes it changes if any snapshot existed when
+ * it started, snapshot taken meanwhile waits until writes which don't save them end
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+class BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::VersionedWrite {
+public:
+    explicit VersionedWrite(BPlusTree *tree);
+    VersionedWrite(VersionedWrite const &) = delete;
+    VersionedWrite &operator=(VersionedWrite const &) = delete;
+    ~VersionedWrite() { if (!this->versioned) --this->tree->unversionedWritesCount; }
+
+    bool versioned = false;
+
+private:
+    BPlusTree *tree;
+};
+
+
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::VersionedWrite::VersionedWrite(BPlusTree *tree)
+        : tree(tree) {
+    // write is counted before snapshots are checked, so either it sees snapshot or snapshot waits for it
+    ++tree->unversionedWritesCount;
+    if (tree->snapshotsCount.load() == 0) return;
+    --tree->unversionedWritesCount;
+    this->versioned = true;
+}
+
+
+/**
+ * Consistent view of records at the moment it was taken, changes committed later aren't seen. Snapshot doesn't block
+ * writers: nodes changed after it was taken are read from versions saved by their writes, other ones are read
+ * without latches like by readRecord. Snapshot can be used by many threads, it has to be destroyed before tree
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+class BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::Snapshot {
+public:
+    explicit Snapshot(BPlusTree *tree);
+    Snapshot(Snapshot const &) = delete;
+    Snapshot &operator=(Snapshot const &) = delete;
+    ~Snapshot();
+
+    auto readRecord(TKey const &key) const -> std::optional<TValue>;
+    template<typename TConsumer> auto scanRange(TKey const &lowKey, TKey const &highKey, TConsumer &&consumer) const
+    -> void;
+    auto getTimestamp() const -> uint64_t { return timestamp; }
+
+private:
+    BPlusTree *tree;
+    uint64_t timestamp = 0; // commit timestamp of the last write seen by snapshot
+};
+
+
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::Snapshot::Snapshot(BPlusTree *tree) : tree(tree) {
+    ++tree->snapshotsCount;
+    // writes which started before don't save versions of nodes, they have to be committed first
+    while (tree->unversionedWritesCount.load() != 0) std::this_thread::yield();
+    std::lock_guard lock(tree->versionsMutex);
+    this->timestamp = tree->lastCommitTimestamp;
+    tree->snapshotTimestamps.insert(this->timestamp);
+}
+
+
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::Snapshot::~Snapshot() {
+    std::lock_guard lock(this->tree->versionsMutex);
+    this->tree->snapshotTimestamps.erase(this->tree->snapshotTimestamps.find(this->timestamp));
+    --this->tree->snapshotsCount;
+    this->tree->collectVersions();
+}
+
+
+/**
+ * Reads record as it was when snapshot was taken
+ * @param key
+ * @return optional record, nullopt if didn't exist
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::Snapshot::readRecord(TKey const &key) const
+-> std::optional<TValue> {
+    EpochGuard guard(this->tree);
+    while (true) {
+        auto leaf = this->tree->findLeafInSnapshot(key, this->timestamp);
+        auto result = static_cast<ALeafNode const *>(leaf.node)->readRecord(key);
+        if (this->tree->snapshotNodeValid(leaf)) return result;
+    }
+}
+
+
+/**
+ * Calls consumer for records with keys from lowKey to highKey (both inclusive) which existed when snapshot was
+ * taken, in order by key. Leaves are followed by their links (or found by separators in shadow file), leaf changed
+ * while it is read is read again
+ * @param lowKey
+ * @param highKey
+ * @param consumer called with key and value of record, returns false to stop scan
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+template<typename TConsumer>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::Snapshot::scanRange(TKey const &lowKey,
+                                                                                     TKey const &highKey,
+                                                                                     TConsumer &&consumer) const
+-> void {
+    if (highKey < lowKey) return;
+    EpochGuard guard(this->tree);
+    std::optional<TKey> bound; // separator following current leaf, leaves of shadow file are found by it
+    auto leaf = this->tree->findLeafInSnapshot(lowKey, this->timestamp, false, &bound);
+    auto first = true;
+    std::vector<std::pair<TKey, TValue>> records;
+    while (true) {
+        auto leafOffset = leaf.node->fileOffset;
+        // slot of current node read meanwhile could be reused by other type of node
+        if (leaf.node->nodeType() != NodeType::LEAF) {
+            leaf = this->tree->readSnapshotNode(leafOffset, this->timestamp);
+            continue;
+        }
+        auto leafNode = static_cast<ALeafNode const *>(leaf.node);
+        auto count = std::min<size_t>(leafNode->count, 2 * TLeafNodeDegree);
+        auto index = first ? NodeSearch::LowerBound<2 * TLeafNodeDegree>(leafNode->keys.data(), count, lowKey) : 0;
+        auto finished = false;
+        records.clear();
+        for (; index < count && !finished; ++index) {
+            finished = highKey < leafNode->keys[index];
+            if (!finished) records.emplace_back(leafNode->keys[index], leafNode->getValue(index));
+        }
+        auto nextOffset = leafNode->nextLeafOffset;
+        if (!this->tree->snapshotNodeValid(leaf)) {
+            leaf = this->tree->readSnapshotNode(leafOffset, this->timestamp);
+            continue;
+        }
+        for (auto const &[key, value] : records)
+            if (!consumer(key, value)) return;
+        first = false;
+        if (finished) return;
+        if (this->tree->shadowPaging) {
+            if (!bound) return;
+            auto separator = *bound;
+            leaf = this->tree->findLeafInSnapshot(separator, this->timestamp, true, &bound);
+            continue;
+        }
+        if (nextOffset == 0) return;
+        leaf = this->tree->readSnapshotNode(nextOffset, this->timestamp);
+    }
+}
+
+
 template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
 BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::Iterator::Iterator(
         std::shared_ptr<ALeafNode> node,
@@ -262,7 +866,23 @@ BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::Iterator::Iterator(
           node(std::move(node)),
           i(0),
           tree(std::move(tree)) {
+    if (this->tree->readaheadWindow == 0) return;
+    // scans done while counters are disabled (e.g. by statistics) are not counted
+    auto stats = this->tree->countersEnabled ? &this->tree->readaheadStats : nullptr;
+    this->readahead = std::make_shared<Readahead>(this->tree->file, stats, this->tree->readaheadWindow);
+    this->readahead->access(this->node->fileOffset, BPlusTree::nodeDataSize(NodeType::LEAF));
+}
+
 
+/**
+ * Moves iterator to leaf at given offset, read is reported to readahead
+ * @param offset
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::Iterator::readLeaf(NodeOffset offset) -> void {
+    node = nullptr; // unload old node to release memory
+    node = std::dynamic_pointer_cast<ALeafNode>(tree->readNode(offset));
+    if (readahead) readahead->access(offset, BPlusTree::nodeDataSize(NodeType::LEAF));
 }
 
 
@@ -274,44 +894,19 @@ auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::Iterator::inc()
         return;
     }
     // next record is in the same node
-    if (i < this->node->keys.size() - 1 && this->node->keys[i + 1] != std::nullopt) {
+    if (i + 1 < this->node->fillKeysSize()) {
         i++;
         return;
     }
 
-    // if no parent then afterEnd iterator
-    if (node->parent == nullptr) {
+    // last leaf
+    auto nextOffset = tree->adjacentLeafOffset(*node, true);
+    if (nextOffset == 0) {
         afterEnd = true;
         return;
     }
-    std::shared_ptr<ANode> tmpNodePtr = this->node;
-
-
-    // go up and search first right neighbour, if so get most left node
-    while (true) {
-        if (tmpNodePtr->parent == nullptr) {
-            afterEnd = true;
-            return;
-        }
-
-        auto parent = std::dynamic_pointer_cast<AInnerNode>(tmpNodePtr->parent);
-        auto nextDescendantOffset = parent->getNextDescendantOffset(tmpNodePtr->fileOffset);
-        if (nextDescendantOffset) {
-            node = nullptr; // unload old node to release memory
-            auto nextNode = tree->readNode(*nextDescendantOffset);
-            nextNode->parent = parent;
-            while (nextNode->nodeType() != NodeType::LEAF) {
-                auto innerNode = std::dynamic_pointer_cast<AInnerNode>(nextNode);
-                nextNode = tree->readNode(*innerNode->descendants[0]);
-                nextNode->parent = innerNode;
-            }
-            node = std::dynamic_pointer_cast<ALeafNode>(nextNode);
-            i = 0;
-            return;
-        }
-        tmpNodePtr = parent;
-    }
-
+    readLeaf(nextOffset);
+    i = 0;
 }
 
 
@@ -323,49 +918,19 @@ auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::Iterator::dec()
         return;
     }
 // prev record is in the same node
-    if (i > 0 && this->node->keys[i - 1] != std::nullopt) {
+    if (i > 0) {
         i--;
         return;
     }
 
-// if no parent then beforeBegin iterator
-    if (node->parent == nullptr) {
+// first leaf
+    auto prevOffset = tree->adjacentLeafOffset(*node, false);
+    if (prevOffset == 0) {
         beforeBegin = true;
         return;
     }
-    std::shared_ptr<ANode> tmpNodePtr;
-    tmpNodePtr = this->node;
-
-
-// go up and search first left neighbour, if so get most left node
-    while (true) {
-        if (tmpNodePtr->parent == nullptr) {
-            beforeBegin = true;
-            return;
-        }
-
-        auto parent = std::dynamic_pointer_cast<AInnerNode>(tmpNodePtr->parent);
-        auto prevDescendantOffset = parent->getPrevDescendantOffset(tmpNodePtr->fileOffset);
-        if (prevDescendantOffset) {
-            node = nullptr; // unload old node to release memory
-            auto nextNode = tree->readNode(*prevDescendantOffset);
-            nextNode->
-                    parent = parent;
-            while (nextNode->
-                    nodeType()
-                   != NodeType::LEAF) {
-                auto innerNode = std::dynamic_pointer_cast<AInnerNode>(nextNode);
-                nextNode = tree->readNode(innerNode->getLastDescendantOffset());
-                nextNode->
-                        parent = innerNode;
-            }
-            node = std::dynamic_pointer_cast<ALeafNode>(nextNode);
-            i = node->getLastRecordIndex();
-            return;
-        }
-        tmpNodePtr = parent;
-    }
-
+    readLeaf(prevOffset);
+    i = node->getLastRecordIndex();
 }
 
 
@@ -375,12 +940,10 @@ auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::Iterator::opera
         throw std::out_of_range("Tree iterator out of range: afterEnd");
     if (beforeBegin)
         throw std::out_of_range("Tree iterator out of range: beforeBegin");
-    auto key = this->node->keys[i];
-    auto val = this->node->values[i];
-    if (!key || !val) {
+    if (i >= this->node->fillKeysSize()) {
         throw std::runtime_error("Internal DB error: next (key, value) not found");
     }
-    return std::pair(*key, *val);
+    return std::pair(this->node->getKey(i), this->node->getValue(i));
 }
 
 
@@ -395,7 +958,8 @@ auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::Iterator::opera
         return false;
     if (this->beforeBegin != other.beforeBegin)
         return false;
-    if (this->node == other.node && this->i == other.i)
+    // the same leaf is read again if it isn't kept by buffer pool, so its offset is compared
+    if (this->node->fileOffset == other.node->fileOffset && this->i == other.i)
         return true;
     return false;
 
@@ -403,11 +967,14 @@ auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::Iterator::opera
 
 
 template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
-BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::BPlusTree(fs::path filePath, OpenMode openMode)
-        : filePath(std::move(filePath)), configHeader() {
+BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::BPlusTree(fs::path filePath, OpenMode openMode,
+                                                                      TreeOptions const &options)
+        : filePath(std::move(filePath)), bufferPool(options.bufferPoolSize), configHeader(),
+          readaheadWindow(options.readaheadWindow), scanThreads(options.scanThreads) {
 
     Tools::debug([] { std::clog << "L: " << ALeafNode::BytesSize() << " I: " << AInnerNode::BytesSize() << '\n'; });
     ANode::ResetCounters();
+    BlockPool::UseHugePages(options.hugePages);
     switch (openMode) {
         case OpenMode::USE_EXISTING:
             if (!fs::is_regular_file(this->filePath))
@@ -415,32 +982,84 @@ BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::BPlusTree(fs::path f
             Tools::debug([this] { std::clog << "Opening file: " << fs::absolute(this->filePath) << '\n'; });
             this->file = File(this->filePath, std::ios::binary | std::ios::out | std::ios::in | std::ios::ate,
                               [this] { this->incrementReadOperationsCounters(); },
-                              [this] { this->incrementWriteOperationsCounters(); });
+                              [this] { this->incrementWriteOperationsCounters(); },
+                              options.fileBackend);
             if (this->file.bad())
                 throw std::runtime_error("Couldn't open file: " + fs::absolute(this->filePath).string() + '\n');
+            this->file.setLogicalWritesCallback([this](size_t count) { this->incrementNodeWritesCounters(count); });
+            if (auto recovered = WriteAheadLog::Recover(WriteAheadLog::PathFor(this->filePath), this->file))
+                std::cout << "Recovered " << recovered << " operations from log\n";
             this->configHeader = this->file.template read<ConfigHeader>(0);
-            if (configHeader.leafNodeDegree != TLeafNodeDegree || configHeader.innerNodeDegree != TInnerNodeDegree) {
-                throw std::runtime_error("Degrees of nodes are incorrect for current program.\n"s +
-                                         "Used by program: <"s + std::to_string(TInnerNodeDegree) +
-                                         ", " + std::to_string(TLeafNodeDegree) + ">\nIn File: <" +
-                                         std::to_string(configHeader.innerNodeDegree) + ", " +
-                                         std::to_string(configHeader.leafNodeDegree) + ">");
+            this->fileEnd = this->file.size();
+            this->freeSpaceHeader = this->file.template read<FreeSpaceHeader>(sizeof(ConfigHeader));
+            this->file.clear();
+            if (this->freeSpaceHeader.magic == FreeSpaceHeader::PagedMagic) {
+                this->format = FileFormat::PAGED;
+                this->file.setPageSize(PageSize);
+            } else if (this->freeSpaceHeader.magic != FreeSpaceHeader::Magic) {
+                // the first superblock of shadow file could be torn by crash, so both of them are read
+                std::optional<Superblock> superblock;
+                for (auto offset : {SuperblockOffset(FileFormat::SLOTTED, 0), SuperblockOffset(FileFormat::SLOTTED, 1),
+                                    SuperblockOffset(FileFormat::PAGED, 1)}) {
+                    auto candidate = ReadSuperblock(this->file, offset);
+                    if (candidate && (!superblock || superblock->sequence < candidate->sequence)) superblock = candidate;
+                }
+                if (!superblock)
+                    throw std::runtime_error("File was created by older version of program, convert it with: "
+                                             "migrate " + this->filePath.string() + " <new file>");
+                this->shadowPaging = true;
+                this->configHeader = superblock->configHeader;
+                this->freeSpaceHeader = FreeSpaceHeader{superblock->magic};
+                this->superblockSequence = superblock->sequence;
+                this->fileEnd = superblock->fileEnd;
+                if (this->freeSpaceHeader.magic == FreeSpaceHeader::PagedShadowMagic) {
+                    this->format = FileFormat::PAGED;
+                    this->file.setPageSize(PageSize);
+                }
             }
-            this->root = BPlusTree::readNode(configHeader.rootOffset);
+            CheckDegrees(this->configHeader);
+            if (options.durability == Durability::SHADOW && !this->shadowPaging)
+                throw std::runtime_error("Shadow paging is used only by files created with it, choose other "
+                                         "durability level or migrate file after changing it");
+            // shadow file is consistent after every commit, so it never uses log
+            this->attachLog(this->shadowPaging ? Durability::SHADOW : options.durability);
+            if (options.fileBackend == FileBackendType::DIRECT && this->format != FileFormat::PAGED)
+                throw std::runtime_error("Direct IO requires paged db file");
+            this->setRoot(BPlusTree::readNode(configHeader.rootOffset));
+            if (this->shadowPaging) this->findFreeSlots();
             break;
 
         case OpenMode::CREATE_NEW:
             this->file = File(this->filePath, std::ios::binary | std::ios::out | std::ios::in | std::ios::trunc,
                               [this] { this->incrementReadOperationsCounters(); },
-                              [this] { this->incrementWriteOperationsCounters(); });
+                              [this] { this->incrementWriteOperationsCounters(); },
+                              options.fileBackend);
             if (!this->file.good())
                 throw std::runtime_error("Error creating file: " + fs::absolute(this->filePath).string());
+            this->file.setLogicalWritesCallback([this](size_t count) { this->incrementNodeWritesCounters(count); });
             Tools::debug([this] { std::clog << "Creating new db file: " << fs::absolute(this->filePath) << '\n'; });
-            this->root = std::make_shared<ALeafNode>(AllocateDiskMemory(NodeType::LEAF), this->file);
+            this->attachLog(options.durability);
+            this->shadowPaging = options.durability == Durability::SHADOW;
+            this->format = options.fileBackend == FileBackendType::DIRECT ? FileFormat::PAGED : options.fileFormat;
+            if (this->shadowPaging) this->freeSpaceHeader.magic = FreeSpaceHeader::ShadowMagic;
+            if (this->format == FileFormat::PAGED) {
+                if (nodeDataSize(NodeType::LEAF) > PageSize || nodeDataSize(NodeType::INNER) > PageSize)
+                    throw std::runtime_error("Nodes of current program don't fit in " + std::to_string(PageSize) +
+                                             " bytes page");
+                this->freeSpaceHeader.magic = this->shadowPaging ? FreeSpaceHeader::PagedShadowMagic
+                                                                 : FreeSpaceHeader::PagedMagic;
+                this->file.setPageSize(PageSize);
+            }
+            this->fileEnd = firstNodeOffset();
+            this->updateFreeSpaceHeader();
+            this->setRoot(createNode(NodeType::LEAF));
             this->updateConfigHeader();
+            // both superblocks are valid from the beginning
+            if (this->shadowPaging) this->writeSuperblock();
 
             break;
     }
+    this->commitOperation();
     Tools::debug([this] { std::clog << "Root: " << *this->root << '\n'; }, 3);
 }
 
@@ -448,443 +1067,2896 @@ BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::BPlusTree(fs::path f
 template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
 BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::~BPlusTree() {
     Tools::debug([this] { std::clog << "Closing db file:" << fs::absolute(this->filePath) << '\n'; });
+    if (!this->retiredNodes.empty()) this->runOperation([this] { this->reclaimNodes(); });
     this->updateConfigHeader();
+    if (!this->log) return;
+    // everything is written to db file and synced, so log is not needed anymore
+    this->unload();
+    this->file.checkpoint();
+    this->file.setLog(nullptr);
+    this->log = nullptr;
+    fs::remove(WriteAheadLog::PathFor(this->filePath));
 }
 
 
 /**
- * Reads node at specified offset and loads it
- * @param fileOffset
- * @return pointer to read and loaded node
+ * Reads all records of db file created by older version of program (which stored nodes as arrays of optional
+ * keys and descendants or values, without any magic), used to migrate it to current format
+ * @param filePath
+ * @param consumer called for every record in order by key
  */
 template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
-auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::readNode(size_t fileOffset) -> std::shared_ptr<ANode> {
-    char header;
-    auto readData = this->file.read(fileOffset,
-                                    sizeof(header) + std::max(AInnerNode::BytesSize(), ALeafNode::BytesSize()));
-    this->file.clear(); // since we read max of both nodes, we can go eof
-    header = readData[0];
-    readData.erase(readData.begin());
-    if (std::bitset<8>(header)[0] == true) // if node is empty
-        throw std::runtime_error("Tried to read empty node at: " + std::to_string(fileOffset));
-    std::shared_ptr<ANode> result = nullptr;
-    if (std::bitset<8>(header)[1] == static_cast<int>(NodeType::INNER)) // check node type
-        result = std::make_shared<AInnerNode>(fileOffset, this->file);
-    if (std::bitset<8>(header)[1] == static_cast<int>(NodeType::LEAF))
-        result = std::make_shared<ALeafNode>(fileOffset, this->file);
-    result->load(readData);
-    return result;
-}
-
-
-// TODO: use some index to make it work faster
-template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
-auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::AllocateDiskMemory(NodeType nodeType) -> size_t {
-    std::fpos<mbstate_t> result;
-    auto currentOffset = sizeof(configHeader);
-    while (true) {
-        char nodeHeader = this->file.template read<char>(currentOffset);
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::ReadOlderFile(
+        fs::path const &filePath, std::function<void(TKey const &, TValue const &)> const &consumer) -> void {
+    if (!fs::is_regular_file(filePath))
+        throw std::runtime_error("Couldn't open file: " + fs::absolute(filePath).string());
+    auto file = File(filePath, std::ios::binary | std::ios::out | std::ios::in | std::ios::ate, [] {}, [] {});
+    if (file.bad()) throw std::runtime_error("Couldn't open file: " + fs::absolute(filePath).string());
+    auto configHeader = file.template read<ConfigHeader>(0);
+    CheckDegrees(configHeader);
+    auto magic = file.template read<FreeSpaceHeader>(sizeof(ConfigHeader)).magic;
+    if (magic == FreeSpaceHeader::Magic || magic == FreeSpaceHeader::PagedMagic ||
+        magic == FreeSpaceHeader::ShadowMagic || magic == FreeSpaceHeader::PagedShadowMagic)
+        throw std::runtime_error("File is already in current format");
+    file.clear();
 
-        // if end of file
-        if (this->file.eof()) {
-            result = currentOffset;
-            break;
+    // older nodes are header byte followed by arrays of optional keys and descendants or values, slots of inner
+    // nodes and leaves have different sizes, so the rest of read data may belong to next slot and it is not used
+    using OlderInnerKeys = std::array<std::optional<TKey>, 2 * TInnerNodeDegree>;
+    using OlderDescendants = std::array<std::optional<NodeOffset>, 2 * TInnerNodeDegree + 1>;
+    using OlderLeafKeys = std::array<std::optional<TKey>, 2 * TLeafNodeDegree>;
+    using OlderValues = std::array<std::optional<TValue>, 2 * TLeafNodeDegree>;
+    auto const olderInnerSize = 1 + sizeof(OlderInnerKeys) + sizeof(OlderDescendants);
+    auto const olderLeafSize = 1 + sizeof(OlderLeafKeys) + sizeof(OlderValues);
+    std::vector<char> bytes(std::max(olderInnerSize, olderLeafSize));
+    std::vector<NodeOffset> offsets{configHeader.rootOffset};
+    while (!offsets.empty()) {
+        auto offset = offsets.back();
+        offsets.pop_back();
+        std::fill(bytes.begin(), bytes.end(), 0);
+        file.readInto(offset, bytes);
+        file.clear();
+        auto header = std::bitset<8>(bytes[0]);
+        if (header[0] == true)
+            throw std::runtime_error("Internal DB error: empty node is used by tree: " + std::to_string(offset));
+        if (static_cast<NodeType>(static_cast<int>(header[1])) == NodeType::LEAF) {
+            OlderLeafKeys keys;
+            OlderValues values;
+            std::memcpy(keys.data(), bytes.data() + 1, sizeof(keys));
+            std::memcpy(values.data(), bytes.data() + 1 + sizeof(keys), sizeof(values));
+            for (size_t i = 0; i < keys.size() && keys[i]; ++i) consumer(*keys[i], *values[i]);
+        } else {
+            OlderDescendants descendants;
+            std::memcpy(descendants.data(), bytes.data() + 1 + sizeof(OlderInnerKeys), sizeof(descendants));
+            // descendants are visited from the leftmost one
+            for (auto it = descendants.rbegin(); it != descendants.rend(); ++it)
+                if (*it) offsets.push_back(**it);
         }
+    }
+}
 
-        // if found space is empty type is good
-        if (std::bitset<8>(nodeHeader)[1] == static_cast<int>(nodeType) && std::bitset<8>(nodeHeader)[0] == true) {
-            result = currentOffset;
-            break;
-        }
 
-        // not empty -> search next
-        auto stepSize = (std::bitset<8>(nodeHeader)[1] == static_cast<int>(NodeType::LEAF))
-                        ? ALeafNode::BytesSize()
-                        : AInnerNode::BytesSize();
-        currentOffset += stepSize + 1; // plus node header
+/**
+ * Throws if file was created by program using other degrees of nodes
+ * @param configHeader
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::CheckDegrees(ConfigHeader const &configHeader)
+-> void {
+    if (configHeader.leafNodeDegree != TLeafNodeDegree || configHeader.innerNodeDegree != TInnerNodeDegree) {
+        throw std::runtime_error("Degrees of nodes are incorrect for current program.\n"s +
+                                 "Used by program: <"s + std::to_string(TInnerNodeDegree) +
+                                 ", " + std::to_string(TLeafNodeDegree) + ">\nIn File: <" +
+                                 std::to_string(configHeader.innerNodeDegree) + ", " +
+                                 std::to_string(configHeader.leafNodeDegree) + ">");
     }
-    if (result < 0) throw std::runtime_error("Unable to allocate disk memory");
-    auto offset = static_cast<size_t>(result);
-
-    // Mark space as occupied by simply creating and unloading node
-    if (nodeType == NodeType::LEAF) ALeafNode(offset, this->file).markChanged();
-    else AInnerNode(offset, this->file).markChanged();
-    return offset;
 }
 
 
 /**
- * Tries to compensate node with neighbour
- * @param node node which needs compensation
- * @param key ptr to key added to node (while creating new record only, otherwise nullptr)
- * @param value ptr value added to node (while creating new record and with leaf nodes only, otherwise nullptr)
- * @param nodeOffset descendant added to node (only used with inner nodes)
- * @return true if succeeded and false if failed
+ * Creates log (replacing old one) and makes file write through it, does nothing if durability is NONE or SHADOW
+ * @param durability
  */
 template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
-auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::tryCompensateAndAdd(std::shared_ptr<ANode> node,
-                                                                                     TKey const *const key,
-                                                                                     TValue const *const value,
-                                                                                     size_t nodeOffset) -> bool {
-    if (!node) throw std::invalid_argument("Given node argument is nullptr");
-
-    // if node is root -> can't compensate
-    if (node->parent == nullptr) return false;
-    // determine which node is left / right
-    std::shared_ptr<ANode> left, right;
-    {
-        auto[l, r] = getNodeNeighbours(node);
-        if (key) {     // compensation while adding new key
-            if (l && !l->full()) {
-                left = l;
-                right = node;
-            } else if (r && !r->full()) {
-                left = node;
-                right = r;
-            } else {
-                return false; // if no unfilled neighbours -> can't compensate
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::attachLog(Durability durability) -> void {
+    if (durability == Durability::NONE || durability == Durability::SHADOW) {
+        fs::remove(WriteAheadLog::PathFor(this->filePath));
+        return;
+    }
+    this->log = std::make_unique<WriteAheadLog>(WriteAheadLog::PathFor(this->filePath), durability);
+    if (this->log->bad())
+        throw std::runtime_error("Couldn't create log: " + fs::absolute(WriteAheadLog::PathFor(this->filePath)).string());
+    this->file.setLog(this->log.get());
+}
 
-            }
-        } else { // compensation after deletion
-            if (l && (l->fillKeysSize() + node->fillKeysSize() >= 2 * node->degree())) {
-                left = l;
-                right = node;
-            } else if (r && (r->fillKeysSize() + node->fillKeysSize() >= 2 * node->degree())) {
-                left = node;
-                right = r;
-            } else {
-                return false; // no nodes which meeting conditions
-            }
 
-        }
+/**
+ * Executes operation changing tree and commits it, nodes used by operation are released before commit.
+ * Operations are run one at a time and not during splits of leaves, readers can't see nodes changed by operation
+ * until it is flushed.
+ * Retired nodes which can't be reached by readers anymore are reclaimed by operation as well.
+ * Operation which throws is discarded (see abortOperation) and exception is rethrown
+ * @param operation
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+template<typename TOperation>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::runOperation(TOperation &&operation) -> void {
+    std::unique_lock structureLock(this->structureMutex);
+    VersionedWrite write(this);
+    this->operationVersioned = write.versioned;
+    this->beginOperation();
+    try {
+        operation();
+    } catch (...) {
+        this->abortOperation();
+        throw;
     }
-
-    // compensate nodes
-    auto middleKey = left->compensateWithAndReturnMiddleKey(right, key, value, nodeOffset);
-    // update parent with new middle key (biggest key in left node also)
-    std::dynamic_pointer_cast<AInnerNode>(node->parent)->setKeyBetweenPtrs(left->fileOffset, right->fileOffset,
-                                                                           middleKey);
-    return true;
+    this->reclaimNodes();
+    this->flushOperation();
+    this->commitOperation();
 }
 
 
 /**
- * Splits node and update anncestors recursively
- * @param node node to split
- * @param key
- * @param value used only for leaf nodes
- * @param addedNodeOffset used only for inner nodes
+ * Starts operation (or its next part after previous one was committed), remembers state of tree which isn't
+ * kept by nodes, so operation can be discarded. Buffers of free slots are reused by next operations
  */
 template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
-auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::splitAndAddRecord(std::shared_ptr<ANode> node,
-                                                                                   TKey const &key,
-                                                                                   TValue const &value,
-                                                                                   size_t addedNodeOffset) -> void {
-    // Create new node
-    std::shared_ptr<ANode> newNode = nullptr;
-    if (node->nodeType() == NodeType::LEAF)
-        newNode = std::make_shared<ALeafNode>(AllocateDiskMemory(NodeType::LEAF), this->file);
-    else
-        newNode = std::make_shared<AInnerNode>(AllocateDiskMemory(NodeType::INNER), this->file);
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::beginOperation() -> void {
+    std::lock_guard lock(this->nodesMutex);
+    auto &start = this->operationStart;
+    start.configHeader = this->configHeader;
+    start.freeSpaceHeader = this->freeSpaceHeader;
+    start.fileEnd = this->fileEnd;
+    start.retiredNodesCount = this->retiredNodes.size();
+    start.freeLeafSlots.assign(this->freeLeafSlots.begin(), this->freeLeafSlots.end());
+    start.freeInnerSlots.assign(this->freeInnerSlots.begin(), this->freeInnerSlots.end());
+    this->operationActive = true;
+}
 
-    // if root then create new parent (new root)
-    if (node == root) {
-        auto newRoot = std::make_shared<AInnerNode>(AllocateDiskMemory(NodeType::INNER), this->file);
-        // compensate old root with newly created empty node
-        auto midKey = node->compensateWithAndReturnMiddleKey(newNode, &key, &value, addedNodeOffset);
-        // add pointers of old root and newly created node to new root
-        newRoot->descendants[0] = node->fileOffset;
-        newRoot->keys[0] = midKey;
-        newRoot->descendants[1] = newNode->fileOffset;
-        newRoot->markChanged();
-        this->root = newRoot;
-        this->updateConfigHeader();
+
+/**
+ * Discards current operation which failed: nodes it changed are dropped (without being written) from buffer pool,
+ * so they are read again from file, writes staged since last commit are dropped and state of tree is restored to
+ * the one remembered when operation began. Nothing done by operation reaches file or log
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::abortOperation() -> void {
+    auto &start = this->operationStart;
+    std::unique_lock lock(this->nodesMutex);
+    // root is used without being tracked, it is replaced by its copy from file if operation changed it
+    auto rootDiscarded = this->root->changed || this->root->fileOffset != start.configHeader.rootOffset;
+    if (this->root->changed) {
+        this->root->markUnloaded();
+        this->bufferPool.erase(this->root->fileOffset);
+    }
+    for (auto const &[offset, node] : this->operationNodes) {
+        if (!node->changed) continue;
+        node->markUnloaded();
+        this->bufferPool.erase(offset);
+    }
+    this->operationNodes.clear();
+    this->operationActive = false;
+    this->file.rollback();
+    // nodes retired by operation (e.g. freed ones) are still used by tree
+    this->retiredNodes.erase(this->retiredNodes.begin() + start.retiredNodesCount, this->retiredNodes.end());
+    this->configHeader = start.configHeader;
+    this->freeSpaceHeader = start.freeSpaceHeader;
+    this->fileEnd = start.fileEnd;
+    this->freeLeafSlots.assign(start.freeLeafSlots.begin(), start.freeLeafSlots.end());
+    this->freeInnerSlots.assign(start.freeInnerSlots.begin(), start.freeInnerSlots.end());
+    this->headersChanged = false;
+    this->shadowSlots.clear();
+    this->shadowReleasedNodes.clear();
+    // root is read again with nodesMutex unlocked, as nodes are latched before it is locked. Latch of root is still
+    // held, so readers don't use replaced root meanwhile
+    lock.unlock();
+    if (rootDiscarded) this->setRoot(this->readNode(this->configHeader.rootOffset));
+    if (this->operationVersioned) this->commitVersions(this->versionedNodes);
+    this->versionedNodes.clear();
+    this->releaseLatches({});
+}
+
+
+/**
+ * Ends current operation writing nodes it changed (root included), each of them once, with single sorted batch.
+ * High keys of nodes are set to separators bounding them first. Nodes kept by buffer pool stay cached but are clean
+ * afterwards, so eviction never writes them. Versions saved by operation get commit timestamp before its latches
+ * are released.
+ * All changed nodes of shadow file are moved to new slots and written, its superblock is written by commit
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::flushOperation() -> void {
+    // copies are created (and latched) before nodesMutex is locked
+    if (this->shadowPaging && this->operationActive) {
+        if (auto root = this->shadowNode(this->root); root != this->root) {
+            this->setRoot(root);
+            this->updateConfigHeader();
+        }
+    }
+    // nodes are latched again before nodesMutex is locked, shadow file has no links to be bounded by high keys
+    if (!this->shadowPaging && this->root->nodeType() == NodeType::INNER)
+        this->updateHighKeys(static_cast<AInnerNode &>(*this->root), nullptr, false);
+    std::lock_guard lock(this->nodesMutex);
+    this->operationActive = false;
+    auto &changed = this->changedNodes;
+    changed.clear();
+    for (auto const &[offset, node] : this->operationNodes) {
+        if (!node->changed) continue;
+        if (this->shadowPaging && !this->shadowSlots.contains(offset))
+            throw std::runtime_error("Internal DB error: slot of committed tree is changed: " + std::to_string(offset));
+        changed.push_back(node);
+    }
+    // root is used by descents without being read, so it may be changed without being tracked
+    if (this->root->changed && !this->shadowPaging && !this->operationNodes.contains(this->root->fileOffset))
+        changed.push_back(this->root);
+    this->writeNodes(changed, this->headersChanged && !this->shadowPaging);
+    changed.clear();
+    if (!this->shadowPaging) this->headersChanged = false;
+    this->operationNodes.clear();
+    this->shadowSlots.clear();
+    if (this->operationVersioned) this->commitVersions(this->versionedNodes);
+    this->versionedNodes.clear();
+    this->releaseLatches({});
+}
+
+
+/**
+ * Writes nodes (and headers) sorted by offsets, data of adjacent slots is written with single call. Buffers are
+ * reused by next writes, unless they grew bigger than MaxKeptWriteBufferSize
+ * @param nodes changed nodes
+ * @param withHeaders whether config and free space headers should be written too
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::writeNodes(std::span<std::shared_ptr<ANode> const> nodes,
+                                                                            bool withHeaders) -> void {
+    std::lock_guard lock(this->nodesMutex);
+    auto &sortedNodes = this->writtenNodes;
+    sortedNodes.clear();
+    for (auto const &node : nodes) sortedNodes.push_back(node.get());
+    std::sort(sortedNodes.begin(), sortedNodes.end(), [](auto a, auto b) { return a->fileOffset < b->fileOffset; });
+    auto nodeWriteSize = [this](auto const &node) { return std::max(node->bytesSize() + 1, this->file.getPageSize()); };
+    auto headersSize = size_t{0};
+    if (withHeaders) {
+        if (this->format == FileFormat::PAGED) headersSize = PageSize;
+        else headersSize = sizeof(ConfigHeader) + sizeof(FreeSpaceHeader);
+    }
+    auto bytesCount = headersSize;
+    for (auto node : sortedNodes) bytesCount += nodeWriteSize(node);
+    if (bytesCount == 0) return;
+
+    // everything is serialized in offset order, so adjacent slots are adjacent in buffer as well
+    auto &buffer = this->writeBuffer;
+    auto &batch = this->writeRequests;
+    buffer.resize(bytesCount);
+    batch.clear();
+    auto data = buffer.data();
+    auto append = [&batch, &data](NodeOffset offset, size_t size) {
+        if (!batch.empty() && batch.back().offset + batch.back().size == offset) {
+            batch.back().size += size;
+            ++batch.back().units;
+        } else {
+            batch.push_back({IoRequest::Type::WRITE, offset, data, size});
+        }
+        data += size;
+    };
+    if (withHeaders) {
+        this->configHeader.rootOffset = this->root->fileOffset;
+        std::memcpy(data, &this->configHeader, sizeof(ConfigHeader));
+        std::memcpy(data + sizeof(ConfigHeader), &this->freeSpaceHeader, sizeof(FreeSpaceHeader));
+        batch.push_back({IoRequest::Type::WRITE, 0, data, headersSize, this->format == FileFormat::SLOTTED ? 2u : 1u});
+        data += headersSize;
+    }
+    for (auto node : sortedNodes) {
+        auto size = nodeWriteSize(node);
+        node->unloadInto({data, size});
+        append(node->fileOffset, size);
+    }
+    this->file.submit(batch);
+    for (auto node : sortedNodes) node->markUnloaded();
+    if (buffer.capacity() > MaxKeptWriteBufferSize) {
+        buffer = {};
+        batch = {};
+        sortedNodes = {};
+    }
+}
+
+
+/**
+ * Writes all changed nodes and headers
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::unload() -> void {
+    std::lock_guard lock(this->nodesMutex);
+    auto changed = this->bufferPool.changedNodes();
+    if (this->root->changed && !this->bufferPool.contains(this->root->fileOffset)) changed.push_back(this->root);
+    this->writeNodes(changed, false);
+    this->updateConfigHeader();
+}
+
+
+/**
+ * Commits writes staged since last commit to log (nodes are written by flushOperation, or by writes outside of
+ * operations themselves), does nothing if log is not used. Shadow file is committed by superblock (if operation
+ * changed tree), slots of nodes replaced by operation are released then
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::commitOperation() -> void {
+    if (this->shadowPaging) {
+        if (std::exchange(this->headersChanged, false)) this->writeSuperblock();
+        this->releaseShadowNodes();
+        return;
+    }
+    if (!this->log) return;
+    std::lock_guard lock(this->nodesMutex);
+    this->file.commit();
+}
+
+
+/**
+ * Writes nodes changed outside of operation (and headers) and commits them to log together with changes of other
+ * threads: the first thread which finds no commit in progress commits all changes waiting for it with single batch
+ * (and single sync of log), the rest wait until group of their change is committed. Writers keep nodes latched or
+ * fenced meanwhile, so nobody changes them
+ * @param nodes changed nodes
+ * @param withHeaders whether headers have to be written too (e.g. root was replaced)
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::commitChanges(
+        std::span<std::shared_ptr<ANode> const> nodes, bool withHeaders) -> void {
+    std::unique_lock lock(this->commitMutex);
+    auto group = this->pendingGroup;
+    if (group < this->failedGroup) {
+        this->pendingNodes.insert(this->pendingNodes.end(), nodes.begin(), nodes.end());
+        this->pendingHeaders |= withHeaders;
+    }
+    while (this->committedGroup < group && group < this->failedGroup) {
+        if (this->commitRunning) {
+            this->commitDone.wait(lock);
+            continue;
+        }
+        // changes which come meanwhile join the next group
+        this->commitRunning = true;
+        std::swap(this->pendingNodes, this->committedNodes);
+        auto headers = std::exchange(this->pendingHeaders, false);
+        auto committed = this->pendingGroup++;
+        lock.unlock();
+        std::exception_ptr error;
+        try {
+            std::lock_guard nodesLock(this->nodesMutex);
+            this->writeNodes(this->committedNodes, headers);
+            this->file.commit();
+        } catch (...) {
+            error = std::current_exception();
+        }
+        this->committedNodes.clear();
+        lock.lock();
+        this->commitRunning = false;
+        this->committedGroup = committed;
+        if (error && committed < this->failedGroup) {
+            this->failedGroup = committed;
+            this->commitError = error;
+        }
+        this->commitDone.notify_all();
+    }
+    if (group >= this->failedGroup) std::rethrow_exception(this->commitError);
+}
+
+
+/**
+ * Reads node at specified offset and loads it, node is taken from buffer pool if cached. Version of node read by
+ * operation is saved for snapshots if needed
+ * @param fileOffset
+ * @return pointer to read and loaded node
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::readNode(size_t fileOffset) -> std::shared_ptr<ANode> {
+    if (this->operationActive) this->latchNode(fileOffset);
+    std::lock_guard lock(this->nodesMutex);
+    auto result = this->getCachedNode(fileOffset);
+    if (!result) {
+        // since we read max of both nodes, less data can be available at the end of file
+        auto[readData, readSize] = this->file.view(fileOffset, sizeof(char) +
+                                                               std::max(AInnerNode::BytesSize(),
+                                                                        ALeafNode::BytesSize()));
+        result = this->makeNode(fileOffset, readData, readSize);
+        this->trackNode(result);
+    }
+    this->saveVersion(result);
+    return result;
+}
+
+
+/**
+ * Reads nodes at specified offsets, those not found in buffer pool are read from file with single batch. Buffers
+ * of batch are reused by next reads
+ * @param fileOffsets
+ * @param result filled with pointers to read and loaded nodes in order of offsets
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::readNodes(std::span<NodeOffset const> fileOffsets,
+                                                                           std::vector<std::shared_ptr<ANode>> &result)
+-> void {
+    if (this->operationActive) for (auto offset : fileOffsets) this->latchNode(offset);
+    std::lock_guard lock(this->nodesMutex);
+    auto &missing = this->readMissing;
+    result.clear();
+    missing.clear();
+    for (size_t i = 0; i < fileOffsets.size(); ++i) {
+        result.push_back(this->getCachedNode(fileOffsets[i]));
+        if (!result.back()) missing.push_back(i);
+    }
+    if (missing.size() == 1) result[missing[0]] = this->readNode(fileOffsets[missing[0]]);
+    if (missing.size() <= 1) {
+        for (auto const &node : result) this->saveVersion(node);
         return;
     }
 
-    // if no parent -> error
-    if (node->parent == nullptr) throw std::runtime_error("Internal database error: nullptr node parent");
+    auto slotSize = sizeof(char) + std::max(AInnerNode::BytesSize(), ALeafNode::BytesSize());
+    auto &buffer = this->readBuffer;
+    auto &batch = this->readRequests;
+    buffer.resize(slotSize * missing.size());
+    batch.clear();
+    for (size_t i = 0; i < missing.size(); ++i)
+        batch.push_back({IoRequest::Type::READ, fileOffsets[missing[i]], buffer.data() + i * slotSize, slotSize});
+    this->file.submit(batch);
+    this->file.clear();
+    for (size_t i = 0; i < missing.size(); ++i) {
+        result[missing[i]] = this->makeNode(batch[i].offset, batch[i].data, batch[i].result);
+        this->trackNode(result[missing[i]]);
+    }
+    for (auto const &node : result) this->saveVersion(node);
+    if (buffer.capacity() > MaxKeptWriteBufferSize) {
+        buffer = {};
+        batch = {};
+        missing = {};
+    }
+}
+
+
+/**
+ * Looks for node used by current operation or in buffer pool and updates cache counters
+ * @param fileOffset
+ * @return cached node or nullptr if it has to be read from file
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::getCachedNode(size_t fileOffset)
+-> std::shared_ptr<ANode> {
+    std::lock_guard lock(this->nodesMutex);
+    auto cachedNode = std::shared_ptr<ANode>();
+    if (auto it = this->operationNodes.find(fileOffset); it != this->operationNodes.end()) {
+        cachedNode = it->second;
+    } else if (this->bufferPool.enabled()) {
+        cachedNode = this->bufferPool.get(fileOffset, this->countersEnabled);
+        if (!cachedNode) return nullptr;
+        this->trackNode(cachedNode);
+    } else {
+        return nullptr;
+    }
+    if (cachedNode->empty)
+        throw std::runtime_error("Tried to read empty node at: " + std::to_string(fileOffset));
+    return cachedNode;
+}
+
+
+/**
+ * Keeps node used by current operation, so it is written at most once when operation ends
+ * @param node
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::trackNode(std::shared_ptr<ANode> const &node) -> void {
+    if (this->operationActive) this->operationNodes.emplace(node->fileOffset, node);
+}
+
+
+/**
+ * Reads node for thread which reads tree without latches, node isn't used by current operation. Its slot may be
+ * freed or reused after version of its latch was read, read fails then instead of throwing
+ * @param fileOffset
+ * @param version version of latch of node read before its offset was validated
+ * @param mayBeFreed offset wasn't validated together with version (it was kept since node was read before), node
+ * may be freed then
+ * @return node taken from buffer pool if cached, nullptr node if latch changed and node couldn't be read or if
+ * node may be freed and it is
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::readOptimisticNode(NodeOffset fileOffset,
+                                                                                    uint64_t version,
+                                                                                    bool mayBeFreed)
+-> OptimisticNode {
+    // root kept by tree is newer than its copy in file when buffer pool isn't used
+    if (auto rootNode = this->rootNode.load(); rootNode->fileOffset == fileOffset) return {nullptr, rootNode, version};
+    try {
+        // cached node is taken with lock of its shard of buffer pool only
+        auto result = this->bufferPool.enabled() ? this->bufferPool.get(fileOffset, this->countersEnabled) : nullptr;
+        if (!result) {
+            std::lock_guard lock(this->nodesMutex);
+            // node may have been read meanwhile (e.g. by operation which changes it), it mustn't be replaced then
+            if (this->bufferPool.enabled()) result = this->bufferPool.get(fileOffset, false);
+            if (!result) {
+                auto[readData, readSize] = this->file.view(fileOffset, sizeof(char) +
+                                                                       std::max(AInnerNode::BytesSize(),
+                                                                                ALeafNode::BytesSize()));
+                result = this->makeNode(fileOffset, readData, readSize);
+            }
+        }
+        if (!result->empty) return {result, result.get(), version};
+    } catch (std::runtime_error const &) {
+        if (this->versionValid(fileOffset, version)) throw;
+        return {};
+    }
+    if (!mayBeFreed && this->versionValid(fileOffset, version))
+        throw std::runtime_error("Tried to read empty node at: " + std::to_string(fileOffset));
+    return {};
+}
+
+
+/**
+ * Reads node as it was when snapshot was taken: the oldest of its saved versions which ended after snapshot,
+ * current node if there is no such version. Current node is read without latch like by readOptimisticNode
+ * @param fileOffset
+ * @param timestamp timestamp of snapshot
+ * @return saved version of node or current node, its data has to be validated with snapshotNodeValid
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::readSnapshotNode(NodeOffset fileOffset,
+                                                                                  uint64_t timestamp)
+-> OptimisticNode {
+    while (true) {
+        // version is read before versions are checked, so write which saves version of node later changes it
+        auto latchVersion = this->latches[LatchIndex(fileOffset)].version.load();
+        {
+            std::lock_guard lock(this->versionsMutex);
+            if (auto versions = this->nodeVersions.find(fileOffset); versions != this->nodeVersions.end()) {
+                auto version = std::find_if(versions->second.begin(), versions->second.end(),
+                                            [timestamp](auto const &v) { return timestamp < v.endTimestamp; });
+                if (version != versions->second.end()) return {version->node, version->node.get(), SavedNodeVersion};
+            }
+        }
+        // node latched by write will have its version saved, or it is written by write seen by snapshot
+        if (latchVersion & 1u) {
+            std::this_thread::yield();
+            continue;
+        }
+        if (auto node = this->readOptimisticNode(fileOffset, latchVersion); node.node) return node;
+    }
+}
+
+
+/**
+ * @param offset
+ * @return index of latch guarding node at given offset, the latch is shared with other nodes
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::LatchIndex(NodeOffset offset) -> size_t {
+    // offsets are multiples of slot size, so they are mixed before their high bits are taken
+    constexpr auto IndexBits = std::bit_width(LatchesCount - 1);
+    return (offset * 0x9E3779B97F4A7C15ull) >> (64 - IndexBits);
+}
+
+
+/**
+ * Latches node for current operation until it ends (or until latch is released by descent), version of latch is
+ * odd while it is held. Node has to be latched before nodesMutex is locked
+ * @param offset
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::latchNode(NodeOffset offset) -> void {
+    auto index = LatchIndex(offset);
+    auto &latch = this->latches[index];
+    if (latch.held) return;
+    latch.mutex.lock();
+    latch.version.fetch_add(1);
+    std::atomic_thread_fence(std::memory_order_release);
+    latch.held = true;
+    this->heldLatches.push_back(index);
+}
+
+
+/**
+ * Releases latches held by current operation, readers which read nodes guarded by them have to read them again
+ * @param keptNodes offsets of nodes which stay latched
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::releaseLatches(std::initializer_list<NodeOffset> keptNodes)
+-> void {
+    auto kept = [keptNodes](size_t index) {
+        return std::ranges::any_of(keptNodes, [index](auto offset) { return LatchIndex(offset) == index; });
+    };
+    for (auto index : this->heldLatches) {
+        if (kept(index)) continue;
+        this->latches[index].held = false;
+        this->latches[index].version.fetch_add(1);
+        this->latches[index].mutex.unlock();
+    }
+    std::erase_if(this->heldLatches, [&kept](auto index) { return !kept(index); });
+}
+
+
+/**
+ * Waits until latch of node isn't held
+ * @param offset
+ * @return version of latch of node, node read after it can be used if versionValid confirms it
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::readVersion(NodeOffset offset) -> uint64_t {
+    auto &latch = this->latches[LatchIndex(offset)];
+    auto version = latch.version.load();
+    while (version & 1u) {
+        std::this_thread::yield();
+        version = latch.version.load();
+    }
+    return version;
+}
+
+
+/**
+ * @param offset
+ * @param version version returned by readVersion
+ * @return true if node wasn't latched since version was read, so data read from it meanwhile is consistent
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::versionValid(NodeOffset offset, uint64_t version)
+-> bool {
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return this->latches[LatchIndex(offset)].version.load(std::memory_order_relaxed) == version;
+}
+
+
+/**
+ * Checks whether change of node's descendant can't propagate to node's ancestors
+ * @param node
+ * @param change change done in leaf
+ * @return true if ancestors of node won't be changed
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::isNodeSafe(ANode const &node,
+                                                                           LeafChange change) const -> bool {
+    auto isLeaf = node.nodeType() == NodeType::LEAF;
+    auto keysCount = node.fillKeysSize();
+    switch (change) {
+        case LeafChange::UPDATE:
+            return true;
+        case LeafChange::INSERT:
+            return keysCount < 2 * (isLeaf ? TLeafNodeDegree : TInnerNodeDegree);
+        case LeafChange::DELETE:
+            if (&node == this->rootNode.load()) return isLeaf || keysCount > 1;
+            return keysCount > (isLeaf ? TLeafNodeDegree : TInnerNodeDegree);
+        case LeafChange::INSERT_MANY:
+            return false; // leaf may be split into many nodes
+    }
+    return false;
+}
+
+
+/**
+ * Replaces root of tree. Threads reading tree without latches may still use old root, so it is retired.
+ * Offset of old root is saved for snapshots if operation saves versions
+ * @param node new root
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::setRoot(std::shared_ptr<ANode> const &node) -> void {
+    std::lock_guard lock(this->nodesMutex);
+    auto oldRoot = std::exchange(this->root, node);
+    {
+        std::lock_guard versionsLock(this->versionsMutex);
+        if (oldRoot && this->operationActive && this->operationVersioned)
+            this->rootVersions.push_back({PendingTimestamp, oldRoot->fileOffset});
+        this->rootNode.store(node.get());
+    }
+    // reader which doesn't use epoch slot yet will see new root
+    if (oldRoot && this->readersActive())
+        this->retiredNodes.push_back({this->globalEpoch.fetch_add(1), std::move(oldRoot), false});
+}
+
+
+/**
+ * @return true if any thread reads tree without latches
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::readersActive() const -> bool {
+    return std::any_of(this->epochSlots.begin(), this->epochSlots.end(),
+                       [](auto const &slot) { return slot.epoch.load() != 0; });
+}
+
+
+/**
+ * Reclaims retired nodes which can't be used by any reader: slots of freed nodes are put on free lists (or free
+ * slots of shadow file), the rest of nodes is only released
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::reclaimNodes() -> void {
+    std::lock_guard lock(this->nodesMutex);
+    if (this->retiredNodes.empty()) return;
+    // readers whose epoch is not greater than epoch of node could reach it
+    auto minEpoch = std::numeric_limits<uint64_t>::max();
+    for (auto const &slot : this->epochSlots)
+        if (auto epoch = slot.epoch.load(); epoch != 0) minEpoch = std::min(minEpoch, epoch);
+    auto reclaimed = std::stable_partition(this->retiredNodes.begin(), this->retiredNodes.end(),
+                                           [minEpoch](auto const &retired) { return retired.epoch >= minEpoch; });
+    for (auto it = reclaimed; it != this->retiredNodes.end(); ++it) {
+        if (!it->freed) continue;
+        if (this->shadowPaging) {
+            this->freeSlots(it->node->nodeType()).push_back(it->node->fileOffset);
+            continue;
+        }
+        auto &head = this->freeListHead(it->node->nodeType());
+        it->node->nextFreeOffset = head;
+        head = it->node->fileOffset;
+        it->node->markChanged();
+        if (this->operationActive) this->trackNode(it->node);
+        else it->node->unload();
+        this->updateFreeSpaceHeader();
+    }
+    this->retiredNodes.erase(reclaimed, this->retiredNodes.end());
+}
+
+
+/**
+ * Moves nodes of shadow file changed by current operation out of slots used by committed tree: every changed node
+ * is copied to new slot (so its ancestors change as well), copies of descendants replace them in their parents.
+ * Replaced nodes are released after commit
+ * @param node root of subtree
+ * @return node or its copy which replaces it
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::shadowNode(std::shared_ptr<ANode> const &node)
+-> std::shared_ptr<ANode> {
+    if (node->nodeType() == NodeType::INNER) {
+        auto innerNode = std::dynamic_pointer_cast<AInnerNode>(node);
+        // only descendants used by operation could be changed
+        for (size_t i = 0; i < innerNode->descendantsCount; ++i) {
+            auto it = this->operationNodes.find(innerNode->descendants[i]);
+            if (it == this->operationNodes.end() || it->second->empty) continue;
+            auto descendant = it->second;
+            auto copy = this->shadowNode(descendant);
+            if (copy == descendant) continue;
+            innerNode->descendants[i] = copy->fileOffset;
+            innerNode->markChanged();
+        }
+    }
+    if (!node->changed || this->shadowSlots.contains(node->fileOffset)) return node;
+    auto copy = this->createNode(node->nodeType());
+    CopyNode(*node, *copy);
+    copy->markChanged();
+    std::lock_guard lock(this->nodesMutex);
+    // old slot keeps committed node, so changed one mustn't be written to it
+    node->markUnloaded();
+    this->operationNodes.erase(node->fileOffset);
+    this->bufferPool.erase(node->fileOffset);
+    this->shadowReleasedNodes.push_back(node);
+    return copy;
+}
+
+
+/**
+ * Releases slots of nodes of shadow file replaced by current operation, tree which doesn't use them has to be
+ * committed. If threads read tree without latches, slots are released when nodes are reclaimed
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::releaseShadowNodes() -> void {
+    std::lock_guard lock(this->nodesMutex);
+    auto retired = this->readersActive();
+    for (auto &node : this->shadowReleasedNodes) {
+        if (!retired) this->freeSlots(node->nodeType()).push_back(node->fileOffset);
+        else this->retiredNodes.push_back({this->globalEpoch.fetch_add(1), std::move(node), true});
+    }
+    this->shadowReleasedNodes.clear();
+}
+
+
+/**
+ * Saves version of node latched by current operation before operation changes it, if operation saves versions.
+ * Version of every node is saved once per commit
+ * @param node
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::saveVersion(std::shared_ptr<ANode> const &node)
+-> void {
+    if (!this->operationActive || !this->operationVersioned) return;
+    if (this->versionedNodes.insert(node->fileOffset).second) this->addVersion(*node);
+}
+
+
+/**
+ * Copies data of node into other node of the same type
+ * @param source
+ * @param target
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::CopyNode(ANode &source, ANode &target) -> void {
+    // scratch buffer is reused by all copies of the thread
+    thread_local std::vector<Byte> bytes;
+    bytes.resize(source.bytesSize() + 1);
+    source.unloadInto(bytes);
+    target.load(bytes.data() + sizeof(char));
+}
+
+
+/**
+ * Adds copy of node as its pending version, node has to be latched and not changed yet by current write
+ * @param node
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::addVersion(ANode &node) -> void {
+    std::shared_ptr<ANode> copy;
+    if (node.nodeType() == NodeType::LEAF) copy = this->newNode<ALeafNode>(node.fileOffset);
+    else copy = this->newNode<AInnerNode>(node.fileOffset);
+    CopyNode(node, *copy);
+    std::lock_guard lock(this->versionsMutex);
+    this->nodeVersions[node.fileOffset].push_back({PendingTimestamp, std::move(copy)});
+}
+
+
+/**
+ * Assigns next commit timestamp to pending versions of given nodes and of root, it has to be done before their
+ * latches are released
+ * @param offsets nodes whose versions were saved by committed write
+ * @param withRoot whether write replaced root, pending version of root may be saved by other write otherwise
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::commitVersions(OffsetsSet const &offsets,
+                                                                               bool withRoot) -> void {
+    std::lock_guard lock(this->versionsMutex);
+    auto timestamp = ++this->lastCommitTimestamp;
+    for (auto offset : offsets) {
+        this->nodeVersions[offset].back().endTimestamp = timestamp;
+        this->committedVersions.emplace_back(timestamp, offset);
+    }
+    for (auto &rootVersion : this->rootVersions)
+        if (withRoot && rootVersion.endTimestamp == PendingTimestamp) rootVersion.endTimestamp = timestamp;
+    this->collectVersions();
+}
+
+
+/**
+ * Drops versions which can't be read by any snapshot: those which ended before the oldest snapshot was taken, or
+ * all committed ones if there is no snapshot. versionsMutex has to be locked
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::collectVersions() -> void {
+    auto oldestTimestamp = this->snapshotTimestamps.empty() ? PendingTimestamp - 1 : *this->snapshotTimestamps.begin();
+    while (!this->committedVersions.empty() && this->committedVersions.front().first <= oldestTimestamp) {
+        auto versions = this->nodeVersions.find(this->committedVersions.front().second);
+        versions->second.pop_front();
+        if (versions->second.empty()) this->nodeVersions.erase(versions);
+        this->committedVersions.pop_front();
+    }
+    std::erase_if(this->rootVersions,
+                  [oldestTimestamp](auto const &version) { return version.endTimestamp <= oldestTimestamp; });
+}
+
+
+/**
+ * Creates node which isn't loaded yet, its memory (shared with its control block) is taken from pool of nodes of
+ * its type, so nodes read and dropped by operations don't allocate memory from heap
+ * @param offset offset of node in file
+ * @return pointer to created node
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+template<typename TNode>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::newNode(NodeOffset offset) -> std::shared_ptr<TNode> {
+    return std::allocate_shared<TNode>(PoolAllocator<TNode>(), offset, this->file);
+}
+
+
+/**
+ * Creates node from slot bytes read from file and puts it into buffer pool
+ * @param fileOffset offset of slot
+ * @param readData slot bytes beginning with header
+ * @param readSize number of bytes available
+ * @return pointer to loaded node
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::makeNode(size_t fileOffset, char const *readData,
+                                                                         size_t readSize) -> std::shared_ptr<ANode> {
+    char header = 0;
+    auto nodeType = NodeTypeOf(fileOffset, readData, readSize);
+    if (!ANode::ChecksumValid(readData, nodeDataSize(nodeType))) {
+        ++this->sessionChecksumFailuresCount;
+        throw std::runtime_error("Checksum mismatch, node at: " + std::to_string(fileOffset) + " is corrupted");
+    }
+    std::shared_ptr<ANode> result = nullptr;
+    if (nodeType == NodeType::INNER) // check node type
+        result = this->newNode<AInnerNode>(fileOffset);
+    if (nodeType == NodeType::LEAF)
+        result = this->newNode<ALeafNode>(fileOffset);
+    result->load(readData + sizeof(header));
+    this->bufferPool.put(fileOffset, result, result->bytesSize() + sizeof(header));
+    return result;
+}
+
+
+/**
+ * Checks header of node read from file
+ * @param fileOffset offset of slot
+ * @param readData slot bytes beginning with header
+ * @param readSize number of bytes available
+ * @return type of node, throws if slot is empty or node is truncated
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::NodeTypeOf(size_t fileOffset, char const *readData,
+                                                                           size_t readSize) -> NodeType {
+    if (readSize == 0)
+        throw std::runtime_error("Tried to read node beyond end of file at: " + std::to_string(fileOffset));
+    auto header = readData[0];
+    if (std::bitset<8>(header)[0] == true) // if node is empty
+        throw std::runtime_error("Tried to read empty node at: " + std::to_string(fileOffset));
+    auto nodeType = static_cast<NodeType>(static_cast<int>(std::bitset<8>(header)[1]));
+    if (readSize < nodeDataSize(nodeType))
+        throw std::runtime_error("Node at: " + std::to_string(fileOffset) + " is truncated");
+    return nodeType;
+}
+
+
+/**
+ * Allocates disk memory for new node, creates it and puts it into buffer pool
+ * @param nodeType type of node to create
+ * @return pointer to created node
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::createNode(NodeType nodeType) -> std::shared_ptr<ANode> {
+    auto offset = AllocateDiskMemory(nodeType);
+    if (this->operationActive) this->latchNode(offset);
+    std::lock_guard lock(this->nodesMutex);
+    std::shared_ptr<ANode> result = nullptr;
+    if (nodeType == NodeType::LEAF)
+        result = this->newNode<ALeafNode>(offset);
+    else
+        result = this->newNode<AInnerNode>(offset);
+    this->bufferPool.put(offset, result, result->bytesSize() + 1);
+    if (this->operationActive) {
+        // space is marked as occupied when operation ends
+        result->markChanged();
+        this->trackNode(result);
+    }
+    return result;
+}
+
+
+/**
+ * Takes slot from free list (or free slots of shadow file) of given node type or appends new one at the end of file
+ * @param nodeType
+ * @return offset of allocated slot
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::AllocateDiskMemory(NodeType nodeType) -> size_t {
+    std::lock_guard lock(this->nodesMutex);
+    auto &head = this->freeListHead(nodeType);
+    auto &slots = this->freeSlots(nodeType);
+    size_t offset;
+    if (this->shadowPaging && !slots.empty()) {
+        offset = slots.back();
+        slots.pop_back();
+        // slot freed by current operation isn't written yet
+        if (auto freed = this->operationNodes.find(offset); freed != this->operationNodes.end()) {
+            freed->second->markUnloaded();
+            this->operationNodes.erase(freed);
+        }
+    } else if (!this->shadowPaging && head != 0) {
+        offset = head;
+        if (auto freed = this->operationNodes.find(offset); freed != this->operationNodes.end()) {
+            // slot freed by current operation isn't written yet
+            if (!freed->second->empty || freed->second->nodeType() != nodeType)
+                throw std::runtime_error("Internal DB error: free list contains occupied slot: " + std::to_string(offset));
+            head = freed->second->nextFreeOffset;
+            freed->second->markUnloaded();
+            this->operationNodes.erase(freed);
+        } else {
+            // free slot contains its header followed by offset of next free slot
+            std::array<char, sizeof(char) + sizeof(NodeOffset)> slot{};
+            this->file.readInto(offset, slot);
+            auto header = std::bitset<8>(slot[0]);
+            if (header[0] != true || header[1] != static_cast<int>(nodeType))
+                throw std::runtime_error("Internal DB error: free list contains occupied slot: " + std::to_string(offset));
+            std::memcpy(&head, slot.data() + 1, sizeof(NodeOffset));
+        }
+        this->updateFreeSpaceHeader();
+    } else {
+        offset = this->fileEnd;
+        this->fileEnd += nodeSlotSize(nodeType);
+    }
+    // drop node which occupied this space before it was freed
+    this->bufferPool.erase(offset);
+    if (this->operationActive) {
+        if (this->shadowPaging) this->shadowSlots.insert(offset);
+        return offset;
+    }
+
+    // Mark space as occupied by simply creating and unloading node
+    if (nodeType == NodeType::LEAF) ALeafNode(offset, this->file).markChanged();
+    else AInnerNode(offset, this->file).markChanged();
+    return offset;
+}
+
+
+/**
+ * Removes node and puts its slot at the beginning of free list. If threads read tree without latches, slot is put
+ * on free list when node is reclaimed, after all of them which could reach it are done. Shadow file keeps slot
+ * intact until tree without node is committed (outside of operation it has to be committed already)
+ * @param node node to remove
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::freeNode(std::shared_ptr<ANode> const &node) -> void {
+    std::lock_guard lock(this->nodesMutex);
+    if (this->shadowPaging) {
+        // slot allocated by current operation is reused at once, it is written as empty one to keep its header valid
+        if (this->operationActive && this->shadowSlots.contains(node->fileOffset)) {
+            node->markEmpty();
+            this->freeSlots(node->nodeType()).push_back(node->fileOffset);
+            return;
+        }
+        // slot used by committed tree is released after tree which doesn't use it is committed
+        node->markUnloaded();
+        this->operationNodes.erase(node->fileOffset);
+        this->bufferPool.erase(node->fileOffset);
+        this->shadowReleasedNodes.push_back(node);
+        if (!this->operationActive) this->releaseShadowNodes();
+        return;
+    }
+    auto retired = this->readersActive();
+    auto &head = this->freeListHead(node->nodeType());
+    node->nextFreeOffset = retired ? 0 : head;
+    if (!retired) head = node->fileOffset;
+    if (this->operationActive) {
+        node->markEmpty();
+        this->trackNode(node);
+    } else {
+        node->remove();
+    }
+    if (retired) this->retiredNodes.push_back({this->globalEpoch.fetch_add(1), node, true});
+    else this->updateFreeSpaceHeader();
+}
+
+
+/**
+ * @param nodeType
+ * @return reference to head of free list for given node type
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::freeListHead(NodeType nodeType) -> uint64_t & {
+    return nodeType == NodeType::LEAF ? this->freeSpaceHeader.leafNodesHead : this->freeSpaceHeader.innerNodesHead;
+}
+
+
+/**
+ * @param nodeType
+ * @return free slots of shadow file for given node type, they are known only in memory
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::freeSlots(NodeType nodeType)
+-> std::vector<NodeOffset> & {
+    return nodeType == NodeType::LEAF ? this->freeLeafSlots : this->freeInnerSlots;
+}
+
+
+/**
+ * @return offset of first node in file
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::firstNodeOffset() const -> NodeOffset {
+    // shadow file begins with two superblocks
+    if (this->shadowPaging) return 2 * SuperblockOffset(this->format, 1);
+    switch (this->format) {
+        case FileFormat::SLOTTED:
+            return sizeof(ConfigHeader) + sizeof(FreeSpaceHeader);
+        case FileFormat::PAGED:
+            return PageSize;
+    }
+    return 0;
+}
+
+
+/**
+ * @param nodeType
+ * @return size of space occupied by node in file
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::nodeSlotSize(NodeType nodeType) const -> size_t {
+    return this->format == FileFormat::PAGED ? PageSize : nodeDataSize(nodeType);
+}
+
+
+/**
+ * @param nodeType
+ * @return size of node with its header
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::nodeDataSize(NodeType nodeType) -> size_t {
+    return 1 + (nodeType == NodeType::LEAF ? ALeafNode::BytesSize() : AInnerNode::BytesSize());
+}
+
+
+/**
+ * Tries to compensate node with neighbour
+ * @param node node which needs compensation
+ * @param key ptr to key added to node (while creating new record only, otherwise nullptr)
+ * @param value ptr value added to node (while creating new record and with leaf nodes only, otherwise nullptr)
+ * @param nodeOffset descendant added to node (only used with inner nodes)
+ * @return true if succeeded and false if failed
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::tryCompensateAndAdd(std::shared_ptr<ANode> node,
+                                                                                     TKey const *const key,
+                                                                                     TValue const *const value,
+                                                                                     size_t nodeOffset) -> bool {
+    if (!node) throw std::invalid_argument("Given node argument is nullptr");
+
+    // if node is root -> can't compensate
+    if (node->parent == nullptr) return false;
+    // determine which node is left / right
+    std::shared_ptr<ANode> left, right;
+    {
+        auto[l, r] = getNodeNeighbours(node);
+        if (key) {     // compensation while adding new key
+            if (l && !l->full()) {
+                left = l;
+                right = node;
+            } else if (r && !r->full()) {
+                left = node;
+                right = r;
+            } else {
+                return false; // if no unfilled neighbours -> can't compensate
+
+            }
+        } else { // compensation after deletion
+            if (l && (l->fillKeysSize() + node->fillKeysSize() >= 2 * node->degree())) {
+                left = l;
+                right = node;
+            } else if (r && (r->fillKeysSize() + node->fillKeysSize() >= 2 * node->degree())) {
+                left = node;
+                right = r;
+            } else {
+                return false; // no nodes which meeting conditions
+            }
+
+        }
+    }
+
+    // compensate nodes
+    auto middleKey = left->compensateWithAndReturnMiddleKey(right, key, value, nodeOffset);
+    // update parent with new middle key (biggest key in left node also)
+    static_cast<AInnerNode *>(node->parent)->setKeyBetweenPtrs(left->fileOffset, right->fileOffset, middleKey);
+    return true;
+}
+
+
+/**
+ * Splits node and update anncestors recursively
+ * @param node node to split
+ * @param key
+ * @param value used only for leaf nodes
+ * @param addedNodeOffset used only for inner nodes
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::splitAndAddRecord(std::shared_ptr<ANode> node,
+                                                                                   TKey const &key,
+                                                                                   TValue const &value,
+                                                                                   size_t addedNodeOffset) -> void {
+    // Create new node, it is placed right after split one
+    auto newNode = createNode(node->nodeType());
+    if (node->nodeType() == NodeType::LEAF) this->linkLeafAfter(node, newNode);
+    else this->linkInnerAfter(static_cast<AInnerNode &>(*node), static_cast<AInnerNode &>(*newNode));
+
+    // if root then create new parent (new root)
+    if (node == root) {
+        auto newRoot = std::dynamic_pointer_cast<AInnerNode>(createNode(NodeType::INNER));
+        // compensate old root with newly created empty node
+        auto midKey = node->compensateWithAndReturnMiddleKey(newNode, &key, &value, addedNodeOffset);
+        // add pointers of old root and newly created node to new root
+        newRoot->setEntries({{midKey}, {node->fileOffset, newNode->fileOffset}});
+        newRoot->markChanged();
+        newRoot->loaded = true;
+        // old root may be kept alive for readers (see setRoot), so it is written when operation ends
+        this->trackNode(node);
+        this->setRoot(newRoot);
+        this->updateConfigHeader();
+        return;
+    }
+
+    // if no parent -> error
+    if (node->parent == nullptr) throw std::runtime_error("Internal database error: nullptr node parent");
+
+    // compensate node with newly created node
+    auto middleKey = node->compensateWithAndReturnMiddleKey(newNode, &key, &value, addedNodeOffset);
+
+    // add info about this nodes to parent
+    auto newNodeOffset = newNode->fileOffset;
+
+    newNode = nullptr; // unload new node, it is needed no more
+
+    // if parent not full -> simply add new key and ptr to new node
+    if (!node->parent->full()) {
+        static_cast<AInnerNode *>(node->parent)->add(middleKey, newNodeOffset);
+        return;
+    }
+
+    // else try compensate and add
+    auto parent = this->parentOf(*node);
+    bool compensationSucceeded = tryCompensateAndAdd(parent, &middleKey, &value, newNodeOffset);
+    if (compensationSucceeded) return;
+
+    // else split parent
+    splitAndAddRecord(parent, middleKey, value, newNodeOffset);
+}
+
+
+/**
+ * Adds sorted records of keys which belong to given leaf and don't exist in tree. Records over capacity of leaf are
+ * moved to neighbour if it has enough free space, else leaf is split into as many nodes as needed
+ * @param leaf
+ * @param records
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::addRecords(
+        std::shared_ptr<ALeafNode> const &leaf, std::vector<std::pair<TKey, TValue>> const &records) -> void {
+    auto const capacity = 2 * TLeafNodeDegree;
+    auto const keyLess = [](auto const &x, auto const &y) { return x.first < y.first; };
+    auto leafRecords = leaf->getRecords();
+    auto data = std::vector<std::pair<TKey, TValue>>();
+    data.reserve(leafRecords.size() + records.size());
+    std::merge(leafRecords.begin(), leafRecords.end(), records.begin(), records.end(), std::back_inserter(data),
+               keyLess);
+
+    // records are spread evenly over nodes, returns greatest keys of all nodes but the last one
+    auto spread = [&data](std::vector<std::shared_ptr<ALeafNode>> const &nodes) {
+        std::vector<TKey> separators;
+        auto begin = data.begin();
+        for (size_t n = 0; n < nodes.size(); ++n) {
+            auto end = begin + data.size() / nodes.size() + (n < data.size() % nodes.size() ? 1 : 0);
+            nodes[n]->setRecords(begin, end);
+            if (n + 1 < nodes.size()) separators.push_back(std::prev(end)->first);
+            begin = end;
+        }
+        return separators;
+    };
+
+    if (data.size() <= capacity) {
+        leaf->setRecords(data.begin(), data.end());
+        return;
+    }
+
+    // compensate with neighbour if it can take all records over capacity
+    if (leaf->parent) {
+        auto[l, r] = this->getNodeNeighbours(leaf);
+        auto const overflow = data.size() - capacity;
+        std::shared_ptr<ALeafNode> left, right;
+        if (l && capacity - l->fillKeysSize() >= overflow) {
+            left = std::dynamic_pointer_cast<ALeafNode>(l), right = leaf;
+            auto neighbourRecords = left->getRecords();
+            data.insert(data.begin(), neighbourRecords.begin(), neighbourRecords.end());
+        } else if (r && capacity - r->fillKeysSize() >= overflow) {
+            left = leaf, right = std::dynamic_pointer_cast<ALeafNode>(r);
+            auto neighbourRecords = right->getRecords();
+            data.insert(data.end(), neighbourRecords.begin(), neighbourRecords.end());
+        }
+        if (left) {
+            auto middleKey = spread({left, right}).front();
+            static_cast<AInnerNode *>(leaf->parent)->setKeyBetweenPtrs(left->fileOffset, right->fileOffset,
+                                                                       middleKey);
+            return;
+        }
+    }
+
+    // else split leaf into the least number of nodes, new ones are linked right after it
+    std::vector<std::shared_ptr<ALeafNode>> nodes{leaf};
+    while (nodes.size() * capacity < data.size()) {
+        nodes.push_back(std::dynamic_pointer_cast<ALeafNode>(createNode(NodeType::LEAF)));
+        this->linkLeafAfter(*std::prev(nodes.end(), 2), nodes.back());
+    }
+    auto separators = spread(nodes);
+    std::vector<std::pair<TKey, NodeOffset>> entries;
+    for (size_t n = 1; n < nodes.size(); ++n) entries.emplace_back(separators[n - 1], nodes[n]->fileOffset);
+    this->addEntriesToParent(leaf, entries);
+}
+
+
+/**
+ * Adds sorted keys with pointers to descendants which follow them to inner node. Like in case of leaves, entries over
+ * capacity are moved to neighbour if it has enough free space, else node is split into as many nodes as needed
+ * @param node
+ * @param entries
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::addEntries(
+        std::shared_ptr<AInnerNode> const &node, std::vector<std::pair<TKey, NodeOffset>> const &entries) -> void {
+    auto const capacity = 2 * TInnerNodeDegree;
+    auto const keyLess = [](auto const &x, auto const &y) { return x.first < y.first; };
+    // node is kept as its first descendant followed by pairs of key and descendant after it
+    auto toEntries = [](std::shared_ptr<AInnerNode> const &innerNode) {
+        auto[keys, descendants] = innerNode->getEntries();
+        std::vector<std::pair<TKey, NodeOffset>> result;
+        for (size_t k = 0; k < keys.size(); ++k) result.emplace_back(keys[k], descendants[k + 1]);
+        return std::pair(descendants.front(), result);
+    };
+    auto nodeEntries = toEntries(node);
+    auto firstDescendant = nodeEntries.first;
+    auto data = std::vector<std::pair<TKey, NodeOffset>>();
+    data.reserve(nodeEntries.second.size() + entries.size());
+    std::merge(nodeEntries.second.begin(), nodeEntries.second.end(), entries.begin(), entries.end(),
+               std::back_inserter(data), keyLess);
+
+    // descendants are spread evenly over nodes, returns keys between nodes which have to be moved to parent
+    auto spread = [&firstDescendant, &data](std::vector<std::shared_ptr<AInnerNode>> const &nodes) {
+        std::vector<TKey> separators;
+        auto const descendantsCount = data.size() + 1;
+        auto first = firstDescendant;
+        auto begin = data.begin();
+        for (size_t n = 0; n < nodes.size(); ++n) {
+            auto end = begin + descendantsCount / nodes.size() + (n < descendantsCount % nodes.size() ? 1 : 0) - 1;
+            std::pair<std::vector<TKey>, std::vector<NodeOffset>> content{{}, {first}};
+            for (auto it = begin; it != end; ++it) {
+                content.first.push_back(it->first);
+                content.second.push_back(it->second);
+            }
+            nodes[n]->setEntries(content);
+            if (n + 1 < nodes.size()) {
+                separators.push_back(end->first);
+                first = end->second;
+                ++end;
+            }
+            begin = end;
+        }
+        return separators;
+    };
+
+    if (data.size() <= capacity) {
+        spread({node});
+        return;
+    }
+
+    // compensate with neighbour if it can take all entries over capacity, key between nodes moves down from parent
+    if (node->parent) {
+        auto parent = static_cast<AInnerNode *>(node->parent);
+        auto[l, r] = this->getNodeNeighbours(node);
+        auto const overflow = data.size() - capacity;
+        std::shared_ptr<AInnerNode> left, right;
+        if (l && capacity - l->fillKeysSize() >= overflow) {
+            left = std::dynamic_pointer_cast<AInnerNode>(l), right = node;
+            auto[neighbourFirst, neighbourEntries] = toEntries(left);
+            neighbourEntries.emplace_back(parent->getKeyBetweenPtrs(left->fileOffset, right->fileOffset),
+                                          firstDescendant);
+            data.insert(data.begin(), neighbourEntries.begin(), neighbourEntries.end());
+            firstDescendant = neighbourFirst;
+        } else if (r && capacity - r->fillKeysSize() >= overflow) {
+            left = node, right = std::dynamic_pointer_cast<AInnerNode>(r);
+            auto[neighbourFirst, neighbourEntries] = toEntries(right);
+            data.emplace_back(parent->getKeyBetweenPtrs(left->fileOffset, right->fileOffset), neighbourFirst);
+            data.insert(data.end(), neighbourEntries.begin(), neighbourEntries.end());
+        }
+        if (left) {
+            auto middleKey = spread({left, right}).front();
+            parent->setKeyBetweenPtrs(left->fileOffset, right->fileOffset, middleKey);
+            return;
+        }
+    }
+
+    // else split node into the least number of nodes
+    std::vector<std::shared_ptr<AInnerNode>> nodes{node};
+    while (nodes.size() * (capacity + 1) < data.size() + 1) {
+        nodes.push_back(std::dynamic_pointer_cast<AInnerNode>(createNode(NodeType::INNER)));
+        nodes.back()->loaded = true;
+        this->linkInnerAfter(**std::prev(nodes.end(), 2), *nodes.back());
+    }
+    auto separators = spread(nodes);
+    std::vector<std::pair<TKey, NodeOffset>> parentEntries;
+    for (size_t n = 1; n < nodes.size(); ++n) parentEntries.emplace_back(separators[n - 1], nodes[n]->fileOffset);
+    this->addEntriesToParent(node, parentEntries);
+}
+
+
+/**
+ * Adds entries of nodes created by split of given one to its parent, new root is created if node is root
+ * @param node
+ * @param entries
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::addEntriesToParent(
+        std::shared_ptr<ANode> const &node, std::vector<std::pair<TKey, NodeOffset>> const &entries) -> void {
+    if (node == root) {
+        auto newRoot = std::dynamic_pointer_cast<AInnerNode>(createNode(NodeType::INNER));
+        newRoot->setEntries({{}, {node->fileOffset}});
+        newRoot->loaded = true;
+        node->parent = newRoot.get();
+        // old root is read by next descents of operation, so it has to be found among nodes used by it
+        this->trackNode(node);
+        this->setRoot(newRoot);
+        this->updateConfigHeader();
+    }
+    if (node->parent == nullptr) throw std::runtime_error("Internal database error: nullptr node parent");
+    this->addEntries(this->parentOf(*node), entries);
+}
+
+
+/**
+ * Merges given node with neighbour and updates ancestors recursively
+ * @param node node needed to be merged
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::merge(std::shared_ptr<BPlusTree::ANode> node) -> void {
+    // get neighbour to merge with
+    // this key we will need to replace with new greatest key in ancestors
+    TKey oldKey;
+    if (node->nodeType() == NodeType::LEAF) {
+        oldKey = *std::dynamic_pointer_cast<ALeafNode>(node)->getLastKey();
+    }
+    auto[left, right] = this->getNodeNeighbours(node);
+
+    if (left) {
+        right = nullptr;
+        // get max key of left descendant
+        auto key = static_cast<AInnerNode *>(left->parent)->getKeyBetweenPtrs(left->fileOffset, node->fileOffset);
+        left->mergeWith(node, &key);
+        if (node->nodeType() == NodeType::LEAF) this->unlinkLeaf(node);
+        this->freeNode(node);
+        node = left;
+        left = nullptr;
+    } else if (right) {
+        left = nullptr;
+        // get max key of this node
+        auto key = static_cast<AInnerNode *>(node->parent)->getKeyBetweenPtrs(node->fileOffset, right->fileOffset);
+        node->mergeWith(right, &key);
+        if (right->nodeType() == NodeType::LEAF) this->unlinkLeaf(right);
+        this->freeNode(right);
+        right = nullptr;
+    } else {
+        throw std::runtime_error("Internal error: merge: no selectedNeighbour");
+    }
+
+    // update parent key with new last key
+    TKey lastKey;
+    if (node->nodeType() == NodeType::LEAF) {
+        auto leafNode = std::dynamic_pointer_cast<ALeafNode>(node);
+        lastKey = *leafNode->getLastKey();
+        auto parent = static_cast<AInnerNode *>(node->parent);
+        while (parent != nullptr) {
+            if (parent->contains(oldKey)) {
+                parent->swapKeys(oldKey, lastKey);
+            }
+            parent = static_cast<AInnerNode *>(parent->parent);
+        }
+    }
+
+    auto parent = this->parentOf(*node);
+
+    // remove out-of-date descendant and key
+    auto nodeState = parent->removeKeyOffsetAfter(node->fileOffset);
+
+    // parent node is valid
+    if (nodeState == NodeState::OK)
+        return;
+
+    // if parent is root
+    if (parent == root) {
+        // if root contains 0 items -> remove and make new root from descendant
+        if (parent->getEntries().first.empty()) {
+            this->freeNode(root);
+            this->setRoot(node);
+            root->parent = nullptr;
+        } // else do nothing
+        return;
+    }
+
+    // parent node is too small
+    if (nodeState & NodeState::TOO_SMALL) {
+        // try compensate with neighbour
+        bool compensationSuccess = tryCompensateAndAdd(parent);
+        if (!compensationSuccess) {
+            merge(parent);
+        }
+    }
+
+
+}
+
+
+/**
+ * Returns pair of ptrs to left and right neighbour
+ * @param node node which neighbours are looked for
+ * @return pair of ptrs to loaded neighbour nodes, nullptr if no such node
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::getNodeNeighbours(std::shared_ptr<ANode> node)
+-> std::pair<std::shared_ptr<ANode>, std::shared_ptr<ANode>> {
+
+    auto result = std::make_pair<std::shared_ptr<ANode>, std::shared_ptr<ANode>>(nullptr, nullptr);
+    if (node->parent == nullptr) return result;
+    auto parent = static_cast<AInnerNode *>(node->parent);
+
+    auto lOffset = parent->getPrevDescendantOffset(node->fileOffset);
+    auto rOffset = parent->getNextDescendantOffset(node->fileOffset);
+
+    // both neighbours are read at once
+    std::array<NodeOffset, 2> offsets{};
+    size_t offsetsCount = 0;
+    if (lOffset) offsets[offsetsCount++] = *lOffset;
+    if (rOffset) offsets[offsetsCount++] = *rOffset;
+    auto &nodes = this->neighbourNodes;
+    this->readNodes({offsets.data(), offsetsCount}, nodes);
+
+    // left neighbour found
+    if (lOffset) {
+        result.first = nodes.front();
+        result.first->parent = node->parent;
+    }
+
+    // right neighbour found
+    if (rOffset) {
+        result.second = nodes.back();
+        result.second->parent = node->parent;
+    }
+    nodes.clear();
+
+    return result;
+}
+
+
+/**
+ * Parents are kept by nodes without being owned, owning pointer is taken from nodes used by current operation
+ * @param node node found by descent of current operation
+ * @return parent of node, nullptr if node is root
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::parentOf(ANode const &node)
+-> std::shared_ptr<AInnerNode> {
+    if (node.parent == nullptr) return nullptr;
+    if (node.parent == this->root.get()) return std::static_pointer_cast<AInnerNode>(this->root);
+    std::lock_guard lock(this->nodesMutex);
+    auto it = this->operationNodes.find(node.parent->fileOffset);
+    if (it == this->operationNodes.end() || it->second.get() != node.parent)
+        throw std::runtime_error("Internal DB error: parent isn't used by operation: " +
+                                 std::to_string(node.parent->fileOffset));
+    return std::static_pointer_cast<AInnerNode>(it->second);
+}
+
+
+/**
+ * Inserts new leaf into list of leaves right after given one
+ * @param leaf
+ * @param newLeaf empty leaf
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::linkLeafAfter(std::shared_ptr<ANode> const &leaf,
+                                                                               std::shared_ptr<ANode> const &newLeaf)
+-> void {
+    // leaves of shadow file aren't linked, otherwise every change would copy their neighbours
+    if (this->shadowPaging) return;
+    auto left = std::dynamic_pointer_cast<ALeafNode>(leaf);
+    auto added = std::dynamic_pointer_cast<ALeafNode>(newLeaf);
+    if (left->nextLeafOffset != 0) {
+        auto next = std::dynamic_pointer_cast<ALeafNode>(this->readNode(left->nextLeafOffset));
+        next->prevLeafOffset = added->fileOffset;
+        next->markChanged();
+    }
+    added->nextLeafOffset = left->nextLeafOffset;
+    added->prevLeafOffset = left->fileOffset;
+    added->highKey = left->highKey;
+    left->nextLeafOffset = added->fileOffset;
+    left->markChanged();
+    added->markChanged();
+}
+
+
+/**
+ * Removes leaf from list of leaves linking its neighbours together
+ * @param leaf leaf which is going to be freed
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::unlinkLeaf(std::shared_ptr<ANode> const &leaf) -> void {
+    if (this->shadowPaging) return;
+    auto removed = std::dynamic_pointer_cast<ALeafNode>(leaf);
+    // neighbours taking part in merge are already loaded, so they are taken from operation nodes
+    if (removed->prevLeafOffset != 0) {
+        auto prev = std::dynamic_pointer_cast<ALeafNode>(this->readNode(removed->prevLeafOffset));
+        prev->nextLeafOffset = removed->nextLeafOffset;
+        prev->highKey = removed->highKey;
+        prev->markChanged();
+    }
+    if (removed->nextLeafOffset != 0) {
+        auto next = std::dynamic_pointer_cast<ALeafNode>(this->readNode(removed->nextLeafOffset));
+        next->prevLeafOffset = removed->prevLeafOffset;
+        next->markChanged();
+    }
+    removed->nextLeafOffset = removed->prevLeafOffset = 0;
+}
+
+
+/**
+ * Inserts new inner node into list of nodes of its level right after given one, new node takes over its high key
+ * @param node
+ * @param newNode empty node
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::linkInnerAfter(AInnerNode &node, AInnerNode &newNode)
+-> void {
+    // like leaves, inner nodes of shadow file aren't linked
+    if (this->shadowPaging) return;
+    newNode.rightLink = node.rightLink;
+    newNode.highKey = node.highKey;
+    node.rightLink = newNode.fileOffset;
+    node.markChanged();
+    newNode.markChanged();
+}
+
+
+/**
+ * Sets high keys of nodes used by current operation to separators which bound them in their parents (key following
+ * node, or high key of parent for its last descendant). Bounds change only below nodes changed by operation, nodes
+ * whose high keys are changed are latched again if descent released them
+ * @param node inner node used by operation
+ * @param highKey high key of node, nullptr if node is the last one of its level
+ * @param boundsChanged whether any ancestor of node was changed
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::updateHighKeys(AInnerNode &node,
+                                                                               TKey const *highKey,
+                                                                               bool boundsChanged) -> void {
+    boundsChanged |= node.changed;
+    for (size_t i = 0; i < node.descendantsCount; ++i) {
+        auto it = this->operationNodes.find(node.descendants[i]);
+        if (it == this->operationNodes.end() || it->second->empty) continue;
+        auto &descendant = *it->second;
+        auto bound = i < node.keysCount ? &node.keys[i] : highKey;
+        if (descendant.nodeType() == NodeType::LEAF) {
+            auto &leaf = static_cast<ALeafNode &>(descendant);
+            if (!boundsChanged || !bound || leaf.nextLeafOffset == 0 || leaf.highKey == *bound) continue;
+            this->latchNode(leaf.fileOffset);
+            leaf.highKey = *bound;
+            leaf.markChanged();
+            continue;
+        }
+        auto &innerNode = static_cast<AInnerNode &>(descendant);
+        if (boundsChanged && bound && innerNode.rightLink != 0 && innerNode.highKey != *bound) {
+            this->latchNode(innerNode.fileOffset);
+            innerNode.highKey = *bound;
+            innerNode.markChanged();
+        }
+        this->updateHighKeys(innerNode, bound, boundsChanged);
+    }
+}
+
+
+/**
+ * Updates config header in db file
+ * @return
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::updateConfigHeader() -> void {
+    std::lock_guard lock(this->nodesMutex);
+    configHeader.rootOffset = this->root->fileOffset;
+    configHeader.innerNodeDegree = TInnerNodeDegree;
+    configHeader.leafNodeDegree = TLeafNodeDegree;
+    if (this->operationActive) this->headersChanged = true;
+    else if (this->shadowPaging) this->writeSuperblock();
+    else if (this->format == FileFormat::PAGED) this->writeHeadersPage();
+    else this->file.write(0, configHeader);
+}
+
+
+/**
+ * Updates free lists heads in db file, they are kept only in memory for files without free space header. Shadow
+ * file doesn't use free lists
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::updateFreeSpaceHeader() -> void {
+    if (this->shadowPaging) return;
+    std::lock_guard lock(this->nodesMutex);
+    if (this->operationActive) this->headersChanged = true;
+    else if (this->format == FileFormat::PAGED) this->writeHeadersPage();
+    else this->file.write(sizeof(ConfigHeader), freeSpaceHeader);
+}
+
+
+/**
+ * Writes both headers as whole first page of paged file, so it never has to be read before writing
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::writeHeadersPage() -> void {
+    std::array<char, PageSize> page{};
+    std::memcpy(page.data(), &this->configHeader, sizeof(ConfigHeader));
+    std::memcpy(page.data() + sizeof(ConfigHeader), &this->freeSpaceHeader, sizeof(FreeSpaceHeader));
+    this->file.writeFrom(0, page);
+}
+
+
+/**
+ * @param format
+ * @param sequence sequence of superblock
+ * @return offset of slot of shadow file used by superblock with given sequence, slots are used alternately
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::SuperblockOffset(FileFormat format, uint64_t sequence)
+-> NodeOffset {
+    static_assert(sizeof(Superblock) <= Superblock::SlotSize);
+    if (sequence % 2 == 0) return 0;
+    return format == FileFormat::PAGED ? PageSize : Superblock::SlotSize;
+}
+
+
+/**
+ * Reads superblock of shadow file from given slot
+ * @param file
+ * @param offset offset of slot
+ * @return superblock, nullopt if slot doesn't contain valid one (e.g. its write was interrupted)
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::ReadSuperblock(File &file, NodeOffset offset)
+-> std::optional<Superblock> {
+    if (file.size() < offset + sizeof(Superblock)) return std::nullopt;
+    auto superblock = file.template read<Superblock>(offset);
+    file.clear();
+    if (!superblock.valid()) return std::nullopt;
+    auto magic = superblock.magic;
+    if (magic != FreeSpaceHeader::ShadowMagic && magic != FreeSpaceHeader::PagedShadowMagic) return std::nullopt;
+    // second slot is placed according to format
+    auto format = magic == FreeSpaceHeader::PagedShadowMagic ? FileFormat::PAGED : FileFormat::SLOTTED;
+    if (offset != SuperblockOffset(format, superblock.sequence)) return std::nullopt;
+    return superblock;
+}
+
+
+/**
+ * Commits shadow file: nodes written so far are made durable, then both headers are written as superblock with
+ * next sequence into slot of the older one. Write interrupted by crash leaves the previous superblock valid.
+ * Readers aren't blocked while file is synced, unless caller locked nodesMutex
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::writeSuperblock() -> void {
+    // superblock fills its own sector (or page), so it is never torn together with other data
+    std::array<char, PageSize> slot{};
+    auto const slotSize = this->format == FileFormat::PAGED ? PageSize : Superblock::SlotSize;
+    Superblock superblock{};
+    {
+        std::lock_guard lock(this->nodesMutex);
+        this->configHeader.rootOffset = this->root->fileOffset;
+        superblock.configHeader = this->configHeader;
+        superblock.magic = this->freeSpaceHeader.magic;
+        superblock.fileEnd = this->fileEnd;
+        superblock.sequence = ++this->superblockSequence;
+        superblock.checksum = superblock.computeChecksum();
+        std::memcpy(slot.data(), &superblock, sizeof(Superblock));
+    }
+    this->file.sync();
+    {
+        std::lock_guard lock(this->nodesMutex);
+        this->file.writeFrom(SuperblockOffset(this->format, superblock.sequence), std::span(slot).first(slotSize));
+    }
+    this->file.sync();
+}
+
+
+/**
+ * Finds free slots of opened shadow file, those which aren't used by committed tree. Inner nodes are read level by
+ * level, leaves aren't read. Types of the rest of slots are read from their headers
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::findFreeSlots() -> void {
+    std::map<NodeOffset, NodeType> used;
+    std::vector<NodeOffset> level{this->root->fileOffset};
+    auto levelType = this->root->nodeType();
+    while (true) {
+        for (auto offset : level) used.emplace(offset, levelType);
+        if (levelType == NodeType::LEAF) break;
+        std::vector<NodeOffset> lowerLevel;
+        std::vector<std::shared_ptr<ANode>> nodes;
+        this->readNodes(level, nodes);
+        for (auto const &node : nodes) {
+            auto descendants = std::dynamic_pointer_cast<AInnerNode>(node)->getEntries().second;
+            lowerLevel.insert(lowerLevel.end(), descendants.begin(), descendants.end());
+        }
+        // all leaves are at the same depth
+        levelType = this->readNode(lowerLevel.front())->nodeType();
+        level = std::move(lowerLevel);
+    }
+    for (auto offset = this->firstNodeOffset(); offset < this->fileEnd;) {
+        auto nodeType = NodeType::LEAF;
+        if (auto it = used.find(offset); it != used.end()) {
+            nodeType = it->second;
+        } else {
+            std::array<char, 1> header{};
+            if (this->file.readInto(offset, header) != header.size())
+                throw std::runtime_error("Internal DB error: committed slot is truncated: " + std::to_string(offset));
+            nodeType = static_cast<NodeType>(static_cast<int>(std::bitset<8>(header[0])[1]));
+            this->freeSlots(nodeType).push_back(offset);
+        }
+        offset += this->nodeSlotSize(nodeType);
+    }
+    // slots at the beginning of file are used first
+    std::reverse(this->freeLeafSlots.begin(), this->freeLeafSlots.end());
+    std::reverse(this->freeInnerSlots.begin(), this->freeInnerSlots.end());
+}
+
+
+/**
+ * Creates new records with given key and value
+ * @param key
+ * @param value
+ * @return whether record was inserted or key already exists
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto
+BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::createRecord(TKey const &key, TValue const &value)
+-> InsertStatus {
+    auto result = InsertStatus::INSERTED;
+    auto inserted = this->tryChangeLeaf(key, LeafChange::INSERT, [&](ALeafNode &leafNode) {
+        if (leafNode.contains(key)) result = InsertStatus::DUPLICATE;
+        else leafNode.insert(key, value);
+    });
+    if (inserted) return result;
+    // leaf is full, so it is split
+    if (auto status = this->splitLeaf(key, value)) return *status;
+
+    // tree which can't be split concurrently gets record by operation
+    this->runOperation([&] {
+        // find leaf to insert record into
+        auto leafNode = this->findProperLeaf(key, LeafChange::INSERT);
+
+        // if key exists then Exit
+        if (leafNode->contains(key)) {
+            result = InsertStatus::DUPLICATE;
+            return;
+        }
+
+        // if node not full -> insert record
+        if (!leafNode->full()) {
+            leafNode->insert(key, value);
+            return;
+        }
+
+        // else try compensate node and add record
+        bool compensationSucceeded = tryCompensateAndAdd(leafNode, &key, &value);
+        if (compensationSucceeded) return;
+
+        // else split node and add record
+        splitAndAddRecord(leafNode, key, value);
+    });
+    return result;
+}
+
+
+/**
+ * Creates batch of records. Records are sorted by key, so all of them which belong to the same leaf are added while
+ * it is loaded - tree is descended once per affected leaf, and every node is compensated or split at most once.
+ * Changes are committed after every leaf which makes number of used nodes exceed CreateRecordsNodesLimit
+ * @param records
+ * @return status of each record in order of given ones, of records with equal keys only the first one is inserted
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::createRecords(
+        std::span<std::pair<TKey, TValue> const> records) -> std::vector<InsertStatus> {
+    auto result = std::vector<InsertStatus>(records.size(), InsertStatus::DUPLICATE);
+    auto order = std::vector<size_t>(records.size());
+    std::iota(order.begin(), order.end(), size_t{0});
+    std::stable_sort(order.begin(), order.end(),
+                     [&records](auto a, auto b) { return records[a].first < records[b].first; });
+
+    this->runOperation([&] {
+        std::optional<TKey> previousKey;
+        for (size_t i = 0; i < order.size();) {
+            std::optional<TKey> upperBound;
+            auto leafNode = this->findProperLeaf(records[order[i]].first, LeafChange::INSERT_MANY, &upperBound);
+            // take all records up to greatest key which can be kept by leaf
+            std::vector<std::pair<TKey, TValue>> leafRecords;
+            for (; i < order.size() && (!upperBound || !(*upperBound < records[order[i]].first)); ++i) {
+                auto const &record = records[order[i]];
+                auto duplicate = (previousKey && *previousKey == record.first) || leafNode->contains(record.first);
+                previousKey = record.first;
+                if (duplicate) continue;
+                leafRecords.push_back(record);
+                result[order[i]] = InsertStatus::INSERTED;
+            }
+            if (!leafRecords.empty()) this->addRecords(leafNode, leafRecords);
+
+            // nodes used so far are committed, they would be pinned in buffer pool until the end of operation
+            if (this->operationNodes.size() >= CreateRecordsNodesLimit) {
+                this->flushOperation();
+                this->commitOperation();
+                this->beginOperation();
+            }
+        }
+    });
+    return result;
+}
+
+
+/**
+ * Reads and returns record with given key, can be called by many threads while tree is changed
+ * @param key
+ * @return optional record, nullopt if doesn't exist
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::readRecord(TKey const &key) -> std::optional<TValue> {
+    EpochGuard guard(this);
+    while (true) {
+        auto leaf = this->findLeafOptimistic(key);
+        auto result = static_cast<ALeafNode const *>(leaf.node)->readRecord(key);
+        if (this->versionValid(leaf.node->fileOffset, leaf.version)) return result;
+        // leaf was changed after it was found, e.g. it was split and record was moved to its new neighbour
+        // (changed leaf of shadow file is replaced by its copy, so it is found again)
+        if (!this->shadowPaging) return this->readRecordAlongLeaves(key, leaf.node->fileOffset);
+    }
+}
+
+
+/**
+ * Reads record starting from leaf which was changed after descent found it. Records of changed leaf can be moved
+ * only to its neighbours, so they are followed by links of leaves: to the right while key is greater than high key
+ * of leaf (right link of B-link tree), to the left while it is lower than keys of leaf (e.g. after merge). Each
+ * leaf is validated together with the one visited before it, key lying between them doesn't exist.
+ * Search is restarted from root only if leaf is freed meanwhile
+ * @param key
+ * @param leafOffset offset of changed leaf
+ * @return optional record, nullopt if doesn't exist
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::readRecordAlongLeaves(TKey const &key,
+                                                                                       NodeOffset leafOffset)
+-> std::optional<TValue> {
+    auto leaf = this->readOptimisticNode(leafOffset, this->readVersion(leafOffset), true);
+    OptimisticNode previous; // leaf visited before current one
+    auto movingLeft = false;
+    while (true) {
+        if (!leaf.node || leaf.node->nodeType() != NodeType::LEAF) {
+            leaf = this->findLeafOptimistic(key);
+            previous = {};
+        }
+        auto leafNode = static_cast<ALeafNode const *>(leaf.node);
+        auto count = std::min<size_t>(leafNode->count, 2 * TLeafNodeDegree);
+        auto result = leafNode->readRecord(key);
+        auto goLeft = count > 0 && key < leafNode->keys[0];
+        auto goRight = leafNode->nextLeafOffset != 0 && leafNode->highKey < key;
+        auto nextOffset = goLeft ? leafNode->prevLeafOffset : goRight ? leafNode->nextLeafOffset : 0;
+        auto nextVersion = nextOffset != 0 ? this->readVersion(nextOffset) : 0;
+        if (!this->versionValid(leafNode->fileOffset, leaf.version) ||
+            (previous.node && !this->versionValid(previous.node->fileOffset, previous.version))) {
+            leaf = this->readOptimisticNode(leafNode->fileOffset, this->readVersion(leafNode->fileOffset), true);
+            previous = {};
+            continue;
+        }
+        // key lies between previous leaf and current one or beyond the first or the last leaf
+        if (result || nextOffset == 0 || (previous.node && goLeft != movingLeft)) return result;
+        movingLeft = goLeft;
+        previous = std::move(leaf);
+        leaf = this->readOptimisticNode(nextOffset, nextVersion);
+    }
+}
+
+
+/**
+ * Updates record with given key, throws if key not found
+ * @param key key of record to update
+ * @param value data to update to
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto
+BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::updateRecord(TKey const &key, TValue const &value) -> void {
+    // update never changes ancestors of leaf
+    auto updated = this->tryChangeLeaf(key, LeafChange::UPDATE, [&](ALeafNode &leafNode) {
+        leafNode.updateRecord(key, value);
+    });
+    if (updated) return;
+
+    // leaf of shadow file is copied by operation
+    this->runOperation([&] { this->findProperLeaf(key, LeafChange::UPDATE)->updateRecord(key, value); });
+}
+
+
+/**
+ * Deletes record with given key, does nothing if key doesn't exist
+ * @param key key of record to delete
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::deleteRecord(TKey const &key) -> void {
+    auto deleted = this->tryChangeLeaf(key, LeafChange::DELETE, [&](ALeafNode &leafNode) {
+        if (!leafNode.contains(key)) throw std::runtime_error("Key " + std::to_string(key) + " doesn't exist");
+        leafNode.deleteRecord(key);
+    });
+    if (deleted) return;
+
+    // leaf becomes too small or its greatest key changes, so record is deleted by operation
+    this->runOperation([&] {
+        // find ndoe possibly containing record
+        auto node = this->findProperLeaf(key, LeafChange::DELETE);
+        if (!node->contains(key)) {
+            throw std::runtime_error("Key " + std::to_string(key) + " doesn't exist");
+        }
+
+        // remove
+        auto nodeState = node->deleteRecord(key);
+        // if root -> no need to do anything
+        if (node == root) return;
+        // node is ok after deletion
+        if (nodeState == OK)
+            return;
+
+        // if deleted last key get new last key and put it in the ancestor instead of old one (if exists)
+        if (nodeState & NodeState::DELETED_LAST) {
+            auto lastKey = node->getLastKey();
+            if (!lastKey)
+                throw std::runtime_error("Internal error: Unable to determine new greatest key in node: " +
+                                         std::to_string(node->fileOffset));
+            auto parent = static_cast<AInnerNode *>(node->parent);
+            while (parent != nullptr) {
+                if (parent->contains(key)) {
+                    parent->swapKeys(key, *lastKey);
+                }
+                parent = static_cast<AInnerNode *>(parent->parent);
+            }
+        }
+
+        if (nodeState & NodeState::TOO_SMALL) {
+            // try compensate with neighbour
+            bool compensationSuccess = tryCompensateAndAdd(node);
+            if (!compensationSuccess) {
+                merge(node);
+            }
+        }
+    });
+}
+
+
+/**
+ * Builds tree from records sorted by key, tree has to be empty. Leaves are filled in order of keys and placed one
+ * after another at the end of file, then every level of inner nodes is built from greatest keys of level below.
+ * Nodes are written in batches of adjacent slots and root is replaced after all of them are written, so load
+ * interrupted by error leaves tree empty.
+ * @param first iterator to first record (pair of key and value)
+ * @param last iterator after last record
+ * @param fillFactor part of capacity of nodes used by load, nodes are never filled below their degree
+ * @return number of loaded records
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+template<typename TIterator>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::bulkLoad(TIterator first, TIterator last,
+                                                                          double fillFactor) -> uint64_t {
+    if (!(fillFactor > 0 && fillFactor <= 1))
+        throw std::runtime_error("Fill factor has to be in range (0, 1]");
+    if (!this->empty())
+        throw std::runtime_error("Bulk load requires empty tree");
+
+    auto fillOf = [fillFactor](size_t min, size_t max) {
+        return std::clamp(static_cast<size_t>(std::lround(fillFactor * static_cast<double>(max))), min, max);
+    };
+    // Returns number of entries of next node, 0 if it is not known until more entries are read. Nodes get fill
+    // entries as long as enough of them remain for next node, the last ones are split into one or two nodes.
+    auto nextNodeSize = [](size_t pending, size_t fill, size_t min, size_t max, bool inputEnded) -> size_t {
+        if (pending >= fill + min) return fill;
+        if (!inputEnded) return 0;
+        return pending <= max ? pending : pending / 2;
+    };
+    auto allocate = [this](NodeType nodeType) {
+        auto offset = this->fileEnd;
+        this->fileEnd += this->nodeSlotSize(nodeType);
+        return offset;
+    };
+    std::vector<std::shared_ptr<ANode>> batch;
+    auto writeBatch = [this, &batch] {
+        this->writeNodes(batch, false);
+        batch.clear();
+        this->commitOperation();
+    };
+    // greatest key and offset of every node of level being built
+    std::vector<std::pair<TKey, NodeOffset>> level;
+
+    auto const leafFill = fillOf(TLeafNodeDegree, 2 * TLeafNodeDegree);
+    std::vector<std::pair<TKey, TValue>> pending;
+    std::optional<TKey> previousKey;
+    uint64_t recordsCount = 0;
+    NodeOffset prevLeafOffset = 0;
+    for (auto inputEnded = false; !inputEnded;) {
+        inputEnded = first == last;
+        if (!inputEnded) {
+            auto const &[key, value] = *first;
+            if (previousKey && !(*previousKey < key))
+                throw std::runtime_error("Records have to be sorted by unique keys, key: " + std::to_string(key) +
+                                         " follows: " + std::to_string(*previousKey));
+            previousKey = key;
+            pending.emplace_back(key, value);
+            ++first;
+            ++recordsCount;
+        }
+        while (auto size = nextNodeSize(pending.size(), leafFill, TLeafNodeDegree, 2 * TLeafNodeDegree, inputEnded)) {
+            auto leaf = this->newNode<ALeafNode>(allocate(NodeType::LEAF));
+            leaf->setRecords(pending.begin(), pending.begin() + size);
+            pending.erase(pending.begin(), pending.begin() + size);
+            // next leaf (if there is any) is allocated right after this one
+            leaf->prevLeafOffset = prevLeafOffset;
+            leaf->nextLeafOffset = pending.empty() ? 0 : this->fileEnd;
+            leaf->highKey = *leaf->getLastKey();
+            prevLeafOffset = leaf->fileOffset;
+            level.emplace_back(*leaf->getLastKey(), leaf->fileOffset);
+            batch.push_back(std::move(leaf));
+            if (batch.size() == BulkLoadBatchSize) writeBatch();
+        }
+    }
+
+    auto const innerFill = fillOf(TInnerNodeDegree + 1, 2 * TInnerNodeDegree + 1);
+    while (level.size() > 1) {
+        std::vector<std::pair<TKey, NodeOffset>> upperLevel;
+        for (auto it = level.begin(); it != level.end();) {
+            auto size = nextNodeSize(level.end() - it, innerFill, TInnerNodeDegree + 1, 2 * TInnerNodeDegree + 1, true);
+            // keys separating descendants are greatest keys of all of them but the last one
+            std::pair<std::vector<TKey>, std::vector<NodeOffset>> entries;
+            for (size_t i = 0; i < size; ++i) {
+                if (i + 1 < size) entries.first.push_back(it[i].first);
+                entries.second.push_back(it[i].second);
+            }
+            auto node = this->newNode<AInnerNode>(allocate(NodeType::INNER));
+            node->setEntries(entries);
+            // like leaves, nodes of level are allocated one after another
+            it += size;
+            node->rightLink = it == level.end() || this->shadowPaging ? 0 : this->fileEnd;
+            node->highKey = it[-1].first;
+            upperLevel.emplace_back(node->highKey, node->fileOffset);
+            batch.push_back(std::move(node));
+            if (batch.size() == BulkLoadBatchSize) writeBatch();
+        }
+        level = std::move(upperLevel);
+    }
+    writeBatch();
+    if (level.empty()) return 0;
+
+    auto oldRoot = this->root;
+    this->setRoot(this->readNode(level.front().second));
+    // slot of old root of shadow file is released after new one is committed
+    this->updateConfigHeader();
+    this->freeNode(oldRoot);
+    this->commitOperation();
+    return recordsCount;
+}
+
+/**
+ * Finds offset of descendant which possibly contains given key
+ * @param node searched node
+ * @param key
+ * @return
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto
+BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::findProperDescendantOffset(std::shared_ptr<ANode> node,
+                                                                                       TKey const &key) -> NodeOffset {
+    auto innerNode = std::dynamic_pointer_cast<AInnerNode>(node);
+    auto offset = innerNode->getDescendantsOfKey(key).first;
+    return offset;
+}
+
+
+/**
+ * Returns ptr loaded Leaf probably containing given key. Operation latches nodes on the path in exclusive mode,
+ * latches of ancestors are released once node which won't be changed by change of its descendants is reached
+ * (node containing separator of leaf is kept by delete, as it changes when the last key of leaf is deleted).
+ * Shadow file keeps all of them
+ * @param key
+ * @param change change done by operation in found leaf
+ * @param upperBound if given, set to the greatest key which can be kept by found leaf (nullopt if there is no limit)
+ * @return ptr to leaf probably containing given key
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::findProperLeaf(TKey const &key, LeafChange change,
+                                                                                std::optional<TKey> *upperBound)
+-> std::shared_ptr<ALeafNode> {
+    std::shared_ptr<ANode> node = root;
+    std::optional<NodeOffset> separatorOwner;
+    auto releaseAncestors = [&] {
+        // ancestors of changed node of shadow file are copied as well
+        if (!this->operationActive || this->shadowPaging || !this->isNodeSafe(*node, change)) return;
+        if (change == LeafChange::DELETE && separatorOwner) this->releaseLatches({node->fileOffset, *separatorOwner});
+        else this->releaseLatches({node->fileOffset});
+    };
+    if (this->operationActive) this->latchNode(node->fileOffset);
+    this->saveVersion(node);
+    releaseAncestors();
+    while (node->nodeType() != NodeType::LEAF) {
+        auto[keysBegin, keysEnd] = std::dynamic_pointer_cast<AInnerNode>(node)->getKeysRange();
+        if (auto it = std::lower_bound(keysBegin, keysEnd, key); it != keysEnd) {
+            // key of parent following descendant bounds its subtree, bound found deeper is the tightest one
+            if (upperBound) *upperBound = *it;
+            separatorOwner = node->fileOffset;
+        }
+        auto descendantOffset = findProperDescendantOffset(node, key);
+        auto nextNode = readNode(descendantOffset);
+        // readers share nodes with operation, so only nodes used by operation get parent
+        if (this->operationActive) nextNode->parent = node.get();
+        node = nextNode;
+        releaseAncestors();
+    }
+    return std::dynamic_pointer_cast<ALeafNode>(node);
+}
+
 
-    // compensate node with newly created node
-    auto middleKey = node->compensateWithAndReturnMiddleKey(newNode, &key, &value, addedNodeOffset);
+/**
+ * Finds leaf which may contain given key for thread which doesn't change tree, nodes on the path aren't latched.
+ * Version of latch of every node is read before node and checked after its descendant's version is read, descent
+ * is restarted from root if any of them changed. Node whose keys beyond given one were moved to new node by split
+ * (see splitLeaf) is left for its right neighbour, like in B-link tree. Caller has to use EpochGuard while it uses
+ * found leaf.
+ * Latches are used as seqlocks: keys and counts are read with plain loads while latching writer may move them, such
+ * torn reads are intended (they are never used unless version is still valid) and reported by ThreadSanitizer,
+ * tsan.supp suppresses them
+ * @param key
+ * @param after if set, leaf with keys greater than given one is found (e.g. the next one after separator)
+ * @param upperBound if given, set to separator bounding keys of found leaf (nullopt for the last leaf)
+ * @param path if given, filled with inner nodes which descent went down from, from root to parent of leaf
+ * @return leaf and version of its latch, its data has to be validated before it is used
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::findLeafOptimistic(TKey const &key, bool after,
+                                                                                    std::optional<TKey> *upperBound,
+                                                                                    std::vector<OptimisticNode> *path)
+-> OptimisticNode {
+    while (true) {
+        auto rootNode = this->rootNode.load();
+        auto version = this->readVersion(rootNode->fileOffset);
+        // root is replaced while its latch is held, so it is the current one if it wasn't replaced meanwhile
+        if (rootNode != this->rootNode.load()) continue;
+        auto node = OptimisticNode{nullptr, rootNode, version};
+        std::optional<TKey> bound;
+        if (path) path->clear();
+        while (node.node) {
+            // links of shadow file aren't maintained
+            auto nextOffset = this->shadowPaging ? 0 : RightLinkFor(*node.node, key, after);
+            auto descending = nextOffset == 0 && node.node->nodeType() == NodeType::INNER;
+            if (nextOffset == 0 && !descending) {
+                // high key of leaf is separator bounding it, leaves of shadow file have no links
+                auto leafNode = static_cast<ALeafNode const *>(node.node);
+                if (!this->shadowPaging) bound = leafNode->nextLeafOffset != 0 ? std::optional(leafNode->highKey)
+                                                                              : std::nullopt;
+                if (upperBound) *upperBound = bound;
+                return node;
+            }
+            std::optional<TKey> separator;
+            if (descending) {
+                // node may be changed while it is read, so its counts are never trusted to be in range
+                auto innerNode = static_cast<AInnerNode const *>(node.node);
+                auto keysCount = std::min<size_t>(innerNode->keysCount, 2 * TInnerNodeDegree);
+                auto index = after
+                             ? NodeSearch::UpperBound<2 * TInnerNodeDegree>(innerNode->keys.data(), keysCount, key)
+                             : NodeSearch::LowerBound<2 * TInnerNodeDegree>(innerNode->keys.data(), keysCount, key);
+                nextOffset = innerNode->descendants[index];
+                if (index < keysCount) separator = innerNode->keys[index];
+            }
+            if (!this->versionValid(node.node->fileOffset, node.version)) break;
+            auto nextVersion = this->readVersion(nextOffset);
+            if (!this->versionValid(node.node->fileOffset, node.version)) break;
+            if (descending) {
+                // separator found deeper is the tightest one
+                if (separator) bound = separator;
+                if (path) path->push_back(std::move(node));
+            }
+            node = this->readOptimisticNode(nextOffset, nextVersion);
+        }
+        std::this_thread::yield();
+    }
+}
 
-    // add info about this nodes to parent
-    auto newNodeOffset = newNode->fileOffset;
 
-    newNode = nullptr; // unload new node, it is needed no more
+/**
+ * @param node node read by descent, its data may be torn
+ * @param key searched key
+ * @param after if set, keys greater than given one are searched
+ * @return right link of node if searched keys were moved to its right neighbour by split (they are greater than
+ * high key of node), 0 otherwise
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::RightLinkFor(ANode const &node, TKey const &key,
+                                                                             bool after) -> NodeOffset {
+    auto isLeaf = node.nodeType() == NodeType::LEAF;
+    auto rightLink = isLeaf ? static_cast<ALeafNode const &>(node).nextLeafOffset
+                            : static_cast<AInnerNode const &>(node).rightLink;
+    if (rightLink == 0) return 0;
+    auto const &highKey = isLeaf ? static_cast<ALeafNode const &>(node).highKey
+                                 : static_cast<AInnerNode const &>(node).highKey;
+    return (after ? !(key < highKey) : highKey < key) ? rightLink : 0;
+}
 
-    // if parent not full -> simply add new key and ptr to new node
-    if (!node->parent->full()) {
-        std::dynamic_pointer_cast<AInnerNode>(node->parent)->add(middleKey, newNodeOffset);
-        return;
-    }
 
-    // else try compensate and add
-    bool compensationSucceeded = tryCompensateAndAdd(node->parent, &middleKey, &value, newNodeOffset);
-    if (compensationSucceeded) return;
+/**
+ * Waits until split which changed node is committed
+ * @param node
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::WaitForSplit(ANode const &node) -> void {
+    node.splitPending.wait(true);
+}
 
-    // else split parent
-    splitAndAddRecord(node->parent, middleKey, value, newNodeOffset);
+
+/**
+ * @param node node returned by readSnapshotNode
+ * @return true if data read from node meanwhile belongs to snapshot
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::snapshotNodeValid(OptimisticNode const &node) -> bool {
+    return node.version == SavedNodeVersion || this->versionValid(node.node->fileOffset, node.version);
 }
 
 
 /**
- * Merges given node with neighbour and updates ancestors recursively
- * @param node node needed to be merged
- * @param key key from leaf which need to be replaced in ancestors
+ * @param timestamp timestamp of snapshot
+ * @return offset of root of tree when snapshot was taken
  */
 template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
-auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::merge(std::shared_ptr<BPlusTree::ANode> node,
-                                                                       TKey const *const key) -> void {
-    // get neighbour to merge with
-    // this key we will need to replace with new greatest key in ancestors
-    TKey oldKey;
-    if (node->nodeType() == NodeType::LEAF) {
-        oldKey = *std::dynamic_pointer_cast<ALeafNode>(node)->getLastKey();
-    }
-    auto[left, right] = this->getNodeNeighbours(node);
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::snapshotRootOffset(uint64_t timestamp) -> NodeOffset {
+    std::lock_guard lock(this->versionsMutex);
+    auto version = std::find_if(this->rootVersions.begin(), this->rootVersions.end(),
+                                [timestamp](auto const &v) { return timestamp < v.endTimestamp; });
+    return version != this->rootVersions.end() ? version->rootOffset : this->rootNode.load()->fileOffset;
+}
 
-    if (left) {
-        right = nullptr;
-        // get max key of left descendant
-        auto key = std::dynamic_pointer_cast<AInnerNode>(left->parent)->getKeyBetweenPtrs(left->fileOffset,
-                                                                                          node->fileOffset);
-        left->mergeWith(node, &key);
-        node = left;
-        left = nullptr;
-    } else if (right) {
-        left = nullptr;
-        // max key is from argument
-        node->mergeWith(right, key);
-        right = nullptr;
-    } else {
-        throw std::runtime_error("Internal error: merge: no selectedNeighbour");
-    }
 
-    // update parent key with new last key
-    TKey lastKey;
-    if (node->nodeType() == NodeType::LEAF) {
-        auto leafNode = std::dynamic_pointer_cast<ALeafNode>(node);
-        lastKey = *leafNode->getLastKey();
-        std::shared_ptr<AInnerNode> parent = std::dynamic_pointer_cast<AInnerNode>(node->parent);
-        while (parent != nullptr) {
-            if (parent->contains(oldKey)) {
-                parent->swapKeys(oldKey, lastKey);
+/**
+ * Finds leaf which may contain given key in snapshot. Every node on the path is the one seen by snapshot, so only
+ * node which was changed while it was read has to be read again. Caller has to use EpochGuard while it uses leaf
+ * @param key
+ * @param timestamp timestamp of snapshot
+ * @param after if set, leaf with keys greater than given one is found
+ * @param upperBound if given, set to separator bounding keys of found leaf (nullopt for the last leaf)
+ * @return leaf of snapshot, its data has to be validated with snapshotNodeValid
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::findLeafInSnapshot(TKey const &key,
+                                                                                    uint64_t timestamp, bool after,
+                                                                                    std::optional<TKey> *upperBound)
+-> OptimisticNode {
+    auto node = this->readSnapshotNode(this->snapshotRootOffset(timestamp), timestamp);
+    std::optional<TKey> bound;
+    while (true) {
+        auto descendantOffset = node.node->fileOffset;
+        // type of current node is trusted only if node is valid, its slot could be reused meanwhile
+        if (node.node->nodeType() == NodeType::LEAF) {
+            if (this->snapshotNodeValid(node)) {
+                if (upperBound) *upperBound = bound;
+                return node;
+            }
+        } else {
+            auto innerNode = static_cast<AInnerNode const *>(node.node);
+            auto keysCount = std::min<size_t>(innerNode->keysCount, 2 * TInnerNodeDegree);
+            auto index = after ? NodeSearch::UpperBound<2 * TInnerNodeDegree>(innerNode->keys.data(), keysCount, key)
+                               : NodeSearch::LowerBound<2 * TInnerNodeDegree>(innerNode->keys.data(), keysCount, key);
+            auto nextOffset = innerNode->descendants[index];
+            auto separator = index < keysCount ? std::optional(innerNode->keys[index]) : std::nullopt;
+            if (this->snapshotNodeValid(node)) {
+                descendantOffset = nextOffset;
+                if (separator) bound = separator;
             }
-            parent = std::dynamic_pointer_cast<AInnerNode>(parent->parent);
         }
+        // node changed while it was read is read again
+        node = this->readSnapshotNode(descendantOffset, timestamp);
     }
+}
 
-    auto parent = std::dynamic_pointer_cast<AInnerNode>(node->parent);
 
-    // remove out-of-date descendant and key
-    auto nodeState = parent->removeKeyOffsetAfter(node->fileOffset);
+/**
+ * Takes snapshot of records, it sees all writes committed so far and none of those committed later
+ * @return snapshot which has to be destroyed before tree
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::snapshot() -> Snapshot {
+    return Snapshot(this);
+}
 
-    // parent node is valid
-    if (nodeState == NodeState::OK)
-        return;
 
-    // if parent is root
-    if (parent == root) {
-        // if root contains 0 items -> remove and make new root from descendant
-        if (parent->getEntries().first.empty()) {
-            root->markEmpty();
-            root = node;
-        } // else do nothing
-        return;
-    }
+/**
+ * Changes records of single leaf without latching its ancestors: leaf is found by optimistic descent and latched
+ * if it wasn't changed since it was read. Such changes are done concurrently by many threads (also while operation
+ * changes structure of tree or leaves are split), changed leaf is committed together with changes of other threads
+ * (see commitChanges) while it is latched. Version of leaf is saved and committed with it if snapshots need it
+ * @param key
+ * @param change change done in leaf, leaf has to stay safe after it
+ * @param changeLeaf called with latched leaf
+ * @return false if change could propagate to ancestors of leaf, leaf isn't changed then
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+template<typename TChange>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::tryChangeLeaf(TKey const &key, LeafChange change,
+                                                                               TChange &&changeLeaf) -> bool {
+    // leaf of shadow file is never changed in place, it is copied by operation
+    if (this->shadowPaging) return false;
+    VersionedWrite write(this);
+    EpochGuard guard(this);
+    while (true) {
+        auto leaf = this->findLeafOptimistic(key);
+        auto leafNode = static_cast<ALeafNode *>(leaf.node);
+        auto &latch = this->latches[LatchIndex(leafNode->fileOffset)];
+        std::unique_lock leafLock(latch.mutex);
+        if (latch.version.load() != leaf.version) continue;
+        // leaf changed by split which isn't committed yet is written by the split
+        if (leafNode->splitPending.load()) {
+            leafLock.unlock();
+            WaitForSplit(*leafNode);
+            continue;
+        }
 
-    // parent node is too small
-    if (nodeState & NodeState::TOO_SMALL) {
-        // try compensate with neighbour
-        bool compensationSuccess = tryCompensateAndAdd(parent);
-        if (!compensationSuccess) {
-            merge(parent, &lastKey);
+        // deleting the greatest key of leaf changes separator kept by its ancestor
+        auto lastKey = leafNode->getLastKey();
+        if (!this->isNodeSafe(*leafNode, change) ||
+            (change == LeafChange::DELETE && leafNode != this->rootNode.load() && lastKey && *lastKey == key))
+            return false;
+        if (write.versioned) this->addVersion(*leafNode);
+        latch.version.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_release);
+        try {
+            changeLeaf(*leafNode);
+        } catch (...) {
+            if (write.versioned) this->commitVersions({leafNode->fileOffset}, false);
+            latch.version.fetch_add(1);
+            throw;
         }
+        if (write.versioned) this->commitVersions({leafNode->fileOffset}, false);
+        latch.version.fetch_add(1);
+        if (!leafNode->isChanged()) return true;
+        // changed leaf is committed at once, so nodes are never left changed outside of operations. Leaf which is
+        // root can't be replaced while it is latched
+        auto owner = leaf.owner;
+        if (!owner) {
+            std::lock_guard lock(this->nodesMutex);
+            owner = this->root;
+        }
+        this->commitChanges({&owner, 1}, false);
+        // without buffer pool readers read leaf from file, those which did it before it was written read it again
+        if (!this->bufferPool.enabled()) latch.version.fetch_add(2);
+        return true;
     }
-
-
 }
 
 
 /**
- * Returns pair of ptrs to left and right neighbour
- * @param node node which neighbours are looked for
- * @return pair of ptrs to loaded neighbour nodes, nullptr if no such node
+ * Inserts record into full leaf without operation by split of B-link tree (Lehman and Yao): upper half of leaf is
+ * moved to new leaf linked after it, which takes over its high key, then separator of new leaf is added to parent
+ * (full parent is split the same way, up to new root). Threads which found node before it was split reach moved
+ * entries by its right link, so nobody restarts because of split. Only one node is latched at a time (and the next
+ * leaf together with split one), so leaves are split concurrently with each other and with changes of single leaves,
+ * only operations wait for splits. Nodes changed by split are fenced until they are committed: writers wait for
+ * them, readers don't. Unlike operation, split doesn't compensate leaf with its neighbours
+ * @param key
+ * @param value
+ * @return status of insert, nullopt if tree can't be split this way (nodes of shadow file aren't linked, new nodes
+ * have to be found in buffer pool by other threads)
  */
 template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
-auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::getNodeNeighbours(std::shared_ptr<ANode> node)
--> std::pair<std::shared_ptr<ANode>, std::shared_ptr<ANode>> {
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::splitLeaf(TKey const &key, TValue const &value)
+-> std::optional<InsertStatus> {
+    if (this->shadowPaging || !this->bufferPool.enabled()) return std::nullopt;
+    std::shared_lock structureLock(this->structureMutex);
+    VersionedWrite write(this);
+    EpochGuard guard(this);
+    std::vector<OptimisticNode> path;
+    std::vector<std::shared_ptr<ANode>> fenced; // changed nodes, they are kept in pool until they are committed
+    OffsetsSet versioned;
+    auto rootChanged = false;
+    auto keepVersion = [&](ANode &node) {
+        if (write.versioned && versioned.insert(node.fileOffset).second) this->addVersion(node);
+    };
+    auto fence = [&fenced](std::shared_ptr<ANode> const &node) {
+        node->markChanged();
+        node->splitPending.store(true);
+        fenced.push_back(node);
+    };
+    auto releaseFences = [&] {
+        if (write.versioned) this->commitVersions(versioned, rootChanged);
+        for (auto const &node : fenced) {
+            node->splitPending.store(false);
+            node->splitPending.notify_all();
+        }
+    };
 
-    auto result = std::make_pair<std::shared_ptr<ANode>, std::shared_ptr<ANode>>(nullptr, nullptr);
-    if (node->parent == nullptr) return result;
-    auto parent = std::dynamic_pointer_cast<AInnerNode>(node->parent);
+    try {
+        // child is node split on current level, separator of added node goes to its parent
+        std::shared_ptr<ANode> child;
+        TKey separator{};
+        NodeOffset addedOffset = 0;
+        while (true) {
+            auto leaf = this->findLeafOptimistic(key, false, nullptr, &path);
+            auto leafNode = static_cast<ALeafNode *>(leaf.node);
+            auto &latch = this->latches[LatchIndex(leafNode->fileOffset)];
+            std::unique_lock leafLock(latch.mutex);
+            if (latch.version.load() != leaf.version) continue;
+            if (leafNode->splitPending.load()) {
+                leafLock.unlock();
+                WaitForSplit(*leafNode);
+                continue;
+            }
+            if (leafNode->contains(key)) return InsertStatus::DUPLICATE;
+            // leaf which is root can't be replaced while it is latched
+            auto owner = leaf.owner;
+            if (!owner) {
+                std::lock_guard lock(this->nodesMutex);
+                owner = this->root;
+            }
+            if (!leafNode->full()) {
+                // record was deleted since leaf was found full
+                keepVersion(*leafNode);
+                latch.version.fetch_add(1);
+                std::atomic_thread_fence(std::memory_order_release);
+                leafNode->insert(key, value);
+                fence(owner);
+                latch.version.fetch_add(1);
+                break;
+            }
 
-    auto lOffset = parent->getPrevDescendantOffset(node->fileOffset);
-    auto rOffset = parent->getNextDescendantOffset(node->fileOffset);
+            // latches of leaves are taken from left to right, but their stripes are shared with other nodes, so the
+            // next leaf is only tried
+            auto nextOffset = leafNode->nextLeafOffset;
+            auto &nextLatch = this->latches[LatchIndex(nextOffset)];
+            std::unique_lock nextLock(nextLatch.mutex, std::defer_lock);
+            if (nextOffset != 0 && &nextLatch != &latch && !nextLock.try_lock()) {
+                leafLock.unlock();
+                std::this_thread::yield();
+                continue;
+            }
+            auto next = nextOffset != 0 ? this->readNode(nextOffset) : nullptr;
+            if (next && next->splitPending.load()) {
+                leafLock.unlock();
+                if (nextLock.owns_lock()) nextLock.unlock();
+                WaitForSplit(*next);
+                continue;
+            }
+            auto newLeaf = this->createNode(NodeType::LEAF);
+            keepVersion(*leafNode);
+            if (next) keepVersion(*next);
+            latch.version.fetch_add(1);
+            if (nextLock.owns_lock()) nextLatch.version.fetch_add(1);
+            std::atomic_thread_fence(std::memory_order_release);
+            this->linkLeafAfter(owner, newLeaf);
+            separator = leafNode->compensateWithAndReturnMiddleKey(newLeaf, &key, &value, 0);
+            leafNode->highKey = separator;
+            fence(owner);
+            fence(newLeaf);
+            if (next) fence(next);
+            if (nextLock.owns_lock()) nextLatch.version.fetch_add(1);
+            latch.version.fetch_add(1);
+            child = owner;
+            addedOffset = newLeaf->fileOffset;
+            break;
+        }
 
-    // left neighbour found
-    if (lOffset) {
-        result.first = BPlusTree::readNode(*lOffset);
-        result.first->parent = node->parent;
-    }
+        // parent of child is found by right links from node which descent went down from
+        for (size_t height = 0; child;) {
+            if (path.size() <= height) {
+                // split node was root when descent started
+                auto &latch = this->latches[LatchIndex(child->fileOffset)];
+                std::unique_lock lock(latch.mutex);
+                if (this->rootNode.load() != child.get()) {
+                    // root above it was added by its previous split meanwhile
+                    lock.unlock();
+                    this->findLeafOptimistic(separator, false, nullptr, &path);
+                    continue;
+                }
+                auto newRoot = std::static_pointer_cast<AInnerNode>(this->createNode(NodeType::INNER));
+                newRoot->setEntries({{separator}, {child->fileOffset, addedOffset}});
+                newRoot->loaded = true;
+                fence(newRoot);
+                // offset of old root is saved before readers can see new one
+                if (write.versioned) {
+                    std::lock_guard versionsLock(this->versionsMutex);
+                    this->rootVersions.push_back({PendingTimestamp, child->fileOffset});
+                }
+                latch.version.fetch_add(1);
+                this->setRoot(newRoot);
+                latch.version.fetch_add(1);
+                rootChanged = true;
+                break;
+            }
 
-    // right neighbour found
-    if (rOffset) {
-        result.second = BPlusTree::readNode(*rOffset);
-        result.second->parent = node->parent;
-    }
+            auto parent = this->readNode(path[path.size() - 1 - height].node->fileOffset);
+            std::unique_lock<std::mutex> parentLock;
+            while (true) {
+                parentLock = std::unique_lock(this->latches[LatchIndex(parent->fileOffset)].mutex);
+                if (parent->splitPending.load()) {
+                    parentLock.unlock();
+                    WaitForSplit(*parent);
+                    continue;
+                }
+                auto rightLink = RightLinkFor(*parent, separator, false);
+                if (rightLink == 0) break;
+                parentLock.unlock();
+                parent = this->readNode(rightLink);
+            }
+            auto &parentLatch = this->latches[LatchIndex(parent->fileOffset)];
+            auto parentNode = std::static_pointer_cast<AInnerNode>(parent);
+            auto newNode = parentNode->full() ? std::static_pointer_cast<AInnerNode>(this->createNode(NodeType::INNER))
+                                              : nullptr;
+            keepVersion(*parentNode);
+            parentLatch.version.fetch_add(1);
+            std::atomic_thread_fence(std::memory_order_release);
+            if (newNode) {
+                this->linkInnerAfter(*parentNode, *newNode);
+                auto middleKey = parentNode->compensateWithAndReturnMiddleKey(newNode, &separator, nullptr,
+                                                                              addedOffset);
+                parentNode->highKey = middleKey;
+                separator = middleKey;
+                addedOffset = newNode->fileOffset;
+                fence(newNode);
+            } else {
+                parentNode->add(separator, addedOffset);
+            }
+            fence(parent);
+            parentLatch.version.fetch_add(1);
+            child = newNode ? parent : nullptr;
+            ++height;
+        }
 
-    return result;
+        // new slots change headers as well
+        this->commitChanges(fenced, addedOffset != 0);
+    } catch (...) {
+        releaseFences();
+        throw;
+    }
+    releaseFences();
+    return InsertStatus::INSERTED;
 }
 
 
 /**
- * Updates config header in db file
- * @return
+ * Calls consumer for records with keys from lowKey to highKey (both inclusive) in order by key, can be called by
+ * many threads while tree is changed. Records of leaf are copied and delivered after leaf is validated, if it
+ * changed meanwhile scan is continued by descent from root to the last delivered key. Next leaf of shadow file is
+ * found by descent to separator following current one
+ * @param lowKey
+ * @param highKey
+ * @param consumer called with key and value of record, returns false to stop scan
  */
 template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
-auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::updateConfigHeader() -> void {
-    configHeader.rootOffset = this->root->fileOffset;
-    configHeader.innerNodeDegree = TInnerNodeDegree;
-    configHeader.leafNodeDegree = TLeafNodeDegree;
-    this->file.write(0, configHeader);
+template<typename TConsumer>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::scanRange(TKey const &lowKey, TKey const &highKey,
+                                                                           TConsumer &&consumer) -> void {
+    if (highKey < lowKey) return;
+    EpochGuard guard(this);
+    std::optional<TKey> bound; // separator following current leaf, leaves of shadow file are found by it
+    auto leaf = this->findLeafOptimistic(lowKey, false, &bound);
+    std::optional<TKey> lastKey;
+    std::vector<std::pair<TKey, TValue>> records;
+    while (true) {
+        auto leafNode = static_cast<ALeafNode const *>(leaf.node);
+        auto count = std::min<size_t>(leafNode->count, 2 * TLeafNodeDegree);
+        auto index = lastKey ? NodeSearch::UpperBound<2 * TLeafNodeDegree>(leafNode->keys.data(), count, *lastKey)
+                             : NodeSearch::LowerBound<2 * TLeafNodeDegree>(leafNode->keys.data(), count, lowKey);
+        auto finished = false;
+        records.clear();
+        for (; index < count && !finished; ++index) {
+            finished = highKey < leafNode->keys[index];
+            if (!finished) records.emplace_back(leafNode->keys[index], leafNode->getValue(index));
+        }
+        auto nextOffset = this->shadowPaging ? 0 : leafNode->nextLeafOffset;
+        auto nextVersion = nextOffset != 0 ? this->readVersion(nextOffset) : 0;
+        if (!this->versionValid(leafNode->fileOffset, leaf.version)) {
+            leaf = this->findLeafOptimistic(lastKey ? *lastKey : lowKey, false, &bound);
+            continue;
+        }
+        for (auto const &[key, value] : records) {
+            if (!consumer(key, value)) return;
+            lastKey = key;
+        }
+        if (finished) return;
+        if (this->shadowPaging) {
+            if (!bound) return;
+            auto separator = *bound;
+            leaf = this->findLeafOptimistic(separator, true, &bound);
+            continue;
+        }
+        if (nextOffset == 0) return;
+        leaf = this->readOptimisticNode(nextOffset, nextVersion);
+        if (!leaf.node || leaf.node->nodeType() != NodeType::LEAF)
+            leaf = this->findLeafOptimistic(lastKey ? *lastKey : lowKey, false, &bound);
+    }
 }
 
 
 /**
- * Creates new records with given key and value
+ * Returns iterator pointing to first record which key is not less (or greater if skipEqual is set) than given one,
+ * leaf which may contain it is found by descent from root
  * @param key
- * @param value
+ * @param skipEqual
+ * @return found position or end() if there is no such record
  */
 template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
-auto
-BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::createRecord(TKey const &key, TValue const &value) -> void {
-    // find leaf to insert record into
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::seek(TKey const &key, bool skipEqual)
+-> ForwardIterator {
     auto leafNode = this->findProperLeaf(key);
-
-    // if key exists then Exit
-    if (leafNode->contains(key)) {
-        std::cout << "Given key already exists. Record not added.\n";
-        return;
+    auto index = skipEqual ? NodeSearch::UpperBound<2 * TLeafNodeDegree>(leafNode->keys.data(), leafNode->count, key)
+                           : NodeSearch::LowerBound<2 * TLeafNodeDegree>(leafNode->keys.data(), leafNode->count, key);
+    auto result = ForwardIterator(leafNode, this, IteratorT::BEGIN);
+    if (index < leafNode->fillKeysSize()) {
+        result.i = index;
+    } else if (index > 0) {
+        // all keys of leaf are lower, searched record is the first one of next leaf
+        result.i = index - 1;
+        ++result;
     }
-
-    // if node not full -> insert record
-    if (!leafNode->full()) {
-        leafNode->insert(key, value);
-        return;
-    }
-
-    // else try compensate node and add record
-    bool compensationSucceeded = tryCompensateAndAdd(leafNode, &key, &value);
-    if (compensationSucceeded) return;
-
-    // else split node and add record
-    splitAndAddRecord(leafNode, key, value);
+    return result;
 }
 
 
 /**
- * Reads and returns record with given key
- * @param key
- * @return optional record, nullopt if doesn't exist
+ * Returns records with keys from lowKey to highKey (both inclusive)
+ * @param lowKey
+ * @param highKey
+ * @return range of records, empty if lowKey is greater than highKey
  */
 template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
-auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::readRecord(TKey const &key) -> std::optional<TValue> {
-    return findProperLeaf(key)->readRecord(key);
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::range(TKey const &lowKey, TKey const &highKey)
+-> Range {
+    auto last = this->upperBound(highKey);
+    if (highKey < lowKey) return Range(last, last);
+    return Range(this->lowerBound(lowKey), last);
 }
 
 
 /**
- * Updates record with given key, throws if key not found
- * @param key key of record to update
- * @param value data to update to
+ * Splits tree into subtrees which can be scanned independently, they are taken from the highest level of tree
+ * which has at least minCount nodes (or from leaves level if tree is smaller)
+ * @param minCount
+ * @return offsets of roots of subtrees in order by keys
  */
 template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
-auto
-BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::updateRecord(TKey const &key, TValue const &value) -> void {
-    this->findProperLeaf(key)->updateRecord(key, value);
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::scanPartitions(size_t minCount)
+-> std::vector<NodeOffset> {
+    std::vector<NodeOffset> partitions{this->root->fileOffset};
+    std::vector<std::shared_ptr<ANode>> level{this->root};
+    while (partitions.size() < minCount && level.front()->nodeType() == NodeType::INNER) {
+        partitions.clear();
+        for (auto const &node : level) {
+            auto descendants = std::dynamic_pointer_cast<AInnerNode>(node)->getEntries().second;
+            partitions.insert(partitions.end(), descendants.begin(), descendants.end());
+        }
+        if (partitions.size() >= minCount) break;
+        this->readNodes(partitions, level);
+    }
+    return partitions;
 }
 
 
 /**
- * Deletes record with given key, does nothing if key doesn't exist
- * @param key key of record to delete
+ * Writes changed nodes to db file so they can be read by scan workers with their own descriptors of it
+ * @param count number of workers
+ * @return created workers
  */
 template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
-auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::deleteRecord(TKey const &key) -> void {
-    // find ndoe possibly containing record
-    auto node = this->findProperLeaf(key);
-    if (!node->contains(key)) {
-        throw std::runtime_error("Key " + std::to_string(key) + " doesn't exist");
-    }
-
-    // remove
-    auto nodeState = node->deleteRecord(key);
-    // if root -> no need to do anything
-    if (node == root) return;
-    // node is ok after deletion
-    if (nodeState == OK)
-        return;
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::makeScanWorkers(size_t count)
+-> std::vector<std::unique_ptr<ScanWorker>> {
+    if (this->root->isChanged() || !this->bufferPool.changedNodes().empty()) this->unload();
+    this->file.checkpoint();
+    std::vector<std::unique_ptr<ScanWorker>> workers;
+    for (size_t i = 0; i < std::max(count, size_t{1}); ++i)
+        workers.push_back(std::make_unique<ScanWorker>(this->filePath));
+    return workers;
+}
 
-    // if deleted last key get new last key and put it in the ancestor instead of old one (if exists)
-    if (nodeState & NodeState::DELETED_LAST) {
-        auto lastKey = node->getLastKey();
-        if (!lastKey)
-            throw std::runtime_error("Internal error: Unable to determine new greatest key in node: " +
-                                     std::to_string(node->fileOffset));
-        auto parent = std::dynamic_pointer_cast<AInnerNode>(node->parent);
-        while (parent != nullptr) {
-            if (parent->contains(key)) {
-                parent->swapKeys(key, *lastKey);
-            }
-            parent = std::dynamic_pointer_cast<AInnerNode>(parent->parent);
-        }
-    }
 
-    if (nodeState & NodeState::TOO_SMALL) {
-        // try compensate with neighbour
-        bool compensationSuccess = tryCompensateAndAdd(node);
-        if (!compensationSuccess) {
-            merge(node);
-        }
+/**
+ * Adds disk reads done by scan workers to counters of tree
+ * @param workers
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::finishScan(
+        std::vector<std::unique_ptr<ScanWorker>> const &workers) -> void {
+    if (!countersEnabled) return;
+    for (auto const &worker : workers) {
+        sessionDiskReadsCount += worker->readsCount;
+        currentOperationDiskReadsCount += worker->readsCount;
     }
 }
 
+
 /**
- * Finds offset of descendant which possibly contains given key
- * @param node searched node
- * @param key
- * @return
+ * Scans all records with given number of threads, each of them takes subtrees one by one and reads them with its
+ * own descriptor of db file. Records are not in order, consumer is called concurrently (with index of calling
+ * thread, so it can aggregate them without locking)
+ * @param threadsCount
+ * @param consumer
  */
 template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
-auto
-BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::findProperDescendantOffset(std::shared_ptr<ANode> node,
-                                                                                       TKey const &key) -> NodeOffset {
-    auto innerNode = std::dynamic_pointer_cast<AInnerNode>(node);
-    auto offset = innerNode->getDescendantsOfKey(key).first;
-    return offset;
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::parallelScan(size_t threadsCount,
+                                                                             WorkerRecordConsumer const &consumer)
+-> void {
+    if (this->empty()) return;
+    auto workers = this->makeScanWorkers(threadsCount);
+    auto partitions = this->scanPartitions(workers.size() * ScanPartitionsPerThread);
+    std::atomic<size_t> nextPartition = 0;
+    std::mutex errorMutex;
+    std::exception_ptr error;
+    auto work = [&](size_t worker) {
+        try {
+            for (size_t partition; (partition = nextPartition++) < partitions.size();) {
+                workers[worker]->scan({partitions[partition]}, [&](TKey const &key, TValue const &value) {
+                    consumer(worker, key, value);
+                });
+            }
+        } catch (...) {
+            std::lock_guard lock(errorMutex);
+            if (!error) error = std::current_exception();
+            nextPartition = partitions.size();
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < workers.size(); ++i) threads.emplace_back(work, i);
+    work(0);
+    for (auto &thread : threads) thread.join();
+    this->finishScan(workers);
+    if (error) std::rethrow_exception(error);
 }
 
 
 /**
- * Returns ptr loaded Leaf probably containing given key
- * @param key
- * @return ptr to leaf probably containing given key
+ * Calls consumer for every record in order by key, subtrees are read by given number of threads ahead of consumer
+ * (see parallelScan) and their records are passed to it in order
+ * @param threadsCount
+ * @param consumer called by calling thread only
  */
 template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
-auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::findProperLeaf(TKey const &key)
--> std::shared_ptr<ALeafNode> {
-    std::shared_ptr<ANode> node = root;
-    while (node->nodeType() != NodeType::LEAF) {
-        auto descendantOffset = findProperDescendantOffset(node, key);
-        auto nextNode = readNode(descendantOffset);
-        nextNode->parent = node;
-        node = nextNode;
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::forEachRecordParallel(size_t threadsCount,
+                                                                                      RecordConsumer const &consumer)
+-> void {
+    if (this->empty()) return;
+    using Records = std::vector<std::pair<TKey, TValue>>;
+    auto workers = this->makeScanWorkers(threadsCount);
+    auto partitions = this->scanPartitions(workers.size() * ScanPartitionsPerThread);
+    auto const window = 2 * workers.size(); // max number of subtrees read ahead of consumer
+    std::vector<std::optional<Records>> results(partitions.size());
+    std::mutex mutex;
+    std::condition_variable condition;
+    size_t nextPartition = 0, consumedCount = 0;
+    bool stopped = false;
+    std::exception_ptr error;
+    auto stop = [&] {
+        {
+            std::lock_guard lock(mutex);
+            if (!error) error = std::current_exception();
+            stopped = true;
+        }
+        condition.notify_all();
+    };
+    auto work = [&](size_t worker) {
+        try {
+            while (true) {
+                size_t partition;
+                {
+                    std::unique_lock lock(mutex);
+                    condition.wait(lock, [&] {
+                        return stopped || nextPartition == partitions.size() ||
+                               nextPartition < consumedCount + window;
+                    });
+                    if (stopped || nextPartition == partitions.size()) return;
+                    partition = nextPartition++;
+                }
+                Records records;
+                workers[worker]->scan({partitions[partition]}, [&records](TKey const &key, TValue const &value) {
+                    records.emplace_back(key, value);
+                });
+                {
+                    std::lock_guard lock(mutex);
+                    results[partition] = std::move(records);
+                }
+                condition.notify_all();
+            }
+        } catch (...) {
+            stop();
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < workers.size(); ++i) threads.emplace_back(work, i);
+    try {
+        for (size_t partition = 0; partition < partitions.size(); ++partition) {
+            Records records;
+            {
+                std::unique_lock lock(mutex);
+                condition.wait(lock, [&] { return stopped || results[partition]; });
+                if (stopped) break;
+                records = std::move(*results[partition]);
+                results[partition].reset();
+                ++consumedCount;
+            }
+            condition.notify_all();
+            for (auto const &[key, value] : records) consumer(key, value);
+        }
+    } catch (...) {
+        stop();
     }
-    return std::dynamic_pointer_cast<ALeafNode>(node);
+    for (auto &thread : threads) thread.join();
+    this->finishScan(workers);
+    if (error) std::rethrow_exception(error);
 }
 
+
 /**
  * Get name of tree
  * @return string with name
@@ -906,6 +3978,17 @@ void BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::incrementWriteO
 }
 
 
+/**
+ * Callback for File class, counts logical writes (nodes and headers) which are merged into physical ones
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+void BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::incrementNodeWritesCounters(size_t count) {
+    if (!countersEnabled) return;
+    sessionNodeWritesCount += count;
+    currentOperationNodeWritesCount += count;
+}
+
+
 /**
  * Callback for File class
  */
@@ -918,14 +4001,20 @@ void BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::incrementReadOp
 
 
 /**
- * Resets disk IO counters and max nodes in memory counter
+ * Resets disk IO counters, buffer pool counters and max nodes in memory counter
  */
 template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
 auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::resetCounters() -> void {
     sessionDiskReadsCount
             = sessionDiskWritesCount
             = currentOperationDiskReadsCount
-            = currentOperationDiskWritesCount = 0;
+            = currentOperationDiskWritesCount
+            = sessionNodeWritesCount
+            = currentOperationNodeWritesCount
+            = sessionChecksumFailuresCount = 0;
+    sessionCacheHitsStart = operationCacheHitsStart = bufferPool.getHitsCount();
+    sessionCacheMissesStart = operationCacheMissesStart = bufferPool.getMissesCount();
+    readaheadStats = {};
     ANode::ResetCounters();
 }
 
@@ -1023,34 +4112,60 @@ template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNo
 auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::printFile() -> void {
     this->unload();
     auto offset = 0u;
-    auto configHeader = file.read<ConfigHeader>(offset);
-    std::cout << "0:\tConfigHeader {rootOffset: " << configHeader.rootOffset
-              << ", innerNodeDegree: " << configHeader.innerNodeDegree
-              << ", leafNodeDegree: " << configHeader.leafNodeDegree
-              << "}";
-    offset += sizeof(ConfigHeader);
-    while (true) {
+    if (this->shadowPaging) {
+        for (auto sequence : {0u, 1u}) {
+            offset = SuperblockOffset(this->format, sequence);
+            auto superblock = ReadSuperblock(this->file, offset);
+            std::cout << (sequence == 0 ? "" : "\n") << offset << ":\tSuperblock ";
+            if (!superblock) {
+                std::cout << "{invalid}";
+                continue;
+            }
+            std::cout << "{sequence: " << superblock->sequence
+                      << ", rootOffset: " << superblock->configHeader.rootOffset
+                      << ", innerNodeDegree: " << superblock->configHeader.innerNodeDegree
+                      << ", leafNodeDegree: " << superblock->configHeader.leafNodeDegree
+                      << ", fileEnd: " << superblock->fileEnd
+                      << (this->format == FileFormat::PAGED ? ", paged" : "") << "}";
+        }
+    } else {
+        auto configHeader = file.read<ConfigHeader>(offset);
+        std::cout << "0:\tConfigHeader {rootOffset: " << configHeader.rootOffset
+                  << ", innerNodeDegree: " << configHeader.innerNodeDegree
+                  << ", leafNodeDegree: " << configHeader.leafNodeDegree
+                  << "}";
+        offset += sizeof(ConfigHeader);
+        auto freeSpaceHeader = file.read<FreeSpaceHeader>(offset);
+        std::cout << "\n" << offset << ":\tFreeSpaceHeader {leafNodesHead: " << freeSpaceHeader.leafNodesHead
+                  << ", innerNodesHead: " << freeSpaceHeader.innerNodesHead
+                  << (this->format == FileFormat::PAGED ? ", paged" : "") << "}";
+    }
+    // free slots of shadow file keep nodes which aren't used anymore
+    std::set<NodeOffset> freeSlots(this->freeLeafSlots.begin(), this->freeLeafSlots.end());
+    freeSlots.insert(this->freeInnerSlots.begin(), this->freeInnerSlots.end());
+    offset = this->firstNodeOffset();
+    while (!this->shadowPaging || offset < this->fileEnd) {
         std::cout << "\n";
         auto nodeHeader = file.read<char>(offset);
         if (file.eof()) break;
         // if found space is empty and big enough
         std::cout << offset << ":\theader, ";
-        if (std::bitset<8>(nodeHeader)[0] == true) {
+        if (freeSlots.contains(offset)) {
+            std::cout << (std::bitset<8>(nodeHeader)[1] == static_cast<int>(NodeType::LEAF) ? "LNode: " : "INode: ")
+                      << "free";
+        } else if (std::bitset<8>(nodeHeader)[0] == true) {
             if (std::bitset<8>(nodeHeader)[1] == static_cast<int>(NodeType::LEAF)) {
                 std::cout << "LNode: ";
             } else {
                 std::cout << "INode: ";
             }
-            std::cout << "empty ";
+            std::cout << "empty, next free: " << file.read<NodeOffset>(offset + 1);
 
         } else {
             readNode(offset)->print(std::cout);
         }
 
-        auto stepSize = (std::bitset<8>(nodeHeader)[1] == static_cast<int>(NodeType::LEAF))
-                        ? ALeafNode::BytesSize()
-                        : AInnerNode::BytesSize();
-        offset += stepSize + 1;
+        offset += nodeSlotSize(static_cast<NodeType>(static_cast<int>(std::bitset<8>(nodeHeader)[1])));
     }
     file.clear();
 }
@@ -1064,7 +4179,7 @@ auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::getHeight() ->
     auto node = root;
     uint64_t counter = 1;
     while (node->nodeType() != NodeType::LEAF) {
-        node = readNode(*std::dynamic_pointer_cast<AInnerNode>(node)->descendants[0]);
+        node = readNode(std::dynamic_pointer_cast<AInnerNode>(node)->descendants[0]);
         counter++;
     }
     return counter;
@@ -1099,9 +4214,8 @@ BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::getNodesCount(std::s
         return;
     }
     counters.first++;
-    auto &descendants = std::dynamic_pointer_cast<AInnerNode>(node)->descendants;
-    for (auto &descendant:descendants) {
-        if (!descendant) break;
+    auto[descendantsBegin, descendantsEnd] = std::dynamic_pointer_cast<AInnerNode>(node)->getDescendantsRange();
+    for (auto descendant = descendantsBegin; descendant != descendantsEnd; ++descendant) {
         this->getNodesCount(this->readNode(*descendant), counters);
     }
 }
@@ -1119,12 +4233,10 @@ BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::getFirstLeaf() {
     }
     while (node->nodeType() != NodeType::LEAF) {
         auto innerNode = std::dynamic_pointer_cast<AInnerNode>(node);
-        auto offset = innerNode->descendants[0];
-        if (!offset) {
+        if (innerNode->descendantsCount == 0) {
             throw std::runtime_error("Unable to find descendant");
         }
-        node = readNode(*offset);
-        node->parent = innerNode;
+        node = readNode(innerNode->descendants[0]);
     }
     return std::dynamic_pointer_cast<ALeafNode>(node);
 }
@@ -1144,20 +4256,64 @@ BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::getLastLeaf() {
         auto innerNode = std::dynamic_pointer_cast<AInnerNode>(node);
         auto offset = innerNode->getLastDescendantOffset();
         node = readNode(offset);
-        node->parent = innerNode;
     }
     return std::dynamic_pointer_cast<ALeafNode>(node);
 }
 
 
+/**
+ * Finds neighbour of leaf by its link. Leaves of shadow file aren't linked, so tree is descended to leaf instead:
+ * neighbour is the outermost leaf of the nearest subtree on the given side of the path
+ * @param leaf
+ * @param next whether the next or the previous leaf is returned
+ * @return offset of neighbouring leaf, 0 if there is no such leaf
+ */
+template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::adjacentLeafOffset(ALeafNode const &leaf, bool next)
+-> NodeOffset {
+    if (!this->shadowPaging) return next ? leaf.nextLeafOffset : leaf.prevLeafOffset;
+    // only root can be empty
+    if (leaf.fillKeysSize() == 0) return 0;
+    auto key = next ? leaf.getKey(leaf.fillKeysSize() - 1) : leaf.getKey(0);
+    std::shared_ptr<ANode> node = this->root;
+    NodeOffset subtreeOffset = 0;
+    while (node->nodeType() != NodeType::LEAF) {
+        auto innerNode = std::dynamic_pointer_cast<AInnerNode>(node);
+        auto[keysBegin, keysEnd] = innerNode->getKeysRange();
+        size_t index = std::lower_bound(keysBegin, keysEnd, key) - keysBegin;
+        if (next && index + 1 < innerNode->descendantsCount) subtreeOffset = innerNode->descendants[index + 1];
+        if (!next && index > 0) subtreeOffset = innerNode->descendants[index - 1];
+        node = this->readNode(innerNode->descendants[index]);
+    }
+    if (node->fileOffset != leaf.fileOffset)
+        throw std::runtime_error("Internal DB error: leaf not found by its key: " + std::to_string(leaf.fileOffset));
+    if (subtreeOffset == 0) return 0;
+    node = this->readNode(subtreeOffset);
+    while (node->nodeType() != NodeType::LEAF) {
+        auto innerNode = std::dynamic_pointer_cast<AInnerNode>(node);
+        node = this->readNode(next ? innerNode->descendants[0] : innerNode->getLastDescendantOffset());
+    }
+    return node->fileOffset;
+}
+
+
 /**
  * Counts and returns records number
  * @return count of records
  */
 template<typename TKey, typename TValue, size_t TInnerNodeDegree, size_t TLeafNodeDegree>
 auto BPlusTree<TKey, TValue, TInnerNodeDegree, TLeafNodeDegree>::getRecordsNumber() -> uint64_t {
+    if (this->scanThreads > 1) {
+        struct alignas(64) Counter { uint64_t value = 0; }; // every thread counts in its own cache line
+        std::vector<Counter> counters(this->scanThreads);
+        this->parallelScan(this->scanThreads, [&counters](size_t worker, TKey const &, TValue const &) {
+            ++counters[worker].value;
+        });
+        return std::accumulate(counters.begin(), counters.end(), uint64_t{0},
+                               [](uint64_t sum, Counter const &counter) { return sum + counter.value; });
+    }
     uint64_t i = 0;
-    for (auto const &_:*this)++i;
+    for ([[maybe_unused]] auto const &record : *this) ++i;
     return i;
 }
 
@@ -0,0 +1,328 @@
+#ifndef SBD2_BUFFER_POOL_HH
+#define SBD2_BUFFER_POOL_HH
+
+#include <cstddef>
+#include <memory>
+#include <list>
+#include <vector>
+#include <atomic>
+#include <bit>
+#include <shared_mutex>
+#include <unordered_map>
+#include "node.hh"
+#include "node_pool.hh"
+
+/**
+ * Cache of loaded nodes indexed by their file offsets, limited by total size of cached nodes in bytes.
+ * Frame is pinned as long as any pointer to its node is held outside of the pool (pinned frames are never evicted),
+ * so budget can be temporarily exceeded when operation holds more nodes than fits in it.
+ *
+ * Eviction policy is 2Q: nodes read for the first time go to probation FIFO (A1in), hits there don't change their
+ * position. Offsets of nodes evicted from probation are remembered in ghost list (A1out), node read again while its
+ * offset is still remembered goes to protected list (Am). Correlated references (e.g. all records of one leaf read
+ * in a row) stay in probation, only nodes referenced again after some time are promoted.
+ * Scans touch every leaf once, so they only circulate through probation and don't push hot inner nodes out.
+ * Protected list is a clock: hit only sets reference bit of frame, frame which has it set is moved to the front
+ * instead of being evicted (second chance).
+ *
+ * Offsets are spread over shards, every shard is such cache of its own part of capacity guarded by its own lock.
+ * Hits take the lock shared and don't change lists, so threads reading cached nodes don't block each other.
+ * Dirty nodes are written back when evicted (by node destructor) or when tree is unloaded.
+ * Entries of lists and maps are taken from pools, so replacing frames doesn't allocate memory from heap.
+ */
+template<typename TNode>
+class BufferPool final {
+    using NodePtr = std::shared_ptr<TNode>;
+    using OffsetsList = std::list<NodeOffset, PoolAllocator<NodeOffset>>;
+    enum class Segment { PROBATION, PROTECTED };
+
+    struct Frame {
+        Frame(NodePtr node, size_t size, Segment segment, typename OffsetsList::iterator position)
+                : node(std::move(node)), size(size), segment(segment), position(position) {}
+
+        NodePtr node;
+        size_t size;
+        Segment segment;
+        typename OffsetsList::iterator position;
+        mutable std::atomic<bool> referenced = false; // set by hits taking lock of shard shared
+    };
+
+    struct alignas(64) Shard {
+        mutable std::shared_mutex mutex;
+        size_t capacity = 0;
+        size_t size = 0;
+        size_t probationSize = 0;
+        std::unordered_map<NodeOffset, Frame, std::hash<NodeOffset>, std::equal_to<>,
+                           PoolAllocator<std::pair<NodeOffset const, Frame>>> frames;
+        OffsetsList probation;  // A1in, front is the newest
+        OffsetsList hot;        // Am, front is the most recently used or given second chance
+        OffsetsList ghosts;     // A1out, offsets recently evicted from probation
+        std::unordered_map<NodeOffset, typename OffsetsList::iterator, std::hash<NodeOffset>, std::equal_to<>,
+                           PoolAllocator<std::pair<NodeOffset const, typename OffsetsList::iterator>>> ghostsIndex;
+        std::atomic<uint64_t> hits = 0;
+        std::atomic<uint64_t> misses = 0;
+    };
+
+public:
+    static constexpr size_t MaxShardsCount = 16;
+    static constexpr size_t MinShardCapacity = 64u << 10u; // small pools are not split, so nodes fit in shards
+
+    explicit BufferPool(size_t capacity = 0);
+    BufferPool(BufferPool const &) = delete;
+    BufferPool &operator=(BufferPool const &) = delete;
+
+    auto get(NodeOffset offset, bool counted = true) -> NodePtr;
+    auto put(NodeOffset offset, NodePtr node, size_t size) -> void;
+    auto erase(NodeOffset offset) -> void;
+    auto changedNodes() const -> std::vector<NodePtr>;
+    auto clear() -> void;
+
+    auto contains(NodeOffset offset) const -> bool;
+    auto enabled() const { return capacity > 0; }
+    auto getCapacity() const { return capacity; }
+    auto getSize() const -> size_t;
+    auto getFramesCount() const -> size_t;
+    auto getHitsCount() const -> uint64_t;
+    auto getMissesCount() const -> uint64_t;
+    auto getShardsCount() const { return shardsCount; }
+
+private:
+    auto shardOf(NodeOffset offset) const -> Shard & {
+        // offsets are multiples of slot size, so they are mixed before their bits are taken
+        return shards[((offset * 0x9E3779B97F4A7C15ull) >> 32u) & (shardsCount - 1)];
+    }
+    static auto Erase(Shard &shard, NodeOffset offset) -> void;
+    static auto Evict(Shard &shard) -> void;
+    static auto EvictFrom(Shard &shard, OffsetsList &list) -> bool;
+    static auto Remember(Shard &shard, NodeOffset offset) -> void;
+    static auto IsPinned(Frame const &frame) { return frame.node.use_count() > 1; }
+    static auto ListOf(Shard &shard, Segment segment) -> OffsetsList & {
+        return segment == Segment::PROBATION ? shard.probation : shard.hot;
+    }
+
+    size_t capacity;
+    size_t shardsCount;
+    std::unique_ptr<Shard[]> shards;
+};
+
+
+template<typename TNode>
+BufferPool<TNode>::BufferPool(size_t capacity)
+        : capacity(capacity),
+          shardsCount(std::bit_floor(std::clamp<size_t>(capacity / MinShardCapacity, 1, MaxShardsCount))),
+          shards(std::make_unique<Shard[]>(shardsCount)) {
+    for (size_t i = 0; i < shardsCount; ++i) shards[i].capacity = capacity / shardsCount;
+}
+
+
+/**
+ * Returns cached node, reference bit of node in protected list is set, node in probation FIFO keeps its position
+ * @param offset file offset of node
+ * @param counted hit or miss is added to counters of pool
+ * @return ptr to cached node, nullptr if not cached
+ */
+template<typename TNode>
+auto BufferPool<TNode>::get(NodeOffset offset, bool counted) -> NodePtr {
+    auto &shard = shardOf(offset);
+    std::shared_lock lock(shard.mutex);
+    auto it = shard.frames.find(offset);
+    if (it == shard.frames.end()) {
+        if (counted) shard.misses.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    if (counted) shard.hits.fetch_add(1, std::memory_order_relaxed);
+    auto &frame = it->second;
+    // bit is written only when it changes, so hits of hot node don't invalidate its cache line in other cores
+    if (frame.segment == Segment::PROTECTED && !frame.referenced.load(std::memory_order_relaxed))
+        frame.referenced.store(true, std::memory_order_relaxed);
+    return frame.node;
+}
+
+
+/**
+ * Adds node to pool, it goes to protected list if its offset is in ghost list, to probation FIFO otherwise.
+ * Evicts unpinned nodes of its shard if budget of shard is exceeded
+ * @param offset file offset of node
+ * @param node loaded node
+ * @param size size of node on disk
+ */
+template<typename TNode>
+auto BufferPool<TNode>::put(NodeOffset offset, NodePtr node, size_t size) -> void {
+    if (!enabled()) return;
+    auto &shard = shardOf(offset);
+    std::unique_lock lock(shard.mutex);
+    auto segment = shard.ghostsIndex.contains(offset) ? Segment::PROTECTED : Segment::PROBATION;
+    Erase(shard, offset); // remembered offset is forgotten as well
+    auto &list = ListOf(shard, segment);
+    list.push_front(offset);
+    shard.frames.try_emplace(offset, std::move(node), size, segment, list.begin());
+    shard.size += size;
+    if (segment == Segment::PROBATION) shard.probationSize += size;
+    Evict(shard);
+}
+
+
+/**
+ * Drops node from pool without writing it back
+ * @param offset file offset of node
+ */
+template<typename TNode>
+auto BufferPool<TNode>::erase(NodeOffset offset) -> void {
+    auto &shard = shardOf(offset);
+    std::unique_lock lock(shard.mutex);
+    Erase(shard, offset);
+}
+
+
+template<typename TNode>
+auto BufferPool<TNode>::contains(NodeOffset offset) const -> bool {
+    auto &shard = shardOf(offset);
+    std::shared_lock lock(shard.mutex);
+    return shard.frames.contains(offset);
+}
+
+
+/**
+ * @return cached nodes which have to be written back, nodes stay cached
+ */
+template<typename TNode>
+auto BufferPool<TNode>::changedNodes() const -> std::vector<NodePtr> {
+    std::vector<NodePtr> result;
+    for (size_t i = 0; i < shardsCount; ++i) {
+        std::shared_lock lock(shards[i].mutex);
+        for (auto const &[offset, frame] : shards[i].frames)
+            if (frame.node->isChanged()) result.push_back(frame.node);
+    }
+    return result;
+}
+
+
+/**
+ * Drops all nodes from pool, not pinned changed nodes are written back
+ */
+template<typename TNode>
+auto BufferPool<TNode>::clear() -> void {
+    for (size_t i = 0; i < shardsCount; ++i) {
+        auto &shard = shards[i];
+        std::unique_lock lock(shard.mutex);
+        shard.frames.clear();
+        shard.probation.clear();
+        shard.hot.clear();
+        shard.ghosts.clear();
+        shard.ghostsIndex.clear();
+        shard.size = shard.probationSize = 0;
+    }
+}
+
+
+template<typename TNode>
+auto BufferPool<TNode>::getSize() const -> size_t {
+    size_t result = 0;
+    for (size_t i = 0; i < shardsCount; ++i) {
+        std::shared_lock lock(shards[i].mutex);
+        result += shards[i].size;
+    }
+    return result;
+}
+
+
+template<typename TNode>
+auto BufferPool<TNode>::getFramesCount() const -> size_t {
+    size_t result = 0;
+    for (size_t i = 0; i < shardsCount; ++i) {
+        std::shared_lock lock(shards[i].mutex);
+        result += shards[i].frames.size();
+    }
+    return result;
+}
+
+
+template<typename TNode>
+auto BufferPool<TNode>::getHitsCount() const -> uint64_t {
+    uint64_t result = 0;
+    for (size_t i = 0; i < shardsCount; ++i) result += shards[i].hits.load(std::memory_order_relaxed);
+    return result;
+}
+
+
+template<typename TNode>
+auto BufferPool<TNode>::getMissesCount() const -> uint64_t {
+    uint64_t result = 0;
+    for (size_t i = 0; i < shardsCount; ++i) result += shards[i].misses.load(std::memory_order_relaxed);
+    return result;
+}
+
+
+/**
+ * Drops frame and remembered offset of node, lock of shard has to be held exclusively
+ */
+template<typename TNode>
+auto BufferPool<TNode>::Erase(Shard &shard, NodeOffset offset) -> void {
+    if (auto ghost = shard.ghostsIndex.find(offset); ghost != shard.ghostsIndex.end()) {
+        shard.ghosts.erase(ghost->second);
+        shard.ghostsIndex.erase(ghost);
+    }
+    auto it = shard.frames.find(offset);
+    if (it == shard.frames.end()) return;
+    auto &frame = it->second;
+    shard.size -= frame.size;
+    if (frame.segment == Segment::PROBATION) shard.probationSize -= frame.size;
+    ListOf(shard, frame.segment).erase(frame.position);
+    shard.frames.erase(it);
+}
+
+
+template<typename TNode>
+auto BufferPool<TNode>::Evict(Shard &shard) -> void {
+    while (shard.size > shard.capacity) {
+        auto preferProbation = shard.probationSize > shard.capacity / 4 || shard.hot.empty();
+        auto &first = preferProbation ? shard.probation : shard.hot;
+        auto &second = preferProbation ? shard.hot : shard.probation;
+        if (!EvictFrom(shard, first) && !EvictFrom(shard, second))
+            return; // everything is pinned
+    }
+}
+
+
+/**
+ * Evicts the oldest unpinned node from given list, referenced node of protected list is moved to its front with
+ * reference bit cleared instead
+ * @return true if any node was evicted
+ */
+template<typename TNode>
+auto BufferPool<TNode>::EvictFrom(Shard &shard, OffsetsList &list) -> bool {
+    for (auto it = list.end(); it != list.begin();) {
+        auto current = std::prev(it);
+        auto &frame = shard.frames.find(*current)->second;
+        if (IsPinned(frame)) {
+            it = current;
+            continue;
+        }
+        // moved frame is visited again only if all older ones were referenced or pinned
+        if (frame.referenced.exchange(false, std::memory_order_relaxed)) {
+            list.splice(list.begin(), list, current);
+            continue;
+        }
+        auto offset = *current;
+        auto segment = frame.segment;
+        Tools::debug([offset] { std::clog << "Evicting node: " << offset << '\n'; }, 3);
+        Erase(shard, offset); // node destructor writes it back if changed
+        if (segment == Segment::PROBATION) Remember(shard, offset);
+        return true;
+    }
+    return false;
+}
+
+
+template<typename TNode>
+auto BufferPool<TNode>::Remember(Shard &shard, NodeOffset offset) -> void {
+    shard.ghosts.push_front(offset);
+    shard.ghostsIndex[offset] = shard.ghosts.begin();
+    if (shard.ghosts.size() > std::max<size_t>(shard.frames.size(), 64)) {
+        shard.ghostsIndex.erase(shard.ghosts.back());
+        shard.ghosts.pop_back();
+    }
+}
+
+
+#endif //SBD2_BUFFER_POOL_HH
@@ -0,0 +1,54 @@
+#include "crc32c.hh"
+#include <array>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+
+namespace {
+    constexpr uint32_t Polynomial = 0x82f63b78; // Castagnoli polynomial, reversed
+
+    constexpr auto MakeTable() {
+        std::array<uint32_t, 256> table{};
+        for (uint32_t i = 0; i < table.size(); ++i) {
+            auto crc = i;
+            for (int bit = 0; bit < 8; ++bit) crc = crc & 1u ? (crc >> 1u) ^ Polynomial : crc >> 1u;
+            table[i] = crc;
+        }
+        return table;
+    }
+
+    constexpr auto Table = MakeTable();
+
+    auto softwareCrc32c(char const *data, size_t size, uint32_t crc) -> uint32_t {
+        for (size_t i = 0; i < size; ++i) crc = Table[(crc ^ static_cast<uint8_t>(data[i])) & 0xffu] ^ (crc >> 8u);
+        return crc;
+    }
+
+#if defined(__x86_64__)
+    // compiled for SSE4.2 regardless of build flags, called only if CPU supports it
+    __attribute__((target("sse4.2")))
+    auto hardwareCrc32c(char const *data, size_t size, uint32_t crc) -> uint32_t {
+        uint64_t crc64 = crc;
+        for (; size >= sizeof(uint64_t); data += sizeof(uint64_t), size -= sizeof(uint64_t)) {
+            uint64_t word;
+            std::memcpy(&word, data, sizeof(word));
+            crc64 = _mm_crc32_u64(crc64, word);
+        }
+        crc = static_cast<uint32_t>(crc64);
+        for (; size > 0; ++data, --size) crc = _mm_crc32_u8(crc, static_cast<uint8_t>(*data));
+        return crc;
+    }
+#endif
+}
+
+
+auto Crc32c(char const *data, size_t size) -> uint32_t {
+#if defined(__x86_64__)
+    static bool const hardwareSupported = __builtin_cpu_supports("sse4.2");
+    if (hardwareSupported) return ~hardwareCrc32c(data, size, ~0u);
+#endif
+    return ~softwareCrc32c(data, size, ~0u);
+}
@@ -0,0 +1,13 @@
+#ifndef SBD2_CRC32C_HH
+#define SBD2_CRC32C_HH
+
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * CRC32C (Castagnoli) of data, uses crc32 instruction if CPU supports SSE4.2 and lookup table otherwise
+ */
+auto Crc32c(char const *data, size_t size) -> uint32_t;
+
+
+#endif //SBD2_CRC32C_HH
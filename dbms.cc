@@ -3,7 +3,7 @@
 //
 
 #include "dbms.hh"
-#include "b_plus_tree.hh"
+#include "tree.hh"
 #include "unique_generator.hh"
 #include <readline/readline.h>
 #include <readline/history.h>
@@ -11,6 +11,10 @@
 #include <iomanip>
 #include <functional>
 #include <cstring>
+#include <chrono>
+#include "node_search.hh"
+#include "external_sort.hh"
+#include <thread>
 
 
 auto Dbms::Main(int argc, char **argv) -> int {
@@ -31,16 +35,20 @@ auto Dbms::InitCommands() -> void{
             {"exit",           {Exit,                   "Close DB file and Exit program"}},
 
             {"open",           {LoadDbFile,             "Open specified db file"}},
-            {"new",            {CreateDbFile,           "Create new db file at specified location"}},
+            {"new",            {CreateDbFile,           "Create new db file at specified location: new file [inner_degree leaf_degree]"}},
             {"close",          {CloseDbFile,            "Save and close db file"}},
+            {"migrate",        {MigrateDbFile,          "Convert db file created by older version: migrate old_file new_file"}},
 
             {"file",           {PrintDbFile,            "Print content of db file in human readable form to stdout"}},
             {"nodes",          {PrintTree,              "Print all nodes of tree to stdout"}},
             {"draw",           {DrawTree,               "Draw and display tree as svg picture"}},
             {"ls",             {PrintRecords,           "Print all records in order by key value"}},
             {"lsd",            {PrintRecordsDescending, "Print all records in order by key value (descending)"}},
+            {"range",          {PrintRecordsInRange,    "Print records with keys from given range in order by key value: range low_key high_key [limit]"}},
 
             {"load",           {LoadTestFile,           "Load test file"}},
+            {"bulkload",       {BulkLoadFile,           "Build empty tree from file of lines: key grade1 grade2 grade3 sorted by key: bulkload file [fill_factor]"}},
+            {"import",         {ImportFile,             "Build empty tree from unsorted file of lines: key grade1 grade2 grade3 (the last of equal keys wins): import file [fill_factor]"}},
             {"gentestfile",    {GenTestFile,            "Generate random test file with specified size (if not size is random"}},
             // tree operations
 
@@ -53,8 +61,12 @@ auto Dbms::InitCommands() -> void{
             {"delete",         {DeleteRecord,           "Delete record"}},
 
 
+            {"set",            {SetOption,              "Set option used by next opened db file: set [name value]"}},
             {"stats",          {PrintStatistics,        "Print DB statistics"}},
-            {"lastop",         {LastOpStats,            "Last operation statistics"}}
+            {"lastop",         {LastOpStats,            "Last operation statistics"}},
+            {"benchsearch",    {BenchmarkSearch,        "Measure time of search in full nodes of degrees 2-256: benchsearch [searches]"}},
+            {"benchreads",     {BenchmarkReads,         "Measure throughput of random reads done by 1, 2, 4... threads: benchreads [max_threads] [reads]"}},
+            {"benchwrites",    {BenchmarkWrites,        "Measure throughput of random reads mixed with inserts done by 1, 2, 4... threads: benchwrites [max_threads] [operations] [read_percent]"}}
     };
     // @formatter:on
 }
@@ -151,7 +163,7 @@ auto Dbms::LoadDbFile(std::string const &params) -> void {
 
 
     try {
-        tree = std::make_unique<BTreeType>(params, OpenMode::USE_EXISTING);
+        tree = Tree::Open(params, options);
     } catch (std::runtime_error const &e) {
         std::cerr << "Error opening file: " << params << '\n' << e.what() << '\n';
         return;
@@ -165,21 +177,39 @@ auto Dbms::CreateDbFile(std::string const &params) -> void {
         std::cout << "You have to close current db before creating new\n";
         return;
     }
+    std::vector<std::string> tokens;
+    boost::split(tokens, params, boost::is_any_of(" "), boost::token_compress_on);
     if (params.empty()) {
         std::cout << "You have to specify file to create\n";
         return;
     }
+    if (tokens.size() != 1 && tokens.size() != 3) {
+        std::cout << "Invalid arguments, should be: new file [inner_degree leaf_degree]\n";
+        return;
+    }
+    auto innerNodeDegree = DefaultInnerNodeDegree;
+    auto leafNodeDegree = DefaultLeafNodeDegree;
+    try {
+        if (tokens.size() == 3) {
+            innerNodeDegree = std::stoull(tokens[1]);
+            leafNodeDegree = std::stoull(tokens[2]);
+        }
+    } catch (std::logic_error const &e) {
+        std::cout << "Invalid degrees of nodes: " << tokens[1] << ' ' << tokens[2] << '\n';
+        return;
+    }
 
-    if (!ConfirmOverridingExistingFile(params))
+    if (!ConfirmOverridingExistingFile(tokens[0]))
         return;
 
     try {
-        tree = std::make_unique<BTreeType>(params, OpenMode::CREATE_NEW);
+        tree = Tree::Create(tokens[0], innerNodeDegree, leafNodeDegree, options);
     } catch (std::runtime_error const &e) {
         std::cerr << e.what() << '\n';
+        fs::remove(tokens[0]);
         return;
     }
-    prompt = params;
+    prompt = tokens[0];
 }
 
 
@@ -193,6 +223,47 @@ auto Dbms::CloseDbFile(std::string const &params) -> void {
 }
 
 
+auto Dbms::MigrateDbFile(std::string const &params) -> void {
+    if (tree) {
+        std::cout << "You have to close current db before migrating\n";
+        return;
+    }
+    auto separator = params.find(' ');
+    if (separator == std::string::npos) {
+        std::cout << "You have to specify old and new file: migrate old_file new_file\n";
+        return;
+    }
+    auto oldPath = params.substr(0, separator);
+    auto newPath = boost::trim_copy(params.substr(separator + 1));
+    if (!ConfirmOverridingExistingFile(newPath))
+        return;
+
+    uint64_t recordsCount = 0;
+    try {
+        auto [innerNodeDegree, leafNodeDegree] = Tree::ReadDegrees(oldPath);
+        tree = Tree::Create(newPath, innerNodeDegree, leafNodeDegree, options);
+        std::vector<std::pair<int64_t, Record>> batch;
+        auto createBatch = [&batch, &recordsCount] {
+            auto statuses = tree->createRecords(batch);
+            recordsCount += std::count(statuses.begin(), statuses.end(), InsertStatus::INSERTED);
+            batch.clear();
+        };
+        Tree::ReadOlderFile(oldPath, [&batch, &createBatch](auto const &key, auto const &value) {
+            batch.emplace_back(key, value);
+            if (batch.size() == MigrateBatchSize) createBatch();
+        });
+        createBatch();
+    } catch (std::runtime_error const &e) {
+        std::cerr << "Error migrating file: " << oldPath << '\n' << e.what() << '\n';
+        tree = nullptr;
+        fs::remove(newPath);
+        return;
+    }
+    std::cout << "Migrated " << recordsCount << " records to: " << newPath << '\n';
+    prompt = newPath;
+}
+
+
 auto Dbms::PrintDbFile(std::string const &params) -> void {
     if (!tree) {
         std::cout << "No opened database\n";
@@ -217,7 +288,8 @@ auto Dbms::CreateRecord(std::string const &params) -> void {
         auto recordToken = params.substr(params.find(' ') + 1);
         auto value = Record(recordToken);
         auto key = std::stoll(keyToken);
-        tree->createRecord(key, value);
+        if (tree->createRecord(key, value) == InsertStatus::DUPLICATE)
+            std::cout << "Given key already exists. Record not added.\n";
     } catch (std::out_of_range const &e) {
         std::cout << "Invalid arguments: " << params << '\n';
         std::cout << e.what() << '\n';
@@ -331,12 +403,14 @@ auto Dbms::PrintRecords(std::string const &params) -> void {
     }
     tree->resetOpCounters();
     std::cout << "Key:\tValue:\n";
-    auto nc = BTreeType::ANode::GetMaxNodesCount();
     int count = 0;
-    for (auto[k, v] : *tree) {
-        auto nc = BTreeType::ANode::GetMaxNodesCount();
-        std::cout << k << '\t' << v << '\n';
-        ++count;
+    try {
+        tree->forEachRecord([&count](auto const &k, auto const &v) {
+            std::cout << k << '\t' << v << '\n';
+            ++count;
+        });
+    } catch (std::runtime_error const &e) {
+        std::cerr << e.what() << '\n';
     }
     std::cout << "Total count: " << count << " records\n";
 }
@@ -350,10 +424,50 @@ auto Dbms::PrintRecordsDescending(std::string const &params) -> void {
     tree->resetOpCounters();
     std::cout << "Key:\tValue:\n";
     int count = 0;
-    for (auto it = tree->rbegin(); it != tree->rend(); ++it) {
-        auto[k, v] = *it;
-        std::cout << k << '\t' << v << '\n';
-        ++count;
+    try {
+        tree->forEachRecordDescending([&count](auto const &k, auto const &v) {
+            std::cout << k << '\t' << v << '\n';
+            ++count;
+        });
+    } catch (std::runtime_error const &e) {
+        std::cerr << e.what() << '\n';
+    }
+    std::cout << "Total count: " << count << " records\n";
+}
+
+
+auto Dbms::PrintRecordsInRange(std::string const &params) -> void {
+    if (!tree) {
+        std::cout << "No opened database\n";
+        return;
+    }
+    std::vector<std::string> tokens;
+    boost::split(tokens, params, boost::is_any_of(" "), boost::token_compress_on);
+    if (tokens.size() < 2 || tokens.size() > 3) {
+        std::cout << "You have to specify range of keys: range low_key high_key [limit]\n";
+        return;
+    }
+    int64_t lowKey, highKey;
+    size_t limit = 0;
+    try {
+        lowKey = std::stoll(tokens[0]);
+        highKey = std::stoll(tokens[1]);
+        if (tokens.size() == 3) limit = std::stoull(tokens[2]);
+    } catch (std::logic_error const &e) {
+        std::cout << "Invalid arguments: " << params << '\n';
+        std::cout << e.what() << '\n';
+        return;
+    }
+    tree->resetOpCounters();
+    std::cout << "Key:\tValue:\n";
+    int count = 0;
+    try {
+        tree->forEachRecordInRange(lowKey, highKey, limit, [&count](auto const &k, auto const &v) {
+            std::cout << k << '\t' << v << '\n';
+            ++count;
+        });
+    } catch (std::runtime_error const &e) {
+        std::cerr << e.what() << '\n';
     }
     std::cout << "Total count: " << count << " records\n";
 }
@@ -366,23 +480,42 @@ auto Dbms::PrintStatistics(std::string const &params) -> void {
     }
     using std::cout;
     tree->disableCounters();
-    cout << std::setw(40) << std::left << "DB file: " << fs::absolute(tree->filePath) << '\n';
-    cout << std::setw(40) << std::left << "DB file size: " << fs::file_size(tree->filePath) << " bytes\n";
+    cout << std::setw(40) << std::left << "DB file: " << fs::absolute(tree->getFilePath()) << '\n';
+    cout << std::setw(40) << std::left << "DB file size: " << tree->getFileSize() << " bytes\n";
     cout << std::setw(40) << std::left << "Underlying data type: " << tree->name() << '\n';
     cout << std::setw(40) << std::left << "Node degree:" << "Inner: " << tree->innerNodeDegree() << " Leaf: "
          << tree->leafNodeDegree() << '\n';
-    cout << std::setw(40) << std::left << "Tree height: " << tree->getHeight() << '\n';
-    cout << std::setw(40) << std::left << "Nodes in RAM: " << "Max: "
-         << BTreeType::ANode::GetMaxNodesCount() << " Current: " << BTreeType::ANode::GetCurrentNodesCount() << "\n";
-    cout << std::setw(40) << std::left << "Records number: " << tree->getRecordsNumber() << '\n';
-    auto[innerNodesCount, leafNodesCount] = tree->getNodesCount();
-    cout << std::setw(40) << std::left << "Nodes number: " << "Inner: " << innerNodesCount << " Leaf: "
-         << leafNodesCount
-         << " Sum: " << innerNodesCount + leafNodesCount << '\n';
+    try {
+        cout << std::setw(40) << std::left << "Tree height: " << tree->getHeight() << '\n';
+        cout << std::setw(40) << std::left << "Nodes in RAM: " << "Max: " << Tree::ANode::GetMaxNodesCount()
+             << " Current: " << Tree::ANode::GetCurrentNodesCount() << "\n";
+        auto const nodePool = BlockPool::GetStats();
+        cout << std::setw(40) << std::left << "Node pools (program): " << "Reserved: " << nodePool.reservedBytes
+             << " bytes Chunks: " << nodePool.chunksCount << " Allocations: " << nodePool.allocationsCount
+             << " Reused: " << nodePool.reusesCount << '\n';
+        cout << std::setw(40) << std::left << "Records number: " << tree->getRecordsNumber() << '\n';
+        auto[innerNodesCount, leafNodesCount] = tree->getNodesCount();
+        cout << std::setw(40) << std::left << "Nodes number: " << "Inner: " << innerNodesCount << " Leaf: "
+             << leafNodesCount
+             << " Sum: " << innerNodesCount + leafNodesCount << '\n';
+    } catch (std::runtime_error const &e) {
+        std::cerr << e.what() << '\n';
+    }
 
     cout << std::setw(40) << std::left << "Disk IO (session): " << "R: " << tree->getSessionDiskReadsCout() << " W: "
          << tree->getSessionDiskWritesCount() << " Sum: "
          << tree->getSessionDiskReadsCout() + tree->getSessionDiskWritesCount() << '\n';
+    cout << std::setw(40) << std::left << "Node writes (session): " << tree->getSessionNodeWritesCount() << '\n';
+    auto &bufferPool = tree->getBufferPool();
+    cout << std::setw(40) << std::left << "Buffer pool: " << "Used: " << bufferPool.getSize() << " / "
+         << bufferPool.getCapacity() << " bytes Nodes: " << bufferPool.getFramesCount() << '\n';
+    cout << std::setw(40) << std::left << "Buffer pool (session): " << "Hits: " << tree->getSessionCacheHitsCount()
+         << " Misses: " << tree->getSessionCacheMissesCount() << '\n';
+    auto const &readahead = tree->getReadaheadStats();
+    cout << std::setw(40) << std::left << "Readahead (session): " << "Prefetched: " << readahead.prefetchedPages
+         << " pages Hits: " << readahead.hits << " Wasted: " << readahead.wastedPages << " pages\n";
+    cout << std::setw(40) << std::left << "Checksum failures (session): " << tree->getSessionChecksumFailuresCount()
+         << '\n';
     tree->enableCounters();
 }
 
@@ -415,6 +548,98 @@ auto Dbms::LoadTestFile(std::string const &params) -> void {
 }
 
 
+auto Dbms::BulkLoadFile(std::string const &params) -> void {
+    LoadRecordsFile(params, false);
+}
+
+
+auto Dbms::ImportFile(std::string const &params) -> void {
+    LoadRecordsFile(params, true);
+}
+
+
+/**
+ * Builds tree from file of lines: key grade1 grade2 grade3, records of unsorted file are sorted by external sort
+ * before they are loaded (of records with equal keys the last one is used)
+ * @param params file [fill_factor]
+ * @param sort whether records have to be sorted
+ */
+auto Dbms::LoadRecordsFile(std::string const &params, bool sort) -> void {
+    if (!tree) {
+        std::cout << "No opened database\n";
+        return;
+    }
+    std::vector<std::string> tokens;
+    boost::split(tokens, params, boost::is_any_of(" "), boost::token_compress_on);
+    if (params.empty() || tokens.size() > 2) {
+        std::cout << "Invalid arguments, should be: " << (sort ? "import" : "bulkload") << " file [fill_factor]\n";
+        return;
+    }
+    auto fillFactor = 1.0;
+    try {
+        if (tokens.size() == 2) fillFactor = std::stod(tokens[1]);
+    } catch (std::logic_error const &e) {
+        std::cout << "Invalid fill factor: " << tokens[1] << '\n';
+        return;
+    }
+    if (!tree->empty()) {
+        std::cout << "Records can be loaded only into empty tree\n";
+        return;
+    }
+    auto filePath = fs::path(tokens[0]);
+    auto fileHandle = std::ifstream(filePath, std::ios::in);
+    if (!fileHandle.is_open()) {
+        std::cout << "Unable to open file: " << fs::absolute(filePath) << '\n';
+        return;
+    }
+    tree->resetOpCounters();
+    uint64_t lineNumber = 0;
+    auto line = std::string();
+    Tree::RecordsSource source = [&]() -> std::optional<std::pair<int64_t, Record>> {
+        while (std::getline(fileHandle, line)) {
+            ++lineNumber;
+            boost::trim(line);
+            if (line.empty() || line[0] == '#') continue;
+            try {
+                auto separator = line.find(' ');
+                if (separator == std::string::npos) throw std::invalid_argument("missing grades");
+                return std::pair(std::stoll(line.substr(0, separator)), Record(line.substr(separator + 1)));
+            } catch (std::logic_error const &e) {
+                throw std::runtime_error("Invalid record in line " + std::to_string(lineNumber) + ": " + line);
+            }
+        }
+        return std::nullopt;
+    };
+    auto begin = std::chrono::steady_clock::now();
+    try {
+        uint64_t recordsCount;
+        if (sort) {
+            auto printProgress = [](ExternalSort<int64_t, Record>::Progress const &progress) {
+                std::cout << "\rRead: " << progress.recordsAdded << " Runs: " << progress.runsWritten
+                          << " Merge passes: " << progress.mergePasses << " Loaded: " << progress.recordsReturned
+                          << std::flush;
+            };
+            auto sortDirectory = Dbms::sortDirectory.empty() ? fs::temp_directory_path() : Dbms::sortDirectory;
+            ExternalSort<int64_t, Record> sorter(sortDirectory, sortMemory, std::thread::hardware_concurrency(),
+                                                 printProgress);
+            while (auto record = source()) sorter.add(record->first, record->second);
+            sorter.finish();
+            recordsCount = tree->bulkLoad([&sorter] { return sorter.next(); }, fillFactor);
+            printProgress(sorter.getProgress());
+            std::cout << '\n';
+        } else {
+            recordsCount = tree->bulkLoad(source, fillFactor);
+        }
+        auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        std::cout << "Loaded " << recordsCount << " records in " << seconds << " s\n";
+    } catch (std::runtime_error const &e) {
+        if (sort) std::cout << '\n';
+        std::cout << "Error while loading file: " << fs::absolute(filePath) << '\n';
+        std::cout << e.what() << '\n';
+    }
+}
+
+
 auto Dbms::GenTestFile(std::string const &params) -> void {
     if (params.empty()) {
         std::cout << "Missing parameters: filename size\n";
@@ -500,7 +725,11 @@ auto Dbms::TruncateTree(std::string const &params) -> void {
         std::cout << "No opened database\n";
         return;
     }
-    tree = std::make_unique<BTreeType>(tree->filePath, OpenMode::CREATE_NEW);
+    auto filePath = tree->getFilePath();
+    auto innerNodeDegree = tree->innerNodeDegree();
+    auto leafNodeDegree = tree->leafNodeDegree();
+    tree = nullptr; // old tree has to write back its nodes before file is truncated
+    tree = Tree::Create(filePath, innerNodeDegree, leafNodeDegree, options);
 }
 
 
@@ -526,9 +755,287 @@ auto Dbms::LastOpStats(std::string const &params) -> void {
     }
     std::cout << "Disk reads:\t" << tree->getCurrentOperationDiskReadsCount() << '\n';
     std::cout << "Disk writes:\t" << tree->getCurrentOperationDiskWritesCount() << '\n';
+    std::cout << "Node writes:\t" << tree->getCurrentOperationNodeWritesCount() << '\n';
+    std::cout << "Cache hits:\t" << tree->getCurrentOperationCacheHitsCount() << '\n';
+    std::cout << "Cache misses:\t" << tree->getCurrentOperationCacheMissesCount() << '\n';
+}
+
+
+auto Dbms::SetOption(std::string const &params) -> void {
+    std::vector<std::string> tokens;
+    boost::split(tokens, params, boost::is_any_of(" "), boost::token_compress_on);
+    if (params.empty()) {
+        std::cout << std::setw(20) << std::left << "bufferpool" << options.bufferPoolSize << " bytes\n";
+        for (auto const &[backendName, backend] : fileBackends) {
+            if (backend == options.fileBackend)
+                std::cout << std::setw(20) << std::left << "backend" << backendName << '\n';
+        }
+        for (auto const &[formatName, format] : fileFormats) {
+            if (format == options.fileFormat)
+                std::cout << std::setw(20) << std::left << "format" << formatName << '\n';
+        }
+        for (auto const &[levelName, level] : durabilityLevels) {
+            if (level == options.durability)
+                std::cout << std::setw(20) << std::left << "durability" << levelName << '\n';
+        }
+        std::cout << std::setw(20) << std::left << "readahead" << options.readaheadWindow << " pages\n";
+        std::cout << std::setw(20) << std::left << "scanthreads" << options.scanThreads << '\n';
+        std::cout << std::setw(20) << std::left << "hugepages" << (options.hugePages ? "on" : "off") << '\n';
+        std::cout << std::setw(20) << std::left << "sortmemory" << sortMemory << " bytes\n";
+        std::cout << std::setw(20) << std::left << "sortdir"
+                  << (sortDirectory.empty() ? fs::temp_directory_path() : sortDirectory).string() << '\n';
+        return;
+    }
+    if (tokens.size() != 2) {
+        std::cout << "Invalid arguments, should be: set [name value]\n";
+        return;
+    }
+    auto const &name = tokens[0];
+    auto const &value = tokens[1];
+    try {
+        if (name == "bufferpool") {
+            options.bufferPoolSize = std::stoull(value);
+        } else if (name == "backend" && fileBackends.count(value)) {
+            options.fileBackend = fileBackends.at(value);
+        } else if (name == "backend") {
+            std::cout << "Available backends:";
+            for (auto const &[backendName, backend] : fileBackends) std::cout << ' ' << backendName;
+            std::cout << " (uring falls back to threads if io_uring is not available, direct requires paged files)\n";
+            return;
+        } else if (name == "format" && fileFormats.count(value)) {
+            options.fileFormat = fileFormats.at(value);
+        } else if (name == "format") {
+            std::cout << "Available formats of new files: slotted, paged\n";
+            return;
+        } else if (name == "durability" && durabilityLevels.count(value)) {
+            options.durability = durabilityLevels.at(value);
+        } else if (name == "durability") {
+            std::cout << "Available durability levels: none, batch (log synced once per group of operations), "
+                         "op (log synced after every operation), shadow (no log, changed nodes are copied and "
+                         "committed by superblock, only for new files)\n";
+            return;
+        } else if (name == "readahead") {
+            options.readaheadWindow = std::stoull(value);
+        } else if (name == "scanthreads") {
+            options.scanThreads = std::max(std::stoull(value), 1ull);
+        } else if (name == "hugepages" && (value == "on" || value == "off")) {
+            options.hugePages = value == "on";
+        } else if (name == "hugepages") {
+            std::cout << "Available values: on, off (memory of nodes is taken in chunks backed by transparent huge "
+                         "pages)\n";
+            return;
+        } else if (name == "sortmemory") {
+            sortMemory = std::stoull(value);
+            return;
+        } else if (name == "sortdir") {
+            sortDirectory = value;
+            return;
+        } else {
+            std::cout << "Unknown option: " << name << '\n';
+            return;
+        }
+    } catch (std::logic_error const &e) {
+        std::cout << "Invalid value: " << value << '\n';
+        return;
+    }
+    if (tree) std::cout << "Option will be used after reopening db file\n";
+}
+
+
+
+
+
+
+
+auto Dbms::BenchmarkSearch(std::string const &params) -> void {
+    size_t searchesCount = 1'000'000;
+    try {
+        if (!params.empty()) searchesCount = std::stoull(params);
+    } catch (std::logic_error const &e) {
+        std::cout << "Invalid number of searches: " << params << '\n';
+        return;
+    }
+    std::cout << "Time of single search in full node (ns), linear search uses: " << NodeSearch::KernelName() << '\n';
+    std::cout << std::setw(8) << std::left << "Degree" << std::setw(8) << "Keys" << std::setw(10) << "Kernel"
+              << std::setw(12) << "Kernel" << std::setw(12) << "std::find" << std::setw(12) << "lower_bound" << '\n';
+    [searchesCount]<size_t... Degrees>(std::index_sequence<Degrees...>) {
+        (BenchmarkSearchInNode<Degrees>(searchesCount), ...);
+    }(std::index_sequence<2, 4, 8, 16, 32, 64, 128, 256>{});
 }
 
 
+/**
+ * Reads random records of opened db file with growing number of threads, every number of threads does the same
+ * number of reads. Throughput scales as long as nodes are found in buffer pool, nodes read from file are read
+ * one at a time
+ * @param params [max_threads] [reads]
+ */
+auto Dbms::BenchmarkReads(std::string const &params) -> void {
+    if (!tree) {
+        std::cout << "No opened database\n";
+        return;
+    }
+    size_t maxThreadsCount = std::max(std::thread::hardware_concurrency(), 1u);
+    size_t readsCount = 1'000'000;
+    std::vector<std::string> tokens;
+    boost::split(tokens, params, boost::is_any_of(" "), boost::token_compress_on);
+    try {
+        if (!params.empty()) maxThreadsCount = std::max(std::stoull(tokens[0]), 1ull);
+        if (tokens.size() > 1) readsCount = std::stoull(tokens[1]);
+    } catch (std::logic_error const &e) {
+        std::cout << "Invalid arguments, should be: benchreads [max_threads] [reads]\n";
+        return;
+    }
+    std::vector<int64_t> keys;
+    tree->forEachRecord([&keys](auto const &key, auto const &) { keys.push_back(key); });
+    if (keys.empty()) {
+        std::cout << "Db file is empty\n";
+        return;
+    }
+    std::cout << std::setw(10) << std::left << "Threads" << std::setw(16) << "Reads/s" << "Speedup\n";
+    std::vector<size_t> threadsCounts;
+    for (size_t threadsCount = 1; threadsCount < maxThreadsCount; threadsCount *= 2) threadsCounts.push_back(threadsCount);
+    threadsCounts.push_back(maxThreadsCount);
+    double singleThreadThroughput = 0;
+    for (auto threadsCount : threadsCounts) {
+        std::atomic<size_t> notFoundCount = 0, failedCount = 0;
+        auto read = [&](size_t thread) {
+            auto generator = std::mt19937_64{thread};
+            auto distribution = std::uniform_int_distribution<size_t>{0, keys.size() - 1};
+            for (size_t i = thread; i < readsCount; i += threadsCount) {
+                try {
+                    if (!tree->readRecord(keys[distribution(generator)])) ++notFoundCount;
+                } catch (std::runtime_error const &e) {
+                    ++failedCount;
+                }
+            }
+        };
+        auto begin = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for (size_t thread = 1; thread < threadsCount; ++thread) threads.emplace_back(read, thread);
+        read(0);
+        for (auto &thread : threads) thread.join();
+        auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        auto throughput = static_cast<double>(readsCount) / seconds;
+        if (threadsCount == 1) singleThreadThroughput = throughput;
+        std::cout << std::setw(10) << std::left << threadsCount << std::setw(16) << static_cast<uint64_t>(throughput)
+                  << std::fixed << std::setprecision(2) << throughput / singleThreadThroughput << '\n'
+                  << std::defaultfloat;
+        if (notFoundCount || failedCount)
+            std::cout << "Records not found: " << notFoundCount << " Failed reads: " << failedCount << '\n';
+    }
+}
 
+/**
+ * Does random reads of existing records mixed with inserts of new ones (with keys greater than all existing keys)
+ * with growing number of threads, every number of threads does the same number of operations. Inserts which don't
+ * split leaves change them without blocking other threads. Inserted records are deleted after every measurement
+ * @param params [max_threads] [operations] [read_percent]
+ */
+auto Dbms::BenchmarkWrites(std::string const &params) -> void {
+    if (!tree) {
+        std::cout << "No opened database\n";
+        return;
+    }
+    size_t maxThreadsCount = std::max(std::thread::hardware_concurrency(), 1u);
+    size_t operationsCount = 100'000;
+    size_t readPercent = 50;
+    std::vector<std::string> tokens;
+    boost::split(tokens, params, boost::is_any_of(" "), boost::token_compress_on);
+    try {
+        if (!params.empty()) maxThreadsCount = std::max(std::stoull(tokens[0]), 1ull);
+        if (tokens.size() > 1) operationsCount = std::stoull(tokens[1]);
+        if (tokens.size() > 2) readPercent = std::min(std::stoull(tokens[2]), 100ull);
+    } catch (std::logic_error const &e) {
+        std::cout << "Invalid arguments, should be: benchwrites [max_threads] [operations] [read_percent]\n";
+        return;
+    }
+    std::vector<int64_t> keys;
+    tree->forEachRecord([&keys](auto const &key, auto const &) { keys.push_back(key); });
+    if (keys.empty()) {
+        std::cout << "Db file is empty\n";
+        return;
+    }
+    auto value = *tree->readRecord(keys.front());
+    std::cout << std::setw(10) << std::left << "Threads" << std::setw(16) << "Operations/s" << "Speedup\n";
+    std::vector<size_t> threadsCounts;
+    for (size_t threadsCount = 1; threadsCount < maxThreadsCount; threadsCount *= 2) threadsCounts.push_back(threadsCount);
+    threadsCounts.push_back(maxThreadsCount);
+    double singleThreadThroughput = 0;
+    for (auto threadsCount : threadsCounts) {
+        std::atomic<size_t> failedCount = 0;
+        std::vector<std::vector<int64_t>> insertedKeys(threadsCount);
+        auto work = [&](size_t thread) {
+            auto generator = std::mt19937_64{thread};
+            auto keysDistribution = std::uniform_int_distribution<size_t>{0, keys.size() - 1};
+            auto percentDistribution = std::uniform_int_distribution<size_t>{0, 99};
+            for (size_t i = thread; i < operationsCount; i += threadsCount) {
+                try {
+                    if (percentDistribution(generator) < readPercent) {
+                        tree->readRecord(keys[keysDistribution(generator)]);
+                    } else {
+                        // threads insert disjoint keys
+                        auto key = keys.back() + 1 + static_cast<int64_t>(i);
+                        tree->createRecord(key, value);
+                        insertedKeys[thread].push_back(key);
+                    }
+                } catch (std::runtime_error const &e) {
+                    ++failedCount;
+                }
+            }
+        };
+        auto begin = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for (size_t thread = 1; thread < threadsCount; ++thread) threads.emplace_back(work, thread);
+        work(0);
+        for (auto &thread : threads) thread.join();
+        auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        auto throughput = static_cast<double>(operationsCount) / seconds;
+        if (threadsCount == 1) singleThreadThroughput = throughput;
+        std::cout << std::setw(10) << std::left << threadsCount << std::setw(16) << static_cast<uint64_t>(throughput)
+                  << std::fixed << std::setprecision(2) << throughput / singleThreadThroughput << '\n'
+                  << std::defaultfloat;
+        if (failedCount) std::cout << "Failed operations: " << failedCount << '\n';
+        for (auto const &threadKeys : insertedKeys)
+            for (auto key : threadKeys) tree->deleteRecord(key);
+    }
+}
 
 
+/**
+ * Searches random keys (half of them present) in full node of given degree using node search kernel, linear scan
+ * done before it was introduced and std::lower_bound. Every search depends on result of previous one (as searches
+ * done while descending the tree do), so latency of search is measured
+ * @tparam TDegree
+ * @param searchesCount
+ */
+template<size_t TDegree>
+auto Dbms::BenchmarkSearchInNode(size_t searchesCount) -> void {
+    constexpr auto KeysCount = 2 * TDegree;
+    std::array<int64_t, KeysCount> keys{};
+    for (size_t i = 0; i < KeysCount; ++i) keys[i] = static_cast<int64_t>(2 * i);
+    std::vector<int64_t> searchedKeys(searchesCount);
+    auto generator = std::mt19937_64{std::random_device{}()};
+    auto distribution = std::uniform_int_distribution<int64_t>{-1, static_cast<int64_t>(2 * KeysCount)};
+    for (auto &key : searchedKeys) key = distribution(generator);
+
+    auto measure = [&](auto search) {
+        size_t checksum = 0; // keeps searches from being optimised out, its top bits are always 0
+        auto begin = std::chrono::steady_clock::now();
+        for (auto key : searchedKeys) checksum += search(key + static_cast<int64_t>(checksum >> 62));
+        auto end = std::chrono::steady_clock::now();
+        if (checksum == static_cast<size_t>(-1)) std::cout << checksum;
+        return std::chrono::duration<double, std::nano>(end - begin).count() / std::max<size_t>(searchesCount, 1);
+    };
+    auto kernelTime = measure([&](int64_t key) { return NodeSearch::LowerBound<KeysCount>(keys.data(), KeysCount, key); });
+    auto findTime = measure([&](int64_t key) {
+        return static_cast<size_t>(std::find(keys.begin(), keys.end(), key) - keys.begin());
+    });
+    auto lowerBoundTime = measure([&](int64_t key) {
+        return static_cast<size_t>(std::lower_bound(keys.begin(), keys.end(), key) - keys.begin());
+    });
+    auto kernel = KeysCount <= NodeSearch::LinearSearchMaxKeys ? "linear" : "binary";
+    std::cout << std::setw(8) << std::left << TDegree << std::setw(8) << KeysCount << std::setw(10) << kernel
+              << std::fixed << std::setprecision(2) << std::setw(12) << kernelTime << std::setw(12) << findTime
+              << std::setw(12) << lowerBoundTime << '\n' << std::defaultfloat;
+}
@@ -11,7 +11,7 @@
 #include <memory>
 #include <any>
 #include <filesystem>
-#include "b_plus_tree.hh"
+#include "tree.hh"
 
 namespace fs = std::filesystem;
 
@@ -19,7 +19,10 @@ class Record;
 
 
 class Dbms final {
-    using BTreeType = BPlusTree<int64_t, Record, 2, 3>;
+    // degrees of nodes of new db file if they aren't specified
+    static constexpr size_t DefaultInnerNodeDegree = 2;
+    static constexpr size_t DefaultLeafNodeDegree = 3;
+    static constexpr size_t MigrateBatchSize = 4096; // records created with single batched insert
 
 public:
     static auto Main(int argc, char **argv) -> int;
@@ -35,16 +38,24 @@ private:
     inline static auto CreateDbFile(std::string const &params) -> void;
     inline static auto LoadDbFile(std::string const &params) -> void;
     inline static auto CloseDbFile(std::string const &params = {}) -> void;
+    inline static auto MigrateDbFile(std::string const &params) -> void;
     inline static auto PrintDbFile(std::string const &params = {}) -> void;
     inline static auto PrintTree(std::string const &params = {}) -> void;
     inline static auto DrawTree(std::string const &params = {}) -> void;
     inline static auto TruncateTree(std::string const &params = {}) -> void;
     inline static auto PrintRecords(std::string const &params = {}) -> void;
     inline static auto PrintRecordsDescending(std::string const &params = {}) -> void;
+    inline static auto PrintRecordsInRange(std::string const &params) -> void;
     inline static auto PrintStatistics(std::string const &params = {}) -> void;
     inline static auto LastOpStats(std::string const &params = {}) -> void;
     inline static auto LoadTestFile(std::string const &params) -> void;
+    inline static auto BulkLoadFile(std::string const &params) -> void;
+    inline static auto ImportFile(std::string const &params) -> void;
     inline static auto GenTestFile(std::string const &params) -> void;
+    inline static auto SetOption(std::string const &params) -> void;
+    inline static auto BenchmarkSearch(std::string const &params) -> void;
+    inline static auto BenchmarkReads(std::string const &params) -> void;
+    inline static auto BenchmarkWrites(std::string const &params) -> void;
     // CRUD operations
     inline static auto CreateRecord(std::string const &params) -> void;
     inline static auto ReadRecord(std::string const &params) -> void;
@@ -52,11 +63,34 @@ private:
     inline static auto DeleteRecord(std::string const &params) -> void;
     // other tools function
     inline static auto ConfirmOverridingExistingFile(fs::path const &path) -> bool;
+    inline static auto LoadRecordsFile(std::string const &params, bool sort) -> void;
+    template<size_t TDegree> inline static auto BenchmarkSearchInNode(size_t searchesCount) -> void;
 
 
     inline static std::map<std::string,
             std::tuple<std::function<void(std::string const &params)>, std::string>> commands;
-    inline static std::unique_ptr<BTreeType> tree;
+    inline static std::unique_ptr<Tree> tree;
+    inline static TreeOptions options;
+    // used by import of unsorted files, empty directory means system temporary directory
+    inline static size_t sortMemory = 256u << 20u;
+    inline static fs::path sortDirectory;
+    inline static const std::map<std::string, FileBackendType> fileBackends{
+            {"pread",   FileBackendType::PREAD},
+            {"mmap",    FileBackendType::MMAP},
+            {"uring",   FileBackendType::URING},
+            {"threads", FileBackendType::THREADS},
+            {"direct",  FileBackendType::DIRECT},
+    };
+    inline static const std::map<std::string, FileFormat> fileFormats{
+            {"slotted", FileFormat::SLOTTED},
+            {"paged",   FileFormat::PAGED},
+    };
+    inline static const std::map<std::string, Durability> durabilityLevels{
+            {"none",   Durability::NONE},
+            {"batch",  Durability::BATCH},
+            {"op",     Durability::OPERATION},
+            {"shadow", Durability::SHADOW},
+    };
     inline static std::string prompt = "";
 };
 
@@ -0,0 +1,92 @@
+#include "direct_file_backend.hh"
+#include <cerrno>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <fcntl.h>
+#include <unistd.h>
+
+
+namespace {
+    /**
+     * Page aligned buffer reused by all transfers of the thread
+     */
+    auto alignedBuffer(size_t size) -> char * {
+        struct Buffer {
+            char *data = nullptr;
+            size_t capacity = 0;
+
+            ~Buffer() { std::free(data); }
+        };
+        thread_local Buffer buffer;
+        if (buffer.capacity < size) {
+            std::free(buffer.data);
+            buffer.data = static_cast<char *>(std::aligned_alloc(PageSize, size));
+            buffer.capacity = buffer.data ? size : 0;
+            if (!buffer.data) throw std::bad_alloc();
+        }
+        return buffer.data;
+    }
+
+    auto alignDown(size_t value) { return value / PageSize * PageSize; }
+
+    auto alignUp(size_t value) { return (value + PageSize - 1) / PageSize * PageSize; }
+}
+
+
+DirectFileBackend::DirectFileBackend(fs::path const &path, std::ios::openmode const &mode)
+        : PositionalFileBackend(path, mode, O_DIRECT) {}
+
+
+size_t DirectFileBackend::read(size_t offset, char *data, size_t size) {
+    if (size == 0 || offset >= this->fileSize) return 0;
+    auto begin = alignDown(offset);
+    auto end = alignUp(offset + size);
+    auto buffer = alignedBuffer(end - begin);
+    auto transferred = this->transfer(IoRequest::Type::READ, begin, buffer, end - begin);
+    if (transferred <= offset - begin) return 0;
+    auto result = std::min(size, transferred - (offset - begin));
+    std::memcpy(data, buffer + (offset - begin), result);
+    return result;
+}
+
+
+void DirectFileBackend::write(size_t offset, char const *data, size_t size) {
+    if (size == 0) return;
+    auto begin = alignDown(offset);
+    auto end = alignUp(offset + size);
+    auto buffer = alignedBuffer(end - begin);
+    // pages partially covered by written data have to be read first
+    if (begin != offset || end != offset + size) {
+        std::memset(buffer, 0, end - begin);
+        if (begin < this->fileSize)
+            this->transfer(IoRequest::Type::READ, begin, buffer, PageSize);
+        if (end - PageSize != begin && end - PageSize < this->fileSize)
+            this->transfer(IoRequest::Type::READ, end - PageSize, buffer + (end - begin - PageSize), PageSize);
+    }
+    std::memcpy(buffer + (offset - begin), data, size);
+    if (this->transfer(IoRequest::Type::WRITE, begin, buffer, end - begin) == end - begin)
+        this->updateSize(end);
+}
+
+
+/**
+ * Executes aligned transfer, short read is treated as end of file
+ * @return number of bytes transferred
+ */
+size_t DirectFileBackend::transfer(IoRequest::Type type, size_t offset, char *data, size_t size) {
+    auto done = size_t{0};
+    while (done < size) {
+        auto transferred = type == IoRequest::Type::READ
+                           ? ::pread(this->fd, data + done, size - done, static_cast<off_t>(offset + done))
+                           : ::pwrite(this->fd, data + done, size - done, static_cast<off_t>(offset + done));
+        if (transferred < 0 && errno == EINTR) continue;
+        if (transferred < 0) this->failed = true;
+        if (transferred <= 0) break;
+        done += static_cast<size_t>(transferred);
+        // next transfer would start at unaligned offset
+        if (done % PageSize != 0) break;
+    }
+    return done;
+}
@@ -0,0 +1,25 @@
+#ifndef SBD2_DIRECT_FILE_BACKEND_HH
+#define SBD2_DIRECT_FILE_BACKEND_HH
+
+#include "positional_file_backend.hh"
+
+/**
+ * Positional backend opening file with O_DIRECT, so data is not cached by OS (buffer pool is the only cache).
+ * Every transfer is extended to whole pages and goes through page aligned buffer, parts of pages which are
+ * not covered by write are read first. Written files always have size being multiple of PageSize.
+ */
+class DirectFileBackend final : public PositionalFileBackend {
+public:
+    DirectFileBackend(fs::path const &path, std::ios::openmode const &mode);
+
+    size_t read(size_t offset, char *data, size_t size) override;
+    void write(size_t offset, char const *data, size_t size) override;
+    // page cache is bypassed, so there is nothing to fetch in advance
+    void prefetch([[maybe_unused]] size_t offset, [[maybe_unused]] size_t size) override {}
+
+private:
+    size_t transfer(IoRequest::Type type, size_t offset, char *data, size_t size);
+};
+
+
+#endif //SBD2_DIRECT_FILE_BACKEND_HH
@@ -0,0 +1,340 @@
+#ifndef SBD2_EXTERNAL_SORT_HH
+#define SBD2_EXTERNAL_SORT_HH
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <optional>
+#include <random>
+#include <type_traits>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+/**
+ * Sorts records which don't fit in memory by key. Added records are collected in chunks, every full chunk is sorted
+ * by one of worker threads and spilled to run file, then runs are merged (in several passes if there are too many
+ * of them to merge at once) into stream returned by next(). Memory used by chunks and merge buffers is bounded
+ * by given limit. Run files are kept in own directory created inside given one.
+ * Records with equal keys are resolved deterministically: the one added last wins, other ones are dropped.
+ */
+template<typename TKey, typename TValue>
+class ExternalSort final {
+    // values are kept as their bytes, so TValue (e.g. Record) doesn't have to be default constructible
+    struct Entry {
+        TKey key;
+        uint64_t sequence; // position in input, resolves duplicates
+        std::array<char, sizeof(TValue)> value;
+    };
+
+    // run file read with fixed size buffer
+    struct RunReader {
+        std::ifstream stream;
+        std::vector<Entry> buffer;
+        size_t position = 0;
+        size_t count = 0; // entries read into buffer
+    };
+
+    static_assert(std::is_trivially_copyable_v<TKey> && std::is_trivially_copyable_v<TValue>,
+                  "Records are spilled to run files as their bytes");
+
+public:
+    static constexpr size_t MinMergeBufferSize = 64u << 10u; // bytes of buffer of every merged run
+
+    struct Progress {
+        uint64_t recordsAdded = 0;
+        uint64_t runsWritten = 0;
+        uint64_t mergePasses = 0;
+        uint64_t recordsReturned = 0;
+    };
+    using ProgressCallback = std::function<void(Progress const &)>;
+
+    ExternalSort(fs::path const &parentDirectory, size_t memoryLimit, size_t threadsCount, ProgressCallback progress = {});
+    ExternalSort(ExternalSort const &) = delete;
+    ExternalSort &operator=(ExternalSort const &) = delete;
+    ~ExternalSort();
+
+    auto add(TKey const &key, TValue const &value) -> void;
+    auto finish() -> void;
+    auto next() -> std::optional<std::pair<TKey, TValue>>;
+    auto getProgress() const -> Progress const & { return progress; }
+
+private:
+    auto spillChunk() -> void;
+    auto waitForSpill() -> void;
+    auto newRunPath() -> fs::path;
+    auto openRuns(std::vector<fs::path> const &paths) -> void;
+    auto nextEntry() -> std::optional<Entry>;
+    auto nextUniqueEntry() -> std::optional<Entry>;
+    auto refill(RunReader &reader) -> bool;
+    auto readersGreater() const;
+    static auto EntryLess(Entry const &a, Entry const &b) -> bool;
+    static auto WriteRun(fs::path const &path, std::vector<Entry> chunk) -> void;
+
+    fs::path directory;
+    size_t memoryLimit;
+    size_t chunkCapacity;
+    size_t mergeFanIn;
+    size_t threadsCount;
+    ProgressCallback progressCallback;
+    Progress progress;
+
+    std::vector<Entry> chunk;
+    std::deque<std::future<void>> spills; // chunks being sorted and written by worker threads
+    std::vector<fs::path> runs;
+    uint64_t runsCreated = 0;
+
+    // merge of the last runs, heap holds indices of readers ordered by their current entries
+    std::vector<RunReader> readers;
+    std::vector<size_t> heap;
+    std::optional<Entry> pending; // entry read ahead while looking for duplicates
+    bool finished = false;
+};
+
+
+/**
+ * @param parentDirectory where directory of run files is created
+ * @param memoryLimit bytes used by chunks (one per worker and one being filled) and by merge buffers
+ * @param threadsCount number of chunks sorted and written at once
+ * @param progress called after every spilled run, merge pass and regularly while records are returned
+ */
+template<typename TKey, typename TValue>
+ExternalSort<TKey, TValue>::ExternalSort(fs::path const &parentDirectory, size_t memoryLimit, size_t threadsCount,
+                                         ProgressCallback progress)
+        : memoryLimit(memoryLimit), threadsCount(std::max<size_t>(threadsCount, 1)),
+          progressCallback(std::move(progress)) {
+    this->chunkCapacity = std::max<size_t>(memoryLimit / (this->threadsCount + 1) / sizeof(Entry), 1);
+    this->mergeFanIn = std::max<size_t>(memoryLimit / MinMergeBufferSize, 2);
+    auto generator = std::mt19937_64{std::random_device{}()};
+    do {
+        this->directory = parentDirectory / ("sbd2_sort_" + std::to_string(generator()));
+    } while (!fs::create_directories(this->directory));
+    this->chunk.reserve(this->chunkCapacity);
+}
+
+
+/**
+ * Waits for workers and removes run files
+ */
+template<typename TKey, typename TValue>
+ExternalSort<TKey, TValue>::~ExternalSort() {
+    for (auto &spill : this->spills) spill.wait();
+    this->readers.clear();
+    std::error_code error;
+    fs::remove_all(this->directory, error);
+}
+
+
+/**
+ * Adds record, full chunk is handed over to worker thread
+ * @param key
+ * @param value
+ */
+template<typename TKey, typename TValue>
+auto ExternalSort<TKey, TValue>::add(TKey const &key, TValue const &value) -> void {
+    if (this->finished) throw std::runtime_error("Records can't be added to finished sort");
+    this->chunk.push_back({key, this->progress.recordsAdded++, std::bit_cast<std::array<char, sizeof(TValue)>>(value)});
+    if (this->chunk.size() == this->chunkCapacity) this->spillChunk();
+}
+
+
+/**
+ * Spills the last chunk and merges runs until all of them can be merged at once by next()
+ */
+template<typename TKey, typename TValue>
+auto ExternalSort<TKey, TValue>::finish() -> void {
+    if (this->finished) return;
+    if (!this->chunk.empty()) this->spillChunk();
+    while (!this->spills.empty()) this->waitForSpill();
+    this->chunk = {};
+    this->finished = true;
+
+    while (this->runs.size() > this->mergeFanIn) {
+        // entries keep their sequence numbers, so duplicates are resolved the same way in any merge order
+        std::vector<fs::path> merged(this->runs.begin(), this->runs.begin() + this->mergeFanIn);
+        this->openRuns(merged);
+        auto path = this->newRunPath();
+        {
+            std::ofstream stream(path, std::ios::binary | std::ios::trunc);
+            std::vector<Entry> buffer;
+            buffer.reserve(MinMergeBufferSize / sizeof(Entry));
+            while (auto entry = this->nextUniqueEntry()) {
+                buffer.push_back(*entry);
+                if (buffer.size() < buffer.capacity()) continue;
+                stream.write(reinterpret_cast<char const *>(buffer.data()), buffer.size() * sizeof(Entry));
+                buffer.clear();
+            }
+            stream.write(reinterpret_cast<char const *>(buffer.data()), buffer.size() * sizeof(Entry));
+            if (!stream) throw std::runtime_error("Couldn't write run file: " + path.string());
+        }
+        this->readers.clear();
+        for (auto const &run : merged) fs::remove(run);
+        this->runs.erase(this->runs.begin(), this->runs.begin() + this->mergeFanIn);
+        this->runs.push_back(path);
+        ++this->progress.mergePasses;
+        if (this->progressCallback) this->progressCallback(this->progress);
+    }
+    this->openRuns(this->runs);
+}
+
+
+/**
+ * @return next record in order by key, nullopt after the last one
+ */
+template<typename TKey, typename TValue>
+auto ExternalSort<TKey, TValue>::next() -> std::optional<std::pair<TKey, TValue>> {
+    if (!this->finished) this->finish();
+    auto entry = this->nextUniqueEntry();
+    if (!entry) return std::nullopt;
+    if (++this->progress.recordsReturned % (1u << 20u) == 0 && this->progressCallback)
+        this->progressCallback(this->progress);
+    return std::pair(entry->key, std::bit_cast<TValue>(entry->value));
+}
+
+
+/**
+ * Hands current chunk over to worker thread, waits for the oldest one if all workers are busy
+ */
+template<typename TKey, typename TValue>
+auto ExternalSort<TKey, TValue>::spillChunk() -> void {
+    if (this->spills.size() == this->threadsCount) this->waitForSpill();
+    auto path = this->newRunPath();
+    this->runs.push_back(path);
+    this->spills.push_back(std::async(std::launch::async, WriteRun, path, std::move(this->chunk)));
+    this->chunk = {};
+    this->chunk.reserve(this->chunkCapacity);
+}
+
+
+/**
+ * Waits until the oldest chunk is written, rethrows error of its worker
+ */
+template<typename TKey, typename TValue>
+auto ExternalSort<TKey, TValue>::waitForSpill() -> void {
+    auto spill = std::move(this->spills.front());
+    this->spills.pop_front();
+    spill.get();
+    ++this->progress.runsWritten;
+    if (this->progressCallback) this->progressCallback(this->progress);
+}
+
+
+template<typename TKey, typename TValue>
+auto ExternalSort<TKey, TValue>::newRunPath() -> fs::path {
+    return this->directory / ("run" + std::to_string(this->runsCreated++));
+}
+
+
+/**
+ * Sorts chunk by keys (records with equal keys in order of input), drops all but the last of equal ones
+ * and writes it to run file, executed by worker thread
+ */
+template<typename TKey, typename TValue>
+auto ExternalSort<TKey, TValue>::WriteRun(fs::path const &path, std::vector<Entry> chunk) -> void {
+    std::sort(chunk.begin(), chunk.end(), EntryLess);
+    // the last of equal keys is kept
+    auto end = std::unique(chunk.rbegin(), chunk.rend(), [](Entry const &a, Entry const &b) {
+        return !(a.key < b.key) && !(b.key < a.key);
+    });
+    auto first = end.base();
+    std::ofstream stream(path, std::ios::binary | std::ios::trunc);
+    stream.write(reinterpret_cast<char const *>(&*first), (chunk.end() - first) * sizeof(Entry));
+    if (!stream) throw std::runtime_error("Couldn't write run file: " + path.string());
+}
+
+
+/**
+ * Orders entries by key, entries with equal keys by order of input
+ */
+template<typename TKey, typename TValue>
+auto ExternalSort<TKey, TValue>::EntryLess(Entry const &a, Entry const &b) -> bool {
+    return a.key < b.key || (!(b.key < a.key) && a.sequence < b.sequence);
+}
+
+
+/**
+ * @return comparator of readers by their current entries, makes heap of readers a min heap
+ */
+template<typename TKey, typename TValue>
+auto ExternalSort<TKey, TValue>::readersGreater() const {
+    return [this](size_t a, size_t b) {
+        auto const &x = this->readers[a];
+        auto const &y = this->readers[b];
+        return EntryLess(y.buffer[y.position], x.buffer[x.position]);
+    };
+}
+
+
+/**
+ * Opens run files to be merged, memory limit is split between their buffers
+ * @param paths
+ */
+template<typename TKey, typename TValue>
+auto ExternalSort<TKey, TValue>::openRuns(std::vector<fs::path> const &paths) -> void {
+    this->readers.clear();
+    this->heap.clear();
+    this->pending.reset();
+    this->readers.resize(paths.size());
+    auto bufferSize = std::max(MinMergeBufferSize, this->memoryLimit / std::max<size_t>(paths.size(), 1));
+    for (size_t i = 0; i < paths.size(); ++i) {
+        auto &reader = this->readers[i];
+        reader.stream.open(paths[i], std::ios::binary);
+        if (!reader.stream) throw std::runtime_error("Couldn't open run file: " + paths[i].string());
+        reader.buffer.resize(std::max<size_t>(bufferSize / sizeof(Entry), 1));
+        if (this->refill(reader)) this->heap.push_back(i);
+    }
+    std::make_heap(this->heap.begin(), this->heap.end(), this->readersGreater());
+}
+
+
+/**
+ * Reads next part of run into its buffer
+ * @return false if run is exhausted
+ */
+template<typename TKey, typename TValue>
+auto ExternalSort<TKey, TValue>::refill(RunReader &reader) -> bool {
+    reader.stream.read(reinterpret_cast<char *>(reader.buffer.data()),
+                       static_cast<std::streamsize>(reader.buffer.size() * sizeof(Entry)));
+    if (reader.stream.bad()) throw std::runtime_error("Couldn't read run file");
+    reader.count = static_cast<size_t>(reader.stream.gcount()) / sizeof(Entry);
+    reader.position = 0;
+    return reader.count > 0;
+}
+
+
+/**
+ * @return the smallest entry of merged runs (by key, then by order of input), nullopt if runs are exhausted
+ */
+template<typename TKey, typename TValue>
+auto ExternalSort<TKey, TValue>::nextEntry() -> std::optional<Entry> {
+    if (this->heap.empty()) return std::nullopt;
+    auto greater = this->readersGreater();
+    std::pop_heap(this->heap.begin(), this->heap.end(), greater);
+    auto &reader = this->readers[this->heap.back()];
+    auto result = reader.buffer[reader.position];
+    if (++reader.position < reader.count || this->refill(reader))
+        std::push_heap(this->heap.begin(), this->heap.end(), greater);
+    else
+        this->heap.pop_back();
+    return result;
+}
+
+
+/**
+ * @return next entry of merged runs, of entries with equal keys only the last one added is returned
+ */
+template<typename TKey, typename TValue>
+auto ExternalSort<TKey, TValue>::nextUniqueEntry() -> std::optional<Entry> {
+    auto result = this->pending ? this->pending : this->nextEntry();
+    if (!result) return std::nullopt;
+    while ((this->pending = this->nextEntry()) && !(result->key < this->pending->key)) result = this->pending;
+    return result;
+}
+
+
+#endif //SBD2_EXTERNAL_SORT_HH
@@ -1,55 +1,287 @@
-
-
 //
 // Created by kamil on 12.12.18.
 //
 
 #include "file.hh"
+#include "mmap_file_backend.hh"
+#include "async_file_backend.hh"
+#include "positional_file_backend.hh"
+#include "direct_file_backend.hh"
+#include "write_ahead_log.hh"
+#include <algorithm>
+#include <cstring>
+
+
+void FileBackend::submit(IoRequest *requests, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        auto &request = requests[i];
+        if (request.type == IoRequest::Type::READ) {
+            request.result = this->read(request.offset, request.data, request.size);
+        } else {
+            this->write(request.offset, request.data, request.size);
+            request.result = request.size;
+        }
+    }
+}
 
 
 File::File(fs::path const &path, std::ios::openmode const &mode,
-           std::function<void(void)> incReadsCntCallback, std::function<void(void)> incWritesCntCallback) {
-    this->fileHandle.open(path, mode);
+           std::function<void(void)> incReadsCntCallback, std::function<void(void)> incWritesCntCallback,
+           FileBackendType backendType) {
+    switch (backendType) {
+        case FileBackendType::PREAD:
+            this->backend = std::make_unique<PositionalFileBackend>(path, mode);
+            break;
+        case FileBackendType::MMAP:
+            this->backend = std::make_unique<MmapFileBackend>(path, mode);
+            break;
+        case FileBackendType::URING:
+        case FileBackendType::THREADS:
+            this->backend = std::make_unique<AsyncFileBackend>(path, mode, backendType == FileBackendType::URING);
+            break;
+        case FileBackendType::DIRECT:
+            this->backend = std::make_unique<DirectFileBackend>(path, mode);
+            break;
+    }
     this->incReadsCntCallback = std::move(incReadsCntCallback);
     this->incWritesCntCallback = std::move(incWritesCntCallback);
-    this->fileHandle.rdbuf()->pubsetbuf(0, 0);
 }
 
 
 
 
 void File::write(size_t offset, std::vector<char> const &data) {
-    if (this->fileHandle.bad()) {
+    this->writeFrom(offset, data);
+}
+
+
+/**
+ * Writes data from caller owned buffer
+ */
+void File::writeFrom(size_t offset, std::span<char const> data) {
+    if (this->bad()) {
         throw std::runtime_error(
                 "Disk write at offset" + std::to_string(offset) + " of size " + std::to_string(data.size()) +
                 " failed before");
     }
     std::invoke(this->incWritesCntCallback);
-    this->fileHandle.clear();
-    this->fileHandle.seekp(offset);
-    this->fileHandle.write(data.data(), data.size());
-    if (this->fileHandle.bad())
+    std::invoke(this->incLogicalWritesCntCallback, 1);
+    if (this->log) this->stage(offset, data.data(), data.size());
+    else this->backend->write(offset, data.data(), data.size());
+    if (this->bad())
         throw std::runtime_error(
                 "Disk write at offset" + std::to_string(offset) + " of size " + std::to_string(data.size()) +
                 " failed after");
 }
 
 
+std::vector<char> File::read(size_t offset, size_t size) {
+    std::vector<char> result;
+    result.resize(size);
+    this->readInto(offset, result);
+    return result;
+}
 
 
-std::vector<char> File::read(size_t offset, size_t size) {
-    if (this->fileHandle.bad()) {
+/**
+ * Reads data into caller owned buffer
+ * @return number of bytes read, less than size of buffer at the end of file
+ */
+size_t File::readInto(size_t offset, std::span<char> data) {
+    if (this->bad()) {
+        throw std::runtime_error(
+                "Disk read at offset" + std::to_string(offset) + " of size " + std::to_string(data.size()) +
+                " failed before");
+    }
+    std::invoke(this->incReadsCntCallback);
+    auto result = this->backend->read(offset, data.data(), data.size());
+    if (this->log) result = this->overlay(offset, data.data(), data.size(), result);
+    this->eofReached = result < data.size();
+    if (this->bad())
+        throw std::runtime_error(
+                "Disk read at offset" + std::to_string(offset) + " of size " + std::to_string(data.size()) +
+                " failed after");
+    return result;
+}
+
+
+
+/**
+ * Reads data without copying it if backend allows that, otherwise data is read into internal buffer.
+ * Returned pointer is valid until next write or view.
+ * @return pointer to data and number of bytes available (less than size at the end of file)
+ */
+std::pair<char const *, size_t> File::view(size_t offset, size_t size) {
+    if (this->bad()) {
         throw std::runtime_error(
                 "Disk read at offset" + std::to_string(offset) + " of size " + std::to_string(size) + " failed before");
     }
     std::invoke(this->incReadsCntCallback);
-    this->fileHandle.clear();
-    std::vector<char> result;
-    result.resize(size);
-    this->fileHandle.seekg(offset);
-    this->fileHandle.read(result.data(), size);
-    if (this->fileHandle.bad())
+    // data changed by staged writes has to be copied, so it can be patched
+    auto patched = this->log && this->overlaps(offset, size);
+    auto result = patched ? std::pair<char const *, size_t>{nullptr, 0} : this->backend->view(offset, size);
+    if (result.first == nullptr) {
+        this->viewBuffer.resize(std::max(this->viewBuffer.size(), size));
+        result = {this->viewBuffer.data(), this->backend->read(offset, this->viewBuffer.data(), size)};
+    }
+    if (patched) result.second = this->overlay(offset, this->viewBuffer.data(), size, result.second);
+    if (this->bad())
         throw std::runtime_error(
                 "Disk read at offset" + std::to_string(offset) + " of size " + std::to_string(size) + " failed after");
     return result;
 }
+
+
+
+/**
+ * Executes batch of reads and writes with single backend call, every request is counted as separate disk access.
+ * Short reads (at the end of file) are reported via result of request and eof flag.
+ */
+void File::submit(std::vector<IoRequest> &requests) {
+    if (requests.empty()) return;
+    if (this->bad()) {
+        throw std::runtime_error("Disk batch of " + std::to_string(requests.size()) + " requests failed before");
+    }
+    for (auto const &request : requests) {
+        std::invoke(request.type == IoRequest::Type::READ ? this->incReadsCntCallback : this->incWritesCntCallback);
+        if (request.type == IoRequest::Type::WRITE) std::invoke(this->incLogicalWritesCntCallback, request.units);
+    }
+    if (this->log) {
+        // writes are staged, reads have to see them
+        std::vector<IoRequest> reads;
+        for (auto &request : requests) {
+            if (request.type == IoRequest::Type::READ) {
+                reads.push_back(request);
+            } else {
+                this->stage(request.offset, request.data, request.size);
+                request.result = request.size;
+            }
+        }
+        this->backend->submit(reads.data(), reads.size());
+        auto read = reads.begin();
+        for (auto &request : requests) {
+            if (request.type != IoRequest::Type::READ) continue;
+            request.result = this->overlay(request.offset, request.data, request.size, (read++)->result);
+        }
+    } else {
+        this->backend->submit(requests.data(), requests.size());
+    }
+    if (this->bad())
+        throw std::runtime_error("Disk batch of " + std::to_string(requests.size()) + " requests failed after");
+    for (auto const &request : requests) {
+        if (request.type == IoRequest::Type::WRITE && request.result != request.size)
+            throw std::runtime_error("Disk write at offset " + std::to_string(request.offset) + " of size " +
+                                     std::to_string(request.size) + " was incomplete");
+        if (request.type == IoRequest::Type::READ && request.result < request.size) this->eofReached = true;
+    }
+}
+
+
+size_t File::size() const {
+    auto result = this->backend ? this->backend->size() : 0;
+    for (auto const &write : this->staged()) result = std::max(result, write.offset + write.data.size());
+    return result;
+}
+
+
+/**
+ * Ends operation: its writes are appended to log, they are done in db file once log is synced
+ * (immediately or with the whole group of operations, depending on durability)
+ */
+void File::commit() {
+    if (!this->log) return;
+    if (this->loggedWritesCount < this->stagedWritesCount) {
+        std::invoke(this->incWritesCntCallback);
+        this->log->append(this->stagedWrites.data() + this->loggedWritesCount,
+                          this->stagedWritesCount - this->loggedWritesCount);
+        this->loggedWritesCount = this->stagedWritesCount;
+    }
+    if (!this->log->synced()) return;
+    this->applyStagedWrites();
+    if (this->log->size() >= WriteAheadLog::CheckpointSize) {
+        this->backend->sync();
+        this->log->truncate();
+    }
+}
+
+
+/**
+ * Drops writes of operation which failed, those staged since it was committed for the last time
+ */
+void File::rollback() {
+    this->stagedWritesCount = this->loggedWritesCount;
+    this->eofReached = false;
+}
+
+
+/**
+ * Commits pending writes, syncs log and db file, log is truncated afterwards
+ */
+void File::checkpoint() {
+    if (!this->log) return;
+    this->commit();
+    this->log->sync();
+    this->applyStagedWrites();
+    this->backend->sync();
+    this->log->truncate();
+}
+
+
+void File::sync() {
+    if (this->backend) this->backend->sync();
+}
+
+
+/**
+ * Keeps write in memory, write of the same range by current operation is replaced. Buffer of entry used by
+ * already applied write is reused
+ */
+void File::stage(size_t offset, char const *data, size_t size) {
+    for (auto it = this->stagedWrites.begin() + this->loggedWritesCount;
+         it != this->stagedWrites.begin() + this->stagedWritesCount; ++it) {
+        if (it->offset == offset && it->data.size() == size) {
+            std::memcpy(it->data.data(), data, size);
+            return;
+        }
+    }
+    if (this->stagedWritesCount == this->stagedWrites.size()) this->stagedWrites.emplace_back();
+    auto &write = this->stagedWrites[this->stagedWritesCount++];
+    write.offset = offset;
+    write.data.assign(data, data + size);
+}
+
+
+/**
+ * Patches read data with staged writes
+ * @param available number of bytes read from db file
+ * @return number of bytes available after patching
+ */
+size_t File::overlay(size_t offset, char *data, size_t size, size_t available) const {
+    for (auto const &write : this->staged()) {
+        auto begin = std::max(offset, write.offset);
+        auto end = std::min(offset + size, write.offset + write.data.size());
+        if (begin >= end) continue;
+        if (begin - offset > available) std::memset(data + available, 0, begin - offset - available);
+        std::memcpy(data + (begin - offset), write.data.data() + (begin - write.offset), end - begin);
+        available = std::max(available, end - offset);
+    }
+    return available;
+}
+
+
+bool File::overlaps(size_t offset, size_t size) const {
+    auto writes = this->staged();
+    return std::any_of(writes.begin(), writes.end(), [offset, size](auto const &write) {
+        return write.offset < offset + size && offset < write.offset + write.data.size();
+    });
+}
+
+
+void File::applyStagedWrites() {
+    for (auto const &write : this->staged()) this->backend->write(write.offset, write.data.data(), write.data.size());
+    this->stagedWritesCount = 0;
+    this->loggedWritesCount = 0;
+    // entries kept after big checkpoint would hold its memory
+    if (this->stagedWrites.size() > MaxKeptStagedWrites) this->stagedWrites = {};
+    if (this->bad()) throw std::runtime_error("Applying logged writes to db file failed");
+}
@@ -9,53 +9,150 @@
 #include <fstream>
 #include <functional>
 #include <filesystem>
+#include <memory>
+#include <span>
+#include <vector>
 
 namespace fs = std::filesystem;
 
+enum class FileBackendType { PREAD, MMAP, URING, THREADS, DIRECT };
+
+// unit of aligned IO, size of node slot in paged db files
+constexpr size_t PageSize = 4096;
+
+/**
+ * Single read or write executed as a part of batch, result is set to number of bytes transferred
+ */
+struct IoRequest {
+    enum class Type { READ, WRITE };
+
+    Type type;
+    size_t offset;
+    char *data;
+    size_t size;
+    size_t result = 0;
+    size_t units = 1; // number of logical writes (e.g. adjacent nodes) merged into the request
+};
+
+/**
+ * Write kept in memory until it can be done in db file (see WriteAheadLog)
+ */
+struct StagedWrite {
+    size_t offset;
+    std::vector<char> data;
+};
+
+class WriteAheadLog;
+
+/**
+ * Raw IO implementation used by File, reads may be short at the end of file
+ */
+class FileBackend {
+public:
+    virtual ~FileBackend() = default;
+
+    virtual size_t read(size_t offset, char *data, size_t size) = 0;
+    virtual void write(size_t offset, char const *data, size_t size) = 0;
+    // pointer to data inside of backend memory (valid until next write) and number of available bytes,
+    // nullptr if backend doesn't support zero copy access
+    virtual std::pair<char const *, size_t> view([[maybe_unused]] size_t offset, [[maybe_unused]] size_t size) {
+        return {nullptr, 0};
+    }
+    // executes all requests (possibly concurrently, so their ranges must not overlap) and waits for completions
+    virtual void submit(IoRequest *requests, size_t count);
+    // makes written data durable
+    virtual void sync() {}
+    // hint that range will be read soon, data should be fetched in background
+    virtual void prefetch([[maybe_unused]] size_t offset, [[maybe_unused]] size_t size) {}
+    virtual size_t size() const = 0;
+    virtual bool bad() const = 0;
+};
+
+
 class File final {
 public:
+    static constexpr size_t MaxKeptStagedWrites = 1024; // more entries aren't kept for reuse after being applied
+
     File() = default;
     File(fs::path const &path, std::ios::openmode const &mode,
          std::function<void(void)> incReadsCntCallback,
-         std::function<void(void)> incWritesCntCallback);
+         std::function<void(void)> incWritesCntCallback,
+         FileBackendType backendType = FileBackendType::PREAD);
 
     template<typename T> void write(size_t offset, T const &data);
 
     void write(size_t offset, std::vector<char> const &data);
 
+    void writeFrom(size_t offset, std::span<char const> data);
+
     template<typename T> T read(size_t offset);
 
     std::vector<char> read(size_t offset, size_t size);
 
-    void clear() { this->fileHandle.clear(); }
-    bool bad() { return this->fileHandle.bad(); }
-    bool good() { return this->fileHandle.good(); }
-    auto tellg() { return this->fileHandle.tellg(); }
-    auto tellp() { return this->fileHandle.tellp(); }
-    bool eof() { return this->fileHandle.eof(); }
+    size_t readInto(size_t offset, std::span<char> data);
+
+    std::pair<char const *, size_t> view(size_t offset, size_t size);
+
+    void submit(std::vector<IoRequest> &requests);
+
+    void prefetch(size_t offset, size_t size) { if (this->backend) this->backend->prefetch(offset, size); }
+
+    // called with number of logical writes, disk writes callback counts physical write calls
+    void setLogicalWritesCallback(std::function<void(size_t)> callback) {
+        this->incLogicalWritesCntCallback = std::move(callback);
+    }
+    void setLog(WriteAheadLog *writeAheadLog) { this->log = writeAheadLog; }
+    void commit();
+    void rollback();
+    void checkpoint();
+    void sync();
+
+    size_t size() const;
+    // nodes are written as whole pages if set (0 means that node slots are packed)
+    void setPageSize(size_t size) { this->pageSize = size; }
+    size_t getPageSize() const { return this->pageSize; }
+    void clear() { this->eofReached = false; }
+    bool bad() { return !this->backend || this->backend->bad(); }
+    bool good() { return !this->bad() && !this->eofReached; }
+    bool eof() { return this->eofReached; }
 
 
 private:
-    std::fstream fileHandle;
+    void stage(size_t offset, char const *data, size_t size);
+    size_t overlay(size_t offset, char *data, size_t size, size_t available) const;
+    bool overlaps(size_t offset, size_t size) const;
+    void applyStagedWrites();
+    std::span<StagedWrite const> staged() const { return {this->stagedWrites.data(), this->stagedWritesCount}; }
+
+    std::unique_ptr<FileBackend> backend;
+    WriteAheadLog *log = nullptr;
+    // writes done since log was synced for the last time, first loggedWritesCount of them are already in log.
+    // Entries after the first stagedWritesCount ones are kept with their buffers to be reused by next writes
+    std::vector<StagedWrite> stagedWrites;
+    size_t stagedWritesCount = 0;
+    size_t loggedWritesCount = 0;
+    std::vector<char> viewBuffer;
+    bool eofReached = false;
+    size_t pageSize = 0;
     std::function<void(void)> incReadsCntCallback;
     std::function<void(void)> incWritesCntCallback;
+    std::function<void(size_t)> incLogicalWritesCntCallback = [](size_t) {};
 
 
 };
 
 template<typename T>
 void File::write(size_t offset, T const &data) {
-    auto dataVector = std::vector<char>();
-    dataVector.resize(sizeof(T));
-    *reinterpret_cast<T *>(dataVector.data()) = data;
-    this->write(offset, dataVector);
+    this->writeFrom(offset, {reinterpret_cast<char const *>(&data), sizeof(T)});
 }
 
 template<typename T>
 T File::read(size_t offset) {
-    auto size = sizeof(T);
-    auto result = this->read(offset, size);
-    return *reinterpret_cast<T *>(result.data()); // TODO: possibly wrong????}
-
+    T result{};
+    this->readInto(offset, {reinterpret_cast<char *>(&result), sizeof(T)});
+    return result;
 }
+
 #endif //SBD2_FILE_HH
+
+
@@ -7,13 +7,19 @@
 
 #include <optional>
 #include <bitset>
+#include <cstring>
+#include <limits>
 #include "node.hh"
+#include "node_search.hh"
 
 template<typename TKey, typename TValue, size_t TDegree>
 class InnerNode final : public Node<TKey, TValue> {
     using Base = Node<TKey, TValue>;
-    using DescendantsCollection = std::array<std::optional<NodeOffset>, 2 * TDegree + 1>;
-    using KeysCollection = std::array<std::optional<TKey>, 2 * TDegree>;
+    using DescendantsCollection = std::array<NodeOffset, 2 * TDegree + 1>;
+    using KeysCollection = std::array<TKey, 2 * TDegree>;
+    using EntriesCount = uint16_t;
+
+    static_assert(2 * TDegree + 1 <= std::numeric_limits<EntriesCount>::max(), "Inner node degree is too big");
     using KeysIterator = typename KeysCollection::iterator;
     using DescendantsIterator = typename DescendantsCollection::iterator;
     using KeysVectorIterator = typename std::vector<TKey>::iterator;
@@ -22,10 +28,13 @@ class InnerNode final : public Node<TKey, TValue> {
 
     template<typename, typename, size_t, size_t> friend class BPlusTree;
 public:
-    InnerNode(NodeOffset fileOffset, File &file, std::shared_ptr<Base> const &parent = nullptr);
+    InnerNode(NodeOffset fileOffset, File &file);
     ~InnerNode() override { this->unload(); };
 
-    static constexpr auto BytesSize() { return sizeof(DescendantsCollection) + sizeof(KeysCollection); };
+    static constexpr auto BytesSize() {
+        return 2 * sizeof(EntriesCount) + sizeof(NodeOffset) + sizeof(TKey) + sizeof(KeysCollection) +
+               sizeof(DescendantsCollection) + Base::ChecksumSize;
+    };
     auto getEntries() -> std::pair<std::vector<TKey>, std::vector<NodeOffset>>;
     auto setEntries(std::pair<std::vector<TKey>, std::vector<NodeOffset>> const &entries) -> void;
     auto setKeys(KeysVectorIterator begI, KeysVectorIterator endI) -> void;
@@ -34,7 +43,7 @@ public:
                                           TValue const *value,
                                           NodeOffset nodeOffset) -> TKey override;
     auto mergeWith(std::shared_ptr<Base> &node, TKey const *key = nullptr) -> void override;
-    auto full() const -> bool override;
+    auto full() const -> bool override { return descendantsCount == descendants.size(); }
     auto add(TKey const &key, NodeOffset descendantOffset) -> void;
     auto setKeyBetweenPtrs(NodeOffset aPtr, NodeOffset bPtr, TKey const &key) -> void;
     auto removeKeyOffsetAfter(NodeOffset offset) -> NodeState;
@@ -49,7 +58,7 @@ public:
     auto getAfterLastKeyIndex() const;
     auto getKeyBetweenPtrs(NodeOffset aPtr, NodeOffset bPtr) -> TKey;
     auto contains(TKey const &key) const -> bool override;
-    auto fillKeysSize() const -> size_t override;
+    auto fillKeysSize() const -> size_t override { return keysCount; }
     auto degree() -> size_t override { return TDegree; };
 
 
@@ -57,80 +66,78 @@ private:
     auto getKeyIndexBetweenPtrs(NodeOffset aPtr, NodeOffset bPtr) -> NodeOffset;
     auto print(std::ostream &o) -> std::ostream & override;
     auto print(std::stringstream &ss) -> std::stringstream & override;
-    auto deserialize(std::vector<Byte> const &bytes) -> void override;
-    auto getData() -> std::vector<Byte> override;
+    auto deserialize(Byte const *bytes) -> void override;
+    auto serializeData(Byte *bytes) -> void override;
     auto nodeType() const -> NodeType override { return NodeType::INNER; }
     auto bytesSize() const -> size_t override { return BytesSize(); }
     auto elementsSize() const -> size_t override { return ElementsSize(); }
     constexpr auto ElementsSize() const noexcept { return this->descendants.size() + this->keys.size() + 1; }
 
 
-    DescendantsCollection descendants{};
+    // entries are kept at the beginning of arrays, the rest of arrays is unused
+    EntriesCount keysCount = 0;
+    EntriesCount descendantsCount = 0;
     KeysCollection keys{};
+    DescendantsCollection descendants{};
+    // B-link: next node of the same level (0 for the last one), keys of node's subtree aren't greater than high key.
+    // Right link lets reader which raced with split of node reach entries moved to new node
+    NodeOffset rightLink{};
+    TKey highKey{}; // meaningful only if node has right link
 };
 
 
 template<typename TKey, typename TValue, size_t TDegree>
-InnerNode<TKey, TValue, TDegree>::InnerNode(NodeOffset fileOffset, File &file,
-                                            std::shared_ptr<InnerNode::Base> const &parent) : Base(fileOffset,
-                                                                                                   file,
-                                                                                                   parent) {}
+InnerNode<TKey, TValue, TDegree>::InnerNode(NodeOffset fileOffset, File &file) : Base(fileOffset, file) {}
 
+/**
+ * Writes counts, right link with high key and zero filled arrays of keys and descendants
+ */
 template<typename TKey, typename TValue, size_t TDegree>
-auto InnerNode<TKey, TValue, TDegree>::getData() -> std::vector<Byte> {
-    auto result = std::vector<Byte>();
-    auto keysByteArray = (std::array<Byte, sizeof(this->keys)> *) this->keys.data();
-    auto descendantsByteArray = (std::array<Byte, sizeof(this->descendants)> *) this->descendants.data();
-    result.reserve(keysByteArray->size() + descendantsByteArray->size());
-    std::copy(keysByteArray->begin(), keysByteArray->end(), std::back_inserter(result));
-    std::copy(descendantsByteArray->begin(), descendantsByteArray->end(), std::back_inserter(result));
-    return std::move(result);
+auto InnerNode<TKey, TValue, TDegree>::serializeData(Byte *bytes) -> void {
+    std::memcpy(bytes, &this->keysCount, sizeof(EntriesCount));
+    std::memcpy(bytes + sizeof(EntriesCount), &this->descendantsCount, sizeof(EntriesCount));
+    bytes += 2 * sizeof(EntriesCount);
+    std::memcpy(bytes, &this->rightLink, sizeof(NodeOffset));
+    std::memcpy(bytes + sizeof(NodeOffset), &this->highKey, sizeof(TKey));
+    bytes += sizeof(NodeOffset) + sizeof(TKey);
+    std::fill_n(bytes, sizeof(KeysCollection) + sizeof(DescendantsCollection), 0);
+    std::memcpy(bytes, this->keys.data(), this->keysCount * sizeof(TKey));
+    std::memcpy(bytes + sizeof(KeysCollection), this->descendants.data(), this->descendantsCount * sizeof(NodeOffset));
 }
 
 
 template<typename TKey, typename TValue, size_t TDegree>
 auto InnerNode<TKey, TValue, TDegree>::getEntries() -> std::pair<std::vector<TKey>, std::vector<NodeOffset>> {
-    auto[keysB, keysE] = this->getKeysRange();
-    auto[descB, descE] = this->getDescendantsRange();
-    std::vector<TKey> keys;
-    std::vector<NodeOffset> descs;
-    keys.reserve(keysE - keysB);
-    descs.reserve(descE - descB);
-    std::transform(keysB, keysE, std::back_inserter(keys), [](auto x) { return *x; });
-    std::transform(descB, descE, std::back_inserter(descs), [](auto x) { return *x; });
-    return {std::move(keys), std::move(descs)};
+    return {std::vector<TKey>(keys.begin(), keys.begin() + keysCount),
+            std::vector<NodeOffset>(descendants.begin(), descendants.begin() + descendantsCount)};
 }
 
 
 template<typename TKey, typename TValue, size_t TDegree>
-auto InnerNode<TKey, TValue, TDegree>::deserialize(std::vector<Byte> const &bytes) -> void {
+auto InnerNode<TKey, TValue, TDegree>::deserialize(Byte const *bytes) -> void {
     this->changed = true;
-    auto descendantsBytePtr = (std::array<Byte, sizeof(this->descendants)> *) this->descendants.data();
-    auto keysBytePtr = (std::array<Byte, sizeof(this->keys)> *) this->keys.data();
-    std::copy_n(bytes.begin(), keysBytePtr->size(), keysBytePtr->begin());
-    std::copy_n(bytes.begin() + keysBytePtr->size(), descendantsBytePtr->size(), descendantsBytePtr->begin());
-}
-
-
-template<typename TKey, typename TValue, size_t TDegree>
-auto InnerNode<TKey, TValue, TDegree>::fillKeysSize() const -> size_t {
-    return static_cast<size_t>(std::count_if(this->keys.begin(), this->keys.end(),
-                                             [](auto x) { return x != std::nullopt; }));
-}
-
-
-template<typename TKey, typename TValue, size_t TDegree>
-auto InnerNode<TKey, TValue, TDegree>::full() const -> bool {
-    return std::find(this->descendants.begin(), this->descendants.end(), std::nullopt) == this->descendants.end();
+    std::memcpy(&this->keysCount, bytes, sizeof(EntriesCount));
+    std::memcpy(&this->descendantsCount, bytes + sizeof(EntriesCount), sizeof(EntriesCount));
+    bytes += 2 * sizeof(EntriesCount);
+    std::memcpy(&this->rightLink, bytes, sizeof(NodeOffset));
+    std::memcpy(&this->highKey, bytes + sizeof(NodeOffset), sizeof(TKey));
+    bytes += sizeof(NodeOffset) + sizeof(TKey);
+    if (this->keysCount > this->keys.size() || this->descendantsCount > this->descendants.size())
+        throw std::runtime_error("Invalid inner node at: " + std::to_string(this->fileOffset));
+    std::memcpy(this->keys.data(), bytes, this->keysCount * sizeof(TKey));
+    std::memcpy(this->descendants.data(), bytes + sizeof(KeysCollection), this->descendantsCount * sizeof(NodeOffset));
 }
 
 
 template<typename TKey, typename TValue, size_t TDegree>
 auto InnerNode<TKey, TValue, TDegree>::setEntries(std::pair<std::vector<TKey>, std::vector<NodeOffset>> const &entries)
 -> void {
-    std::fill(std::move(entries.first.begin(), entries.first.end(), keys.begin()), keys.end(), std::nullopt);
-    std::fill(std::move(entries.second.begin(), entries.second.end(), descendants.begin()), descendants.end(),
-              std::nullopt);
+    if (entries.first.size() > keys.size() || entries.second.size() > descendants.size())
+        throw std::runtime_error("Internal DB error: too much entries in node to set");
+    std::copy(entries.first.begin(), entries.first.end(), keys.begin());
+    std::copy(entries.second.begin(), entries.second.end(), descendants.begin());
+    keysCount = static_cast<EntriesCount>(entries.first.size());
+    descendantsCount = static_cast<EntriesCount>(entries.second.size());
     this->changed = true;
 }
 
@@ -138,8 +145,7 @@ auto InnerNode<TKey, TValue, TDegree>::setEntries(std::pair<std::vector<TKey>, s
 template<typename TKey, typename TValue, size_t TDegree>
 auto InnerNode<TKey, TValue, TDegree>::setKeys(KeysVectorIterator begI, KeysVectorIterator endI) -> void {
     this->changed = true;
-    this->keys = KeysCollection();
-    std::move(begI, endI, this->keys.begin());
+    keysCount = static_cast<EntriesCount>(std::copy(begI, endI, this->keys.begin()) - this->keys.begin());
 }
 
 
@@ -147,8 +153,8 @@ template<typename TKey, typename TValue, size_t TDegree>
 auto InnerNode<TKey, TValue, TDegree>::setDescendants(DescendantsVectorIterator begI,
                                                       DescendantsVectorIterator endI) -> void {
     this->changed = true;
-    this->descendants = DescendantsCollection();
-    std::move(begI, endI, this->descendants.begin());
+    descendantsCount = static_cast<EntriesCount>(std::copy(begI, endI, this->descendants.begin())
+                                                 - this->descendants.begin());
 }
 
 
@@ -156,11 +162,14 @@ template<typename TKey, typename TValue, size_t TDegree>
 auto InnerNode<TKey, TValue, TDegree>::add(TKey const &key, NodeOffset descendantOffset) -> void {
     if (this->full()) throw std::runtime_error("Unable to add new key, desc to full node");
     this->changed = true;
-    auto data = this->getEntries();
-    auto insertPosition = std::upper_bound(data.first.begin(), data.first.end(), key) - data.first.begin();
-    data.first.insert(data.first.begin() + insertPosition, key);
-    data.second.insert(data.second.begin() + insertPosition + 1, descendantOffset);
-    this->setEntries(data);
+    auto insertPosition = NodeSearch::UpperBound<2 * TDegree>(keys.data(), keysCount, key);
+    // following entries are moved by one slot (memmove of trivially copyable elements)
+    std::copy_backward(keys.begin() + insertPosition, keys.begin() + keysCount, keys.begin() + keysCount + 1);
+    std::copy_backward(descendants.begin() + insertPosition + 1, descendants.begin() + descendantsCount,
+                       descendants.begin() + descendantsCount + 1);
+    keys[insertPosition] = key;
+    descendants[insertPosition + 1] = descendantOffset;
+    ++keysCount, ++descendantsCount;
 }
 
 
@@ -202,8 +211,8 @@ InnerNode<TKey, TValue, TDegree>::compensateWithAndReturnMiddleKey(std::shared_p
     if (otherNode->loaded) {
         if (this->parent == nullptr)
             throw std::invalid_argument("Internal DB error: InnerNode compensation failed: parent node is NULL");
-        auto parentKey = std::dynamic_pointer_cast<InnerNode>(this->parent)->getKeyBetweenPtrs(this->fileOffset,
-                                                                                               node->fileOffset);
+        auto parentKey = static_cast<InnerNode *>(this->parent)->getKeyBetweenPtrs(this->fileOffset,
+                                                                                   node->fileOffset);
         allKeys.push_back(parentKey);
         std::move(bKeys.begin(), bKeys.end(), std::back_inserter(allKeys));
         std::move(bDescendants.begin(), bDescendants.end(), std::back_inserter(allDescendants));
@@ -232,6 +241,8 @@ InnerNode<TKey, TValue, TDegree>::compensateWithAndReturnMiddleKey(std::shared_p
     otherNode->setKeys(middleKeyIterator + 1, allKeys.end());
     this->setDescendants(allDescendants.begin(), middleDescendantIterator + 1);
     otherNode->setDescendants(middleDescendantIterator + 1, allDescendants.end());
+    // newly created node is filled now, next compensations have to take its entries into account
+    otherNode->loaded = true;
 
     return middleKey;
 }
@@ -242,15 +253,18 @@ auto InnerNode<TKey, TValue, TDegree>::mergeWith(std::shared_ptr<Base> &node, TK
     if (node->nodeType() != NodeType::INNER)
         throw std::runtime_error("Internal DB error: merge failed, bad neighbour node type");
     auto otherNode = std::dynamic_pointer_cast<InnerNode>(node);
-    auto[firstKeysBegin, firstKeysEnd] = this->getKeysRange();
-    auto[secondKeysBegin, secondKeysEnd] = otherNode->getKeysRange();
-    auto[firstDescendantsBegin, firstDescendantsEnd] = this->getDescendantsRange();
-    auto[secondDescendantsBegin, secondDescendantsEnd] = otherNode->getDescendantsRange();
-    if (key) *firstKeysEnd = *key;
-    std::move(secondKeysBegin, secondKeysEnd, firstKeysEnd + 1);
-    std::move(secondDescendantsBegin, secondDescendantsEnd, firstDescendantsEnd);
+    if (keysCount + (key ? 1 : 0) + otherNode->keysCount > keys.size()
+        || descendantsCount + otherNode->descendantsCount > descendants.size())
+        throw std::runtime_error("Internal DB error: merge failed, too much entries");
+    if (key) keys[keysCount++] = *key;
+    std::copy_n(otherNode->keys.begin(), otherNode->keysCount, keys.begin() + keysCount);
+    std::copy_n(otherNode->descendants.begin(), otherNode->descendantsCount, descendants.begin() + descendantsCount);
+    keysCount += otherNode->keysCount;
+    descendantsCount += otherNode->descendantsCount;
+    // other node is the next one of the level, it is removed from list of the level
+    rightLink = otherNode->rightLink;
+    highKey = otherNode->highKey;
     this->markChanged();
-    otherNode->remove();
 
 }
 
@@ -272,30 +286,24 @@ auto InnerNode<TKey, TValue, TDegree>::print(std::stringstream &ss) -> std::stri
 
 template<typename TKey, typename TValue, size_t TDegree>
 auto InnerNode<TKey, TValue, TDegree>::contains(TKey const &key) const -> bool {
-    for (auto &element : keys) {
-        if (!element) return false;
-        if (*element == key) return true;
-    }
-    return false;
+    auto i = NodeSearch::LowerBound<2 * TDegree>(keys.data(), keysCount, key);
+    return i < keysCount && keys[i] == key;
 }
 
 
 template<typename TKey, typename TValue, size_t TDegree>
 auto InnerNode<TKey, TValue, TDegree>::getKeyBetweenPtrs(NodeOffset aPtr, NodeOffset bPtr) -> TKey {
-    auto result = keys[getKeyIndexBetweenPtrs(aPtr, bPtr)];
-    if (!result)
+    auto index = getKeyIndexBetweenPtrs(aPtr, bPtr);
+    if (index >= keysCount)
         throw std::runtime_error("Key between ptrs is nullopt: " + std::to_string(aPtr) + ' ' + std::to_string(bPtr));
-    return *result;
+    return keys[index];
 }
 
 
 template<typename TKey, typename TValue, size_t TDegree>
 auto InnerNode<TKey, TValue, TDegree>::getKeyIndexBetweenPtrs(NodeOffset aPtr, NodeOffset bPtr) -> NodeOffset {
-    for (auto i = 0u; i < descendants.size(); ++i) {
-        auto desc = descendants[i];
-        if (i == descendants.size() - 1) throw std::runtime_error("Internal DB error: searched key not found");
-        if (!desc) throw std::runtime_error("Internal DB error: searched key not found");
-        if (*desc == aPtr || *desc == bPtr) {
+    for (auto i = 0u; i < descendantsCount && i < descendants.size() - 1; ++i) {
+        if (descendants[i] == aPtr || descendants[i] == bPtr) {
             return i;
         }
     }
@@ -306,6 +314,8 @@ auto InnerNode<TKey, TValue, TDegree>::getKeyIndexBetweenPtrs(NodeOffset aPtr, N
 template<typename TKey, typename TValue, size_t TDegree>
 auto InnerNode<TKey, TValue, TDegree>::setKeyBetweenPtrs(NodeOffset aPtr, NodeOffset bPtr, TKey const &key) -> void {
     auto index = getKeyIndexBetweenPtrs(aPtr, bPtr);
+    if (index >= keysCount)
+        throw std::runtime_error("Internal DB error: key between ptrs not found");
     this->changed = true;
     keys[index] = key;
 }
@@ -313,26 +323,22 @@ auto InnerNode<TKey, TValue, TDegree>::setKeyBetweenPtrs(NodeOffset aPtr, NodeOf
 
 template<typename TKey, typename TValue, size_t TDegree>
 auto InnerNode<TKey, TValue, TDegree>::getNextDescendantOffset(NodeOffset offset) const -> std::optional<NodeOffset> {
-    for (int i = 0; i < this->descendants.size(); ++i) {
-        if (this->descendants[i] == std::nullopt)
-            return std::nullopt;
+    for (int i = 0; i < descendantsCount; ++i) {
         if (this->descendants[i] == offset) {
-            if (i < this->descendants.size() - 1 && this->descendants[i + 1]) {
+            if (i < descendantsCount - 1) {
                 return this->descendants[i + 1];
             }
             return std::nullopt;
         }
     }
+    if (descendantsCount < descendants.size()) return std::nullopt;
     throw std::runtime_error("Given descendant offset doesn't exist");
 }
 
 
 template<typename TKey, typename TValue, size_t TDegree>
 auto InnerNode<TKey, TValue, TDegree>::getPrevDescendantOffset(NodeOffset offset) const -> std::optional<NodeOffset> {
-    for (int i = 0; i < this->descendants.size(); ++i) {
-        if (this->descendants[i] == std::nullopt) {
-            return std::nullopt;
-        }
+    for (int i = 0; i < descendantsCount; ++i) {
         if (this->descendants[i] == offset) {
             if (i == 0) {
                 return std::nullopt;
@@ -340,67 +346,61 @@ auto InnerNode<TKey, TValue, TDegree>::getPrevDescendantOffset(NodeOffset offset
             return this->descendants[i - 1];
         }
     }
+    if (descendantsCount < descendants.size()) return std::nullopt;
     throw std::runtime_error("Given descendant offset doesn't exist");
 }
 
 
 template<typename TKey, typename TValue, size_t TDegree>
 auto InnerNode<TKey, TValue, TDegree>::getLastDescendantOffset() const -> NodeOffset {
-    return **std::find_if(descendants.rbegin(), descendants.rend(), [](auto x) { return x != std::nullopt; });
+    return descendants[descendantsCount - 1];
 }
 
 
 template<typename TKey, typename TValue, size_t TDegree>
 auto InnerNode<TKey, TValue, TDegree>::swapKeys(TKey const &oldKey, TKey const &newKey) -> void{
-    auto it = std::find(keys.begin(), keys.end(), oldKey);
-    if (it == keys.end()) {
+    auto i = NodeSearch::LowerBound<2 * TDegree>(keys.data(), keysCount, oldKey);
+    if (i == keysCount || keys[i] != oldKey) {
         throw std::runtime_error("Internal DB error: InnerNode->swapKeys: unable to find given key");
     }
-    *it = newKey;
+    keys[i] = newKey;
     this->changed = true;
 }
 
 
 template<typename TKey, typename TValue, size_t TDegree>
 auto InnerNode<TKey, TValue, TDegree>::getAfterLastKeyIndex() const {
-    return std::distance(std::find_if(keys.rbegin(), keys.rend(), [](auto x) { return x != std::nullopt; }),
-                         keys.rend());
+    return static_cast<long>(keysCount);
 }
 
 
 template<typename TKey, typename TValue, size_t TDegree>
 auto InnerNode<TKey, TValue, TDegree>::getKeysRange() -> std::pair<KeysIterator, KeysIterator>{
-    auto begin = keys.begin();
-    auto end = std::find_if(keys.rbegin(), keys.rend(), [](auto x) { return x != std::nullopt; }).base();
-    return {begin, end};
+    return {keys.begin(), keys.begin() + keysCount};
 }
 
 
 template<typename TKey, typename TValue, size_t TDegree>
 auto InnerNode<TKey, TValue, TDegree>::getDescendantsRange() -> std::pair<DescendantsIterator, DescendantsIterator>{
-    auto begin = descendants.begin();
-    auto end = std::find_if(descendants.rbegin(), descendants.rend(), [](auto x) { return x != std::nullopt; }).base();
-    return {begin, end};
+    return {descendants.begin(), descendants.begin() + descendantsCount};
 }
 
 
 template<typename TKey, typename TValue, size_t TDegree>
 auto InnerNode<TKey, TValue, TDegree>::removeKeyOffsetAfter(NodeOffset offset) -> NodeState {
-    int i = 0;
-    for (auto &o:descendants) {
-        if (o == std::nullopt) {
-            throw std::runtime_error("Internal DB error: innerNode: removeKeyOffsetAfter: given offset not found");
-        }
-        if (o == offset) break;
-        ++i;
-    }
+    auto i = std::find(descendants.begin(), descendants.begin() + descendantsCount, offset) - descendants.begin();
+    if (i == descendantsCount)
+        throw std::runtime_error("Internal DB error: innerNode: removeKeyOffsetAfter: given offset not found");
     i++; // now i is index of offset to delete
-    // removing offset
-    auto lastDesc = std::move(descendants.begin() + i + 1, descendants.end(), descendants.begin() + i);
-    std::fill(lastDesc, descendants.end(), std::nullopt);
-    // removing key
-    auto lastKey = std::move(keys.begin() + i, keys.end(), keys.begin() + i - 1);
-    std::fill(lastKey, keys.end(), std::nullopt);
+    // removing offset and key before it, following entries are moved by one slot
+    if (i < descendantsCount) {
+        std::copy(descendants.begin() + i + 1, descendants.begin() + descendantsCount, descendants.begin() + i);
+        --descendantsCount;
+    }
+    if (i - 1 < keysCount) {
+        std::copy(keys.begin() + i, keys.begin() + keysCount, keys.begin() + i - 1);
+        --keysCount;
+    }
     this->changed = true;
     if (this->fillKeysSize() < TDegree)
         return NodeState::TOO_SMALL;
@@ -409,10 +409,9 @@ auto InnerNode<TKey, TValue, TDegree>::removeKeyOffsetAfter(NodeOffset offset) -
 
 template<typename TKey, typename TValue, size_t TDegree>
 auto InnerNode<TKey, TValue, TDegree>::getDescendantsOfKey(TKey const &key) -> std::pair<NodeOffset, NodeOffset> {
-    auto[keysBegin, keysEnd] = getKeysRange();
-    auto i = std::lower_bound(keysBegin, keysEnd, key) - keysBegin;
-    auto l = *descendants[i];
-    auto p = *descendants[i + 1];
+    auto i = NodeSearch::LowerBound<2 * TDegree>(keys.data(), keysCount, key);
+    auto l = descendants[i];
+    auto p = descendants[i + 1];
     return {l, p};
 
 }
@@ -420,7 +419,7 @@ template<typename TKey, typename TValue, size_t TDegree>
 auto InnerNode<TKey, TValue, TDegree>::getPrecedingKey(NodeOffset nodeOffset) -> std::optional<TKey> {
     auto[b, e] = getDescendantsRange();
     auto result = std::find(b, e, nodeOffset);
-    if (result == e) return std::nullopt;
+    if (result == e || result - b >= keysCount) return std::nullopt;
     return keys[result - b];
 }
 
@@ -436,6 +435,7 @@ auto InnerNode<TKey, TValue, TDegree>::print(std::ostream &o) -> std::ostream &
     if (i != 0)
         o << descendants[i];
     o << '}'; // TODO: changeit after the fix
+    if (this->rightLink != 0) o << " -> " << this->rightLink << " <= " << this->highKey;
     return o;
 }
 
@@ -0,0 +1,165 @@
+#include "io_uring_queue.hh"
+#include "file.hh"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+namespace {
+    int ioUringSetup(unsigned entries, io_uring_params *params) {
+        return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+    }
+
+    int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+        return static_cast<int>(::syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+    }
+
+    template<typename T> T *ringField(void *ring, unsigned offset) {
+        return reinterpret_cast<T *>(static_cast<char *>(ring) + offset);
+    }
+}
+
+
+/**
+ * Sets up ring, available() is false if kernel doesn't support io_uring (or it is disabled)
+ */
+IoUringQueue::IoUringQueue() {
+    io_uring_params params{};
+    auto fd = ioUringSetup(QueueDepth, &params);
+    if (fd < 0) return;
+    this->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    this->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    auto singleMapping = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMapping) this->sqRingSize = this->cqRingSize = std::max(this->sqRingSize, this->cqRingSize);
+    this->sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    auto map = [fd](size_t size, off_t offset) {
+        return ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+    };
+    this->sqRing = map(this->sqRingSize, IORING_OFF_SQ_RING);
+    this->cqRing = singleMapping ? this->sqRing : map(this->cqRingSize, IORING_OFF_CQ_RING);
+    this->sqesMapping = map(this->sqesSize, IORING_OFF_SQES);
+    if (this->sqRing == MAP_FAILED || this->cqRing == MAP_FAILED || this->sqesMapping == MAP_FAILED) {
+        if (this->sqRing != MAP_FAILED) ::munmap(this->sqRing, this->sqRingSize);
+        if (!singleMapping && this->cqRing != MAP_FAILED) ::munmap(this->cqRing, this->cqRingSize);
+        if (this->sqesMapping != MAP_FAILED) ::munmap(this->sqesMapping, this->sqesSize);
+        this->sqRing = this->cqRing = this->sqesMapping = nullptr;
+        ::close(fd);
+        return;
+    }
+    this->sqHead = ringField<unsigned>(this->sqRing, params.sq_off.head);
+    this->sqTail = ringField<unsigned>(this->sqRing, params.sq_off.tail);
+    this->sqMask = ringField<unsigned>(this->sqRing, params.sq_off.ring_mask);
+    this->sqArray = ringField<unsigned>(this->sqRing, params.sq_off.array);
+    this->cqHead = ringField<unsigned>(this->cqRing, params.cq_off.head);
+    this->cqTail = ringField<unsigned>(this->cqRing, params.cq_off.tail);
+    this->cqMask = ringField<unsigned>(this->cqRing, params.cq_off.ring_mask);
+    this->cqes = ringField<io_uring_cqe>(this->cqRing, params.cq_off.cqes);
+    this->entries = params.sq_entries;
+    this->iovecs.resize(this->entries);
+    this->ringFd = fd;
+}
+
+
+IoUringQueue::~IoUringQueue() {
+    if (!this->available()) return;
+    ::munmap(this->sqesMapping, this->sqesSize);
+    if (this->cqRing != this->sqRing) ::munmap(this->cqRing, this->cqRingSize);
+    ::munmap(this->sqRing, this->sqRingSize);
+    ::close(this->ringFd);
+}
+
+
+/**
+ * Executes requests in chunks of ring size, each chunk is submitted with single syscall and its completions are
+ * reaped as they come. Short reads are treated as end of file, short writes are completed synchronously.
+ */
+void IoUringQueue::execute(int fd, IoRequest *requests, size_t count) {
+    for (size_t i = 0; i < count; ++i) requests[i].result = 0;
+    for (size_t first = 0; first < count; first += this->entries) {
+        auto chunk = std::min<size_t>(this->entries, count - first);
+        this->submit(fd, requests, first, chunk);
+        auto completed = size_t{0};
+        while (completed < chunk) {
+            auto result = ioUringEnter(this->ringFd, 0, 1, IORING_ENTER_GETEVENTS);
+            if (result < 0 && errno != EINTR)
+                throw std::runtime_error(std::string("io_uring_enter failed: ") + std::strerror(errno));
+            completed += this->reap(fd, requests);
+        }
+        if (!this->error.empty()) throw std::runtime_error(std::exchange(this->error, {}));
+    }
+}
+
+
+void IoUringQueue::submit(int fd, IoRequest *requests, size_t first, size_t count) {
+    auto tail = *this->sqTail;
+    for (size_t i = 0; i < count; ++i, ++tail) {
+        auto &request = requests[first + i];
+        auto index = tail & *this->sqMask;
+        this->iovecs[index] = {request.data, request.size};
+        auto &sqe = static_cast<io_uring_sqe *>(this->sqesMapping)[index];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = request.type == IoRequest::Type::READ ? IORING_OP_READV : IORING_OP_WRITEV;
+        sqe.fd = fd;
+        sqe.off = request.offset;
+        sqe.addr = reinterpret_cast<uint64_t>(&this->iovecs[index]);
+        sqe.len = 1;
+        sqe.user_data = first + i;
+        this->sqArray[index] = index;
+    }
+    __atomic_store_n(this->sqTail, tail, __ATOMIC_RELEASE);
+    auto submitted = size_t{0};
+    while (submitted < count) {
+        auto result = ioUringEnter(this->ringFd, static_cast<unsigned>(count - submitted), 0, 0);
+        if (result < 0 && errno != EINTR)
+            throw std::runtime_error(std::string("io_uring_enter failed: ") + std::strerror(errno));
+        if (result > 0) submitted += static_cast<size_t>(result);
+    }
+}
+
+
+/**
+ * Consumes available completions
+ * @return number of requests which are finished
+ */
+size_t IoUringQueue::reap(int fd, IoRequest *requests) {
+    auto finished = size_t{0};
+    auto head = *this->cqHead;
+    auto tail = __atomic_load_n(this->cqTail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        auto const &cqe = static_cast<io_uring_cqe *>(this->cqes)[head & *this->cqMask];
+        auto &request = requests[cqe.user_data];
+        if (cqe.res < 0) {
+            // reported after whole chunk is reaped, so no stale completions are left in the ring
+            if (this->error.empty())
+                this->error = "Disk request at offset " + std::to_string(request.offset) + " failed: " +
+                              std::strerror(-cqe.res);
+            ++finished;
+            continue;
+        }
+        request.result += static_cast<size_t>(cqe.res);
+        auto remaining = request.size - request.result;
+        if (cqe.res == 0 || remaining == 0 || request.type == IoRequest::Type::READ) {
+            // short read means end of file
+            ++finished;
+            continue;
+        }
+        // short write, rest is written synchronously
+        while (request.result < request.size) {
+            auto written = ::pwrite(fd, request.data + request.result, request.size - request.result,
+                                    request.offset + request.result);
+            if (written < 0 && errno == EINTR) continue;
+            if (written <= 0) break;
+            request.result += static_cast<size_t>(written);
+        }
+        ++finished;
+    }
+    __atomic_store_n(this->cqHead, head, __ATOMIC_RELEASE);
+    return finished;
+}
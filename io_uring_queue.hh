@@ -0,0 +1,51 @@
+#ifndef SBD2_IO_URING_QUEUE_HH
+#define SBD2_IO_URING_QUEUE_HH
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <sys/uio.h>
+
+struct IoRequest;
+
+/**
+ * Minimal io_uring wrapper (raw syscalls, no liburing) executing batches of reads and writes on single file
+ */
+class IoUringQueue final {
+public:
+    static constexpr unsigned QueueDepth = 64;
+
+    IoUringQueue();
+    IoUringQueue(IoUringQueue const &) = delete;
+    IoUringQueue &operator=(IoUringQueue const &) = delete;
+    ~IoUringQueue();
+
+    bool available() const { return this->ringFd >= 0; }
+    void execute(int fd, IoRequest *requests, size_t count);
+
+private:
+    void submit(int fd, IoRequest *requests, size_t first, size_t count);
+    size_t reap(int fd, IoRequest *requests);
+
+    int ringFd = -1;
+    void *sqRing = nullptr;
+    void *cqRing = nullptr;
+    void *sqesMapping = nullptr;
+    size_t sqRingSize = 0;
+    size_t cqRingSize = 0;
+    size_t sqesSize = 0;
+    unsigned *sqHead = nullptr;
+    unsigned *sqTail = nullptr;
+    unsigned *sqMask = nullptr;
+    unsigned *sqArray = nullptr;
+    unsigned *cqHead = nullptr;
+    unsigned *cqTail = nullptr;
+    unsigned *cqMask = nullptr;
+    void *cqes = nullptr;
+    unsigned entries = 0;
+    std::vector<iovec> iovecs;
+    std::string error;
+};
+
+
+#endif //SBD2_IO_URING_QUEUE_HH
@@ -7,13 +7,20 @@
 
 #include <optional>
 #include <array>
+#include <cstring>
+#include <bit>
+#include <type_traits>
+#include <limits>
 #include "node.hh"
+#include "node_search.hh"
 
 template<typename TKey, typename TValue, size_t TDegree>
 class LeafNode final : public Node<TKey, TValue> {
     using Base = Node<TKey, TValue>;
-    using KeysCollection = std::array<std::optional<TKey>, 2 * TDegree>;
-    using ValuesCollection =  std::array<std::optional<TValue>, 2 * TDegree>;
+    // values are kept as their bytes, so TValue (e.g. Record) doesn't have to be default constructible
+    using ValueBytes = std::array<Byte, sizeof(TValue)>;
+    using KeysCollection = std::array<TKey, 2 * TDegree>;
+    using ValuesCollection = std::array<ValueBytes, 2 * TDegree>;
     using KeysIterator = typename KeysCollection::iterator;
     using ValuesIterator = typename ValuesCollection::iterator;
     using KeysValuesIterator = typename std::vector<std::pair<TKey, TValue>>::iterator;
@@ -23,78 +30,116 @@ class LeafNode final : public Node<TKey, TValue> {
     using ValuesRange = std::pair<ValuesIterator, ValuesIterator>;
     using KeysReverseRange = std::pair<KeysReverseIterator, KeysReverseIterator>;
     using ValuesReverseRange = std::pair<ValuesReverseIterator, ValuesReverseIterator>;
+    using RecordsCount = uint16_t;
+    static constexpr size_t LinksSize = 2 * sizeof(NodeOffset);
+
+    static_assert(2 * TDegree <= std::numeric_limits<RecordsCount>::max(), "Leaf degree is too big");
+    static_assert(std::is_trivially_copyable_v<TKey> && std::is_trivially_copyable_v<TValue>,
+                  "Keys and values are stored as their bytes");
 
     template<typename, typename, size_t, size_t> friend class BPlusTree;
 public:
-    LeafNode(size_t fileOffset, File &file, std::shared_ptr<Base> parent = nullptr) : Base(fileOffset, file, parent) {}
+    LeafNode(size_t fileOffset, File &file) : Base(fileOffset, file) {}
     ~LeafNode() override { this->unload(); }
 
 
-    static auto BytesSize() { return sizeof(KeysCollection) + sizeof(ValuesCollection); }
+    static constexpr auto BytesSize() {
+        return LinksSize + sizeof(TKey) + sizeof(RecordsCount) + 2 * TDegree * (sizeof(TKey) + sizeof(TValue))
+               + Base::ChecksumSize;
+    }
     auto insert(TKey const &key, TValue const &value) -> void;
     auto readRecord(TKey const &key) const -> std::optional<TValue>;
     auto updateRecord(TKey const &key, TValue const &value) -> void;
     auto deleteRecord(TKey const &) -> NodeState;
-    auto full() const -> bool override { return std::none_of(keys.begin(), keys.end(), [](auto x) { return !x; }); }
-    auto contains(TKey const &key) const -> bool override;
+    auto full() const -> bool override { return count == keys.size(); }
+    auto contains(TKey const &key) const -> bool override { return findKey(key) != count; }
     auto compensateWithAndReturnMiddleKey(std::shared_ptr<Base> node, TKey const *key,
                                           TValue const *value,
                                           size_t nodeOffset) -> TKey override;
 
     auto mergeWith(std::shared_ptr<Base> &other, TKey const *) -> void override;
     auto getRecords() const -> std::vector<std::pair<TKey, TValue>>;
-    auto getLastRecordIndex() const -> long;
-    auto getKeysRange() -> KeysRange;
+    auto getLastRecordIndex() const -> long { return static_cast<long>(count) - 1; }
+    auto getKeysRange() -> KeysRange { return {keys.begin(), keys.begin() + count}; }
     auto getKeysRangeReverse() -> KeysReverseRange;
-    auto getValuesRange() -> ValuesRange;
+    auto getValuesRange() -> ValuesRange { return {values.begin(), values.begin() + count}; }
     auto getValuesRangeReverse() -> ValuesReverseRange;
-    auto getLastKey() const { return *std::find_if(keys.rbegin(), keys.rend(), [](auto x) { return x; }); }
+    auto getLastKey() const { return count == 0 ? std::nullopt : std::optional<TKey>(keys[count - 1]); }
+    auto getKey(size_t index) const -> TKey const & { return keys[index]; }
+    auto getValue(size_t index) const -> TValue { return std::bit_cast<TValue>(values[index]); }
     auto setRecords(KeysValuesIterator it1, KeysValuesIterator it2) -> void;
-    auto fillKeysSize() const -> size_t override;
+    auto fillKeysSize() const -> size_t override { return count; }
     virtual size_t degree() { return TDegree; }
 
 
 private:
     auto print(std::stringstream &ss) -> std::stringstream & override;
     auto print(std::ostream &o) -> std::ostream & override;
-    auto deserialize(std::vector<Byte> const &bytes) -> void override;
-    auto getData() -> std::vector<Byte> override;
+    auto deserialize(Byte const *bytes) -> void override;
+    auto serializeData(Byte *bytes) -> void override;
+    auto findKey(TKey const &key) const -> size_t;
+    auto setValue(size_t index, TValue const &value) { values[index] = std::bit_cast<ValueBytes>(value); }
     auto elementsSize() const -> size_t override { return ElementsSize(); }
     auto bytesSize() const -> size_t override { return BytesSize(); }
     auto nodeType() const -> NodeType { return NodeType::LEAF; }
     constexpr auto ElementsSize() const noexcept { return this->keys.size() + this->values.size() + 1; }
 
 
+    // records are kept sorted at the beginning of arrays, the rest of arrays is unused
+    RecordsCount count = 0;
     KeysCollection keys{};
     ValuesCollection values{};
+    // neighbour leaves in order of keys, 0 if there is no such leaf (config header is always at 0)
+    NodeOffset nextLeafOffset{};
+    NodeOffset prevLeafOffset{};
+    // keys of leaf aren't greater than high key, it is meaningful only if leaf has next one (see InnerNode::highKey)
+    TKey highKey{};
 };
 
 
+/**
+ * Writes links, high key, records count, packed keys and packed values
+ */
 template<typename TKey, typename TValue, size_t TDegree>
-auto LeafNode<TKey, TValue, TDegree>::getData() -> std::vector<Byte> {
-    auto result = std::vector<Byte>();
-    auto keysByteArray = (std::array<Byte, sizeof(this->keys)> *) this->keys.data();
-    auto valuesByteArray = (std::array<Byte, sizeof(this->values)> *) (this->values.data());
-    result.reserve(keysByteArray->size() + valuesByteArray->size());
-    std::copy(keysByteArray->begin(), keysByteArray->end(), std::back_inserter(result));
-    std::copy(valuesByteArray->begin(), valuesByteArray->end(), std::back_inserter(result));
-    return std::move(result);
+auto LeafNode<TKey, TValue, TDegree>::serializeData(Byte *bytes) -> void {
+    std::memcpy(bytes, &this->nextLeafOffset, sizeof(NodeOffset));
+    std::memcpy(bytes + sizeof(NodeOffset), &this->prevLeafOffset, sizeof(NodeOffset));
+    bytes += LinksSize;
+    std::memcpy(bytes, &this->highKey, sizeof(TKey));
+    bytes += sizeof(TKey);
+    std::memcpy(bytes, &this->count, sizeof(this->count));
+    bytes += sizeof(this->count);
+    std::memcpy(bytes, this->keys.data(), this->count * sizeof(TKey));
+    bytes += this->count * sizeof(TKey);
+    std::memcpy(bytes, this->values.data(), this->count * sizeof(TValue));
+    bytes += this->count * sizeof(TValue);
+    std::fill_n(bytes, (2 * TDegree - this->count) * (sizeof(TKey) + sizeof(TValue)), 0);
 }
 
 
 template<typename TKey, typename TValue, size_t TDegree>
-auto LeafNode<TKey, TValue, TDegree>::deserialize(std::vector<Byte> const &bytes) -> void {
+auto LeafNode<TKey, TValue, TDegree>::deserialize(Byte const *bytes) -> void {
     this->changed = true;
-    auto valuesBytePtr = (std::array<Byte, sizeof(this->values)> *) this->values.data();
-    auto keysBytePtr = (std::array<Byte, sizeof(this->keys)> *) this->keys.data();
-    std::copy_n(bytes.begin(), keysBytePtr->size(), keysBytePtr->begin());
-    std::copy_n(bytes.begin() + keysBytePtr->size(), valuesBytePtr->size(), valuesBytePtr->begin());
+    std::memcpy(&this->nextLeafOffset, bytes, sizeof(NodeOffset));
+    std::memcpy(&this->prevLeafOffset, bytes + sizeof(NodeOffset), sizeof(NodeOffset));
+    bytes += LinksSize;
+    std::memcpy(&this->highKey, bytes, sizeof(TKey));
+    bytes += sizeof(TKey);
+    std::memcpy(&this->count, bytes, sizeof(this->count));
+    bytes += sizeof(this->count);
+    if (this->count > 2 * TDegree)
+        throw std::runtime_error("Invalid leaf at: " + std::to_string(this->fileOffset));
+    std::memcpy(this->keys.data(), bytes, this->count * sizeof(TKey));
+    bytes += this->count * sizeof(TKey);
+    std::memcpy(this->values.data(), bytes, this->count * sizeof(TValue));
 }
 
 
 template<typename TKey, typename TValue, size_t TDegree>
 auto LeafNode<TKey, TValue, TDegree>::print(std::ostream &o) -> std::ostream & {
-    o << "LNode: " << this->fileOffset << " { ";
+    o << "LNode: " << this->fileOffset << " <" << this->prevLeafOffset << ", " << this->nextLeafOffset << "> ";
+    if (this->nextLeafOffset != 0) o << "<= " << this->highKey << ' ';
+    o << "{ ";
     for (auto&[k, v] : this->getRecords())
         o << "<" << k << '>' << "(" << v << ')';
     return o << '}';
@@ -114,9 +159,13 @@ auto LeafNode<TKey, TValue, TDegree>::print(std::stringstream &ss) -> std::strin
 }
 
 
+/**
+ * @return index of record with given key or count if there is no such record
+ */
 template<typename TKey, typename TValue, size_t TDegree>
-auto LeafNode<TKey, TValue, TDegree>::fillKeysSize() const -> size_t {
-    return static_cast<size_t>(std::count_if(keys.begin(), keys.end(), [](auto x) { return x; }));
+auto LeafNode<TKey, TValue, TDegree>::findKey(TKey const &key) const -> size_t {
+    auto i = NodeSearch::LowerBound<2 * TDegree>(keys.data(), count, key);
+    return i < count && keys[i] == key ? i : count;
 }
 
 
@@ -124,49 +173,42 @@ template<typename TKey, typename TValue, size_t TDegree>
 auto LeafNode<TKey, TValue, TDegree>::insert(TKey const &key, TValue const &value) -> void {
     if (this->full()) throw std::runtime_error("Tried to add element to full node");
     this->markChanged();
-    auto[keysBeginReverse, keysEndReverse] = getKeysRangeReverse();
-    auto[keysBegin, keysEnd] = getKeysRange();
-    auto[valuesBeginReverse, valuesEndReverse] = getValuesRangeReverse();
-    auto i = std::upper_bound(keysBegin, keysEnd, key) - keysBegin;
-    std::move(keysBeginReverse, keysEndReverse - i, keysBeginReverse - 1);
+    auto i = NodeSearch::UpperBound<2 * TDegree>(keys.data(), count, key);
+    // records after inserted one are moved by one slot (memmove of trivially copyable elements)
+    std::copy_backward(keys.begin() + i, keys.begin() + count, keys.begin() + count + 1);
+    std::copy_backward(values.begin() + i, values.begin() + count, values.begin() + count + 1);
     keys[i] = key;
-    std::move(valuesBeginReverse, valuesEndReverse - i, valuesBeginReverse - 1);
-    values[i] = value;
+    this->setValue(i, value);
+    ++count;
 }
 
 
 template<typename TKey, typename TValue, size_t TDegree>
 auto LeafNode<TKey, TValue, TDegree>::readRecord(TKey const &key) const -> std::optional<TValue> {
-    for (int i = 0; i < keys.size(); ++i) {
-        if (keys[i] == std::nullopt) break;
-        if (keys[i] == key) return values[i];
-    }
-    return std::nullopt;
+    auto i = this->findKey(key);
+    if (i == count) return std::nullopt;
+    return this->getValue(i);
 }
 
 
 template<typename TKey, typename TValue, size_t TDegree>
 auto LeafNode<TKey, TValue, TDegree>::updateRecord(TKey const &key, TValue const &value) -> void {
-    for (int i = 0; i < keys.size(); ++i) {
-        if (keys[i] == std::nullopt) break;
-        if (keys[i] == key) {
-            values[i]->update(value);
-            this->markChanged();
-            return;
-        }
-    }
-    throw std::runtime_error("LeafNode->updateRecord: record with key: " + std::to_string(key) + " not found");
+    auto i = this->findKey(key);
+    if (i == count)
+        throw std::runtime_error("LeafNode->updateRecord: record with key: " + std::to_string(key) + " not found");
+    auto record = this->getValue(i);
+    record.update(value);
+    this->setValue(i, record);
+    this->markChanged();
 }
 
 
 template<typename TKey, typename TValue, size_t TDegree>
 auto LeafNode<TKey, TValue, TDegree>::getRecords() const -> std::vector<std::pair<TKey, TValue>> {
     auto result = std::vector<std::pair<TKey, TValue>>();
-    for (int i = 0; i < this->keys.size(); ++i) {
-        if (!this->keys[i]) return result;
-        result.emplace_back(*this->keys[i], *this->values[i]);
-    }
-    return std::move(result);
+    result.reserve(count);
+    for (size_t i = 0; i < count; ++i) result.emplace_back(this->keys[i], this->getValue(i));
+    return result;
 }
 
 
@@ -176,15 +218,11 @@ auto LeafNode<TKey, TValue, TDegree>::setRecords(KeysValuesIterator it1,
     if (std::distance(it1, it2) > this->keys.size())
         throw std::runtime_error("Internal DB error: too much records in node to set");
     this->markChanged();
-    auto keysI = keys.begin();
-    auto valuesI = values.begin();
-    std::for_each(it1, it2, [&keysI, &valuesI](auto x) {
-        *keysI++ = std::move(x.first);
-        *valuesI++ = std::move(x.second);
+    count = 0;
+    std::for_each(it1, it2, [this](auto const &x) {
+        keys[count] = x.first;
+        this->setValue(count++, x.second);
     });
-    std::fill(keysI, keys.end(), std::nullopt);
-    std::fill(valuesI, values.end(), std::nullopt);
-
 }
 
 
@@ -197,7 +235,7 @@ auto LeafNode<TKey, TValue, TDegree>::compensateWithAndReturnMiddleKey(std::shar
     if (node->nodeType() != NodeType::LEAF)
         throw std::runtime_error("Internal DB error: compensation failed, bad neighbour node type");
 
-    if (key != nullptr && (std::find(this->keys.begin(), this->keys.end(), *key) != this->keys.end()))
+    if (key != nullptr && this->contains(*key))
         throw std::runtime_error("Record with given key already exists");
 
 
@@ -229,43 +267,22 @@ auto LeafNode<TKey, TValue, TDegree>::compensateWithAndReturnMiddleKey(std::shar
 }
 
 
-template<typename TKey, typename TValue, size_t TDegree>
-auto LeafNode<TKey, TValue, TDegree>::contains(TKey const &key) const -> bool {
-    for (auto &element : keys) {
-        if (!element) return false;
-        if (*element == key) return true;
-    }
-    return false;
-}
-
-
-template<typename TKey, typename TValue, size_t TDegree>
-auto LeafNode<TKey, TValue, TDegree>::getLastRecordIndex() const -> long {
-    return std::distance(std::find_if(keys.rbegin(), keys.rend(), [](auto x) { return x; }), keys.rend()) - 1;
-}
-
-
 template<typename TKey, typename TValue, size_t TDegree>
 auto LeafNode<TKey, TValue, TDegree>::deleteRecord(TKey const &key) -> NodeState {
     NodeState result = NodeState::OK;
-    auto const lastRecordIndex = this->getLastRecordIndex();
-    auto const toDeleteRecordIndex = std::find(keys.begin(), keys.end(), key) - keys.begin();
-
-    // delete key
-    auto keysI = std::remove(keys.begin(), keys.end(), key);
-    // delete record
-    auto valuesI = std::move(values.begin() + toDeleteRecordIndex + 1, values.end(),
-                             values.begin() + toDeleteRecordIndex);
-
-    // fill empty space with std::nullopt
-    std::fill(keysI, keys.end(), std::nullopt);
-    std::fill(valuesI, values.end(), std::nullopt);
+    auto const toDeleteRecordIndex = this->findKey(key);
+    if (toDeleteRecordIndex == count)
+        throw std::runtime_error("LeafNode->deleteRecord: record with key: " + std::to_string(key) + " not found");
 
+    // records after deleted one are moved by one slot (memmove of trivially copyable elements)
+    std::copy(keys.begin() + toDeleteRecordIndex + 1, keys.begin() + count, keys.begin() + toDeleteRecordIndex);
+    std::copy(values.begin() + toDeleteRecordIndex + 1, values.begin() + count, values.begin() + toDeleteRecordIndex);
+    --count;
 
     // check if node contains valid number of elements
-    if (this->fillKeysSize() < TDegree)
+    if (count < TDegree)
         result = (NodeState) (result | NodeState::TOO_SMALL);
-    if (lastRecordIndex == toDeleteRecordIndex)
+    if (toDeleteRecordIndex == count)
         result = (NodeState) (result | NodeState::DELETED_LAST);
     this->markChanged();
     return result;
@@ -279,26 +296,14 @@ auto LeafNode<TKey, TValue, TDegree>::mergeWith(std::shared_ptr<Base> &other, TK
         throw std::runtime_error("Internal DB error: merge failed, bad neighbour other type");
 
     auto otherNode = std::dynamic_pointer_cast<LeafNode>(other);
-    auto[otherKeysBegin, otherKeysEnd] = otherNode->getKeysRange();
-    auto[otherValuesBegin, otherValuesEnd] = otherNode->getValuesRange();
+    if (count + otherNode->count > keys.size())
+        throw std::runtime_error("Internal DB error: merge failed, too much records");
 
     // move keys and values to the end of this node
-    std::move(otherKeysBegin, otherKeysEnd, this->getKeysRange().second);
-    std::move(otherValuesBegin, otherValuesEnd, this->getValuesRange().second);
+    std::copy_n(otherNode->keys.begin(), otherNode->count, keys.begin() + count);
+    std::copy_n(otherNode->values.begin(), otherNode->count, values.begin() + count);
+    count += otherNode->count;
     this->markChanged();
-    otherNode->remove();
-}
-
-
-template<typename TKey, typename TValue, size_t TDegree>
-auto LeafNode<TKey, TValue, TDegree>::getKeysRange() -> KeysRange {
-    return {keys.begin(), std::find_if(keys.rbegin(), keys.rend(), [](auto x) { return x; }).base()};
-}
-
-
-template<typename TKey, typename TValue, size_t TDegree>
-auto LeafNode<TKey, TValue, TDegree>::getValuesRange() -> ValuesRange {
-    return {values.begin(), std::find_if(values.rbegin(), values.rend(), [](auto x) { return x; }).base()};
 }
 
 
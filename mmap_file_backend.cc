@@ -0,0 +1,86 @@
+#include "mmap_file_backend.hh"
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+MmapFileBackend::MmapFileBackend(fs::path const &path, std::ios::openmode const &mode) {
+    auto flags = O_RDWR | O_CREAT;
+    if (mode & std::ios::trunc) flags |= O_TRUNC;
+    this->fd = ::open(path.c_str(), flags, 0644);
+    if (this->fd < 0) return;
+    struct stat fileStat{};
+    if (::fstat(this->fd, &fileStat) != 0) {
+        this->failed = true;
+        return;
+    }
+    this->fileSize = static_cast<size_t>(fileStat.st_size);
+    this->reserve(this->fileSize);
+}
+
+
+MmapFileBackend::~MmapFileBackend() {
+    if (this->mapping) ::munmap(this->mapping, this->capacity);
+    if (this->fd < 0) return;
+    // cut unused part of last chunk
+    if (::ftruncate(this->fd, this->fileSize) != 0) this->failed = true;
+    ::close(this->fd);
+}
+
+
+/**
+ * Makes sure that file and mapping are at least of given size
+ * @param size
+ */
+void MmapFileBackend::reserve(size_t size) {
+    if (size <= this->capacity || size == 0) return;
+    auto newCapacity = (size + GrowthChunk - 1) / GrowthChunk * GrowthChunk;
+    if (::ftruncate(this->fd, newCapacity) != 0) {
+        this->failed = true;
+        throw std::runtime_error("Unable to grow db file to " + std::to_string(newCapacity) + " bytes");
+    }
+    void *newMapping = this->mapping
+                       ? ::mremap(this->mapping, this->capacity, newCapacity, MREMAP_MAYMOVE)
+                       : ::mmap(nullptr, newCapacity, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
+    if (newMapping == MAP_FAILED) {
+        this->failed = true;
+        throw std::runtime_error("Unable to map db file of size " + std::to_string(newCapacity));
+    }
+    this->mapping = static_cast<char *>(newMapping);
+    this->capacity = newCapacity;
+}
+
+
+size_t MmapFileBackend::read(size_t offset, char *data, size_t size) {
+    auto[source, available] = this->view(offset, size);
+    if (available > 0) std::memcpy(data, source, available);
+    return available;
+}
+
+
+void MmapFileBackend::write(size_t offset, char const *data, size_t size) {
+    this->reserve(offset + size);
+    std::memcpy(this->mapping + offset, data, size);
+    this->fileSize = std::max(this->fileSize, offset + size);
+}
+
+
+std::pair<char const *, size_t> MmapFileBackend::view(size_t offset, size_t size) {
+    if (offset >= this->fileSize) return {this->mapping, 0};
+    return {this->mapping + offset, std::min(size, this->fileSize - offset)};
+}
+
+
+void MmapFileBackend::prefetch(size_t offset, size_t size) {
+    if (offset >= this->fileSize) return;
+    // madvise requires page aligned address
+    auto begin = offset / PageSize * PageSize;
+    ::madvise(this->mapping + begin, std::min(offset + size, this->fileSize) - begin, MADV_WILLNEED);
+}
+
+
+void MmapFileBackend::sync() {
+    if (this->mapping && ::msync(this->mapping, this->fileSize, MS_SYNC) != 0) this->failed = true;
+}
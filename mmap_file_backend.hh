@@ -0,0 +1,38 @@
+#ifndef SBD2_MMAP_FILE_BACKEND_HH
+#define SBD2_MMAP_FILE_BACKEND_HH
+
+#include "file.hh"
+
+/**
+ * Backend mapping whole db file into memory. File is grown in large chunks, so mapping has to be moved rarely,
+ * its size is set back to size of written data on close.
+ */
+class MmapFileBackend final : public FileBackend {
+public:
+    static constexpr size_t GrowthChunk = 16u << 20u;
+
+    MmapFileBackend(fs::path const &path, std::ios::openmode const &mode);
+    MmapFileBackend(MmapFileBackend const &) = delete;
+    MmapFileBackend &operator=(MmapFileBackend const &) = delete;
+    ~MmapFileBackend() override;
+
+    size_t read(size_t offset, char *data, size_t size) override;
+    void write(size_t offset, char const *data, size_t size) override;
+    std::pair<char const *, size_t> view(size_t offset, size_t size) override;
+    void sync() override;
+    void prefetch(size_t offset, size_t size) override;
+    size_t size() const override { return this->fileSize; }
+    bool bad() const override { return this->fd < 0 || this->failed; }
+
+private:
+    void reserve(size_t size);
+
+    int fd = -1;
+    char *mapping = nullptr;
+    size_t capacity = 0;
+    size_t fileSize = 0;
+    bool failed = false;
+};
+
+
+#endif //SBD2_MMAP_FILE_BACKEND_HH
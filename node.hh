@@ -9,10 +9,13 @@
 #include <memory>
 #include <iostream>
 #include <bitset>
-#include "dbms.hh"
+#include <span>
+#include <cstring>
+#include <atomic>
 #include "tools.hh"
+#include "crc32c.hh"
+#include "file.hh"
 
-class File;
 template<typename TKey, typename TValue> class Node;
 template<typename TKey, typename TValue, size_t TDegree> class InnerNode;
 template<typename TKey, typename TValue, size_t TDegree> class LeafNode;
@@ -42,8 +45,10 @@ class Node {
 
 
 public:
+    static constexpr size_t ChecksumSize = sizeof(uint32_t); // CRC32C stored at the end of node data
+
     Node() = delete;
-    Node(size_t fileOffset, File &file, std::shared_ptr<Node> parent = nullptr);
+    Node(size_t fileOffset, File &file);
     virtual ~Node();
 
 
@@ -59,31 +64,41 @@ public:
     virtual auto degree() -> size_t = 0;
     virtual auto fillKeysSize() const -> size_t = 0;
 
-    auto load(std::vector<char> const &bytes) -> void;
+    auto load(Byte const *bytes) -> void;
     auto unload() -> void;
+    auto unloadInto(std::span<Byte> bytes) -> void;
+    auto markUnloaded() { changed = false, loaded = true; };
     auto markEmpty() { changed = true, empty = true; };
     auto markChanged() { changed = true; };
 
     auto isChanged() const { return changed; }
     auto isLoaded() const { return loaded; }
 
-    static auto GetCurrentNodesCount() { return currentNodesCount; }
-    static auto GetMaxNodesCount() { return maxNodesCount; }
+    static auto GetCurrentNodesCount() -> uint64_t { return currentNodesCount; }
+    static auto GetMaxNodesCount() -> uint64_t { return maxNodesCount; }
     static auto ResetCounters() { maxNodesCount = currentNodesCount = 0; };
+    static auto ChecksumValid(Byte const *bytes, size_t size) -> bool;
 
 
-    std::shared_ptr<Node> parent;
+    Node *parent = nullptr; // set by descents of operation, nodes used by it are kept alive until it ends
     size_t fileOffset{};
+    NodeOffset nextFreeOffset{}; // next slot in free list, stored in place of data when node is empty
+    // set while node is changed by split which isn't committed yet, other writers wait until it is cleared
+    std::atomic<bool> splitPending = false;
 
 protected:
 
     virtual size_t elementsSize() const = 0;
     virtual size_t bytesSize() const = 0;
-    virtual std::vector<Byte> getData() = 0;
-    std::vector<Byte> serialize();
-    virtual auto deserialize(std::vector<Byte> const &bytes) -> void = 0;
+    virtual auto serializeData(Byte *bytes) -> void = 0;
+    auto serialize(std::span<Byte> bytes) -> void;
+    virtual auto deserialize(Byte const *bytes) -> void = 0;
     void remove();
-    void incCounter() { maxNodesCount = std::max(maxNodesCount, ++currentNodesCount); };
+    void incCounter() {
+        auto current = ++currentNodesCount;
+        auto max = maxNodesCount.load();
+        while (max < current && !maxNodesCount.compare_exchange_weak(max, current));
+    };
     void decCounter() { --currentNodesCount; };
 
     File &file;
@@ -91,16 +106,16 @@ protected:
     bool changed;
     bool loaded;
 
-    inline static uint64_t currentNodesCount = 0;
-    inline static uint64_t maxNodesCount = 0;
+    // nodes are created by all threads reading tree
+    inline static std::atomic<uint64_t> currentNodesCount = 0;
+    inline static std::atomic<uint64_t> maxNodesCount = 0;
 };
 
 
 
 template<typename TKey, typename TValue>
-Node<TKey, TValue>::Node(size_t const fileOffset, File &file, std::shared_ptr<Node> parent)
-        : file(file), fileOffset(fileOffset), parent(std::move(parent)), empty(false), changed(false),
-          loaded(false) {
+Node<TKey, TValue>::Node(size_t const fileOffset, File &file)
+        : file(file), fileOffset(fileOffset), empty(false), changed(false), loaded(false) {
     Tools::debug([this] { std::clog << "Created node: " << this->fileOffset << '\n'; }, 2);
     incCounter();
 }
@@ -122,23 +137,42 @@ auto Node<TKey, TValue>::remove() -> void {
 }
 
 
+/**
+ * Writes header byte followed by node data into buffer of size bytesSize() + 1, last ChecksumSize bytes of buffer
+ * are filled with checksum of the rest
+ */
 template<typename TKey, typename TValue>
-auto Node<TKey, TValue>::serialize() -> std::vector<char> {
-    auto result = std::vector<char>{};
-    auto size = this->bytesSize() + 1;
-    result.reserve(size);
+auto Node<TKey, TValue>::serialize(std::span<Byte> bytes) -> void {
     std::bitset<8> headerByte = 0;
     headerByte[0] = this->empty;
     headerByte[1] = static_cast<bool>(this->nodeType());
-    result.emplace_back(static_cast<uint8_t>(headerByte.to_ulong()));
-    auto data = this->getData();
-    std::copy(data.begin(), data.end(), std::back_inserter(result));
-    return result;
+    bytes[0] = static_cast<uint8_t>(headerByte.to_ulong());
+    if (this->empty) {
+        std::fill(bytes.begin() + 1, bytes.end(), 0);
+        std::memcpy(bytes.data() + 1, &this->nextFreeOffset, sizeof(NodeOffset));
+    } else {
+        this->serializeData(bytes.data() + 1);
+    }
+    auto checksum = Crc32c(bytes.data(), bytes.size() - ChecksumSize);
+    std::memcpy(bytes.data() + bytes.size() - ChecksumSize, &checksum, ChecksumSize);
 }
 
 
+/**
+ * @param bytes serialized node: header byte, node data and checksum
+ * @param size bytesSize() + 1 of node
+ * @return true if checksum stored in node matches its contents
+ */
 template<typename TKey, typename TValue>
-auto Node<TKey, TValue>::load(std::vector<char> const &bytes) -> void{
+auto Node<TKey, TValue>::ChecksumValid(Byte const *bytes, size_t size) -> bool {
+    uint32_t stored;
+    std::memcpy(&stored, bytes + size - ChecksumSize, ChecksumSize);
+    return Crc32c(bytes, size - ChecksumSize) == stored;
+}
+
+
+template<typename TKey, typename TValue>
+auto Node<TKey, TValue>::load(Byte const *bytes) -> void{
     Tools::debug([this] { std::clog << "Constructing node from bytes: " << this->fileOffset << '\n'; }, 3);
     this->deserialize(bytes);
     this->loaded = true;
@@ -153,14 +187,28 @@ auto Node<TKey, TValue>::unload() -> void{
         return;
     }
     Tools::debug([this] { std::clog << "Unloading node at: " << this->fileOffset << '\n'; }, 3);
-    auto bytes = this->serialize();
-    if (bytes.size() != this->bytesSize() + 1) {
+    // scratch buffer is reused by all unloads of the thread
+    thread_local std::vector<Byte> buffer;
+    buffer.resize(std::max(this->bytesSize() + 1, this->file.getPageSize()));
+    this->unloadInto(buffer);
+    this->file.writeFrom(this->fileOffset, buffer);
+    if (!this->file.good())Tools::debug([] { std::clog << "Error while writing node\n"; });
+    this->markUnloaded();
+}
+
+
+/**
+ * Serializes node into caller owned buffer to be written by caller (e.g. as part of batch),
+ * markUnloaded() should be called after writing
+ * @param bytes buffer of size bytesSize() + 1, or bigger one (e.g. whole page) which remaining part is zeroed
+ */
+template<typename TKey, typename TValue>
+auto Node<TKey, TValue>::unloadInto(std::span<Byte> bytes) -> void {
+    if (bytes.size() < this->bytesSize() + 1) {
         throw std::runtime_error("Sizes do not match");
     }
-    this->file.write(this->fileOffset, bytes);
-    if (!this->file.good())Tools::debug([] { std::clog << "Error while writing node\n"; });
-    this->changed = false;
-    this->loaded = true;
+    this->serialize(bytes.first(this->bytesSize() + 1));
+    std::fill(bytes.begin() + this->bytesSize() + 1, bytes.end(), 0);
 }
 
 
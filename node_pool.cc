@@ -0,0 +1,67 @@
+#include "node_pool.hh"
+#include <algorithm>
+#include <new>
+#include <cstdlib>
+#include <sys/mman.h>
+
+
+BlockPool::BlockPool(size_t blockSize, size_t alignment)
+        : blockSize(std::max(blockSize, sizeof(FreeBlock))), alignment(std::max(alignment, alignof(FreeBlock))) {
+    // released block keeps pointer to next free one, blocks follow each other in chunk
+    this->blockSize = (this->blockSize + this->alignment - 1) / this->alignment * this->alignment;
+}
+
+
+/**
+ * @return block from free list, or next unused block of chunk (new chunk is taken if the last one is used up)
+ */
+auto BlockPool::allocate() -> void * {
+    std::lock_guard lock(this->mutex);
+    ++allocationsCount;
+    if (auto block = this->freeBlocks) {
+        ++reusesCount;
+        this->freeBlocks = block->next;
+        return block;
+    }
+    if (this->chunkPosition == this->chunkEnd) this->allocateChunk();
+    auto block = this->chunkPosition;
+    this->chunkPosition += this->blockSize;
+    return block;
+}
+
+
+/**
+ * Puts block on free list, it is handed out by the next allocation
+ * @param block block returned by allocate
+ */
+auto BlockPool::deallocate(void *block) -> void {
+    std::lock_guard lock(this->mutex);
+    this->freeBlocks = new(block) FreeBlock{this->freeBlocks};
+}
+
+
+/**
+ * Takes chunk for at least MinChunkBlocks blocks from heap. Chunks used with huge pages are aligned to huge page,
+ * advice is ignored if kernel doesn't support them
+ */
+auto BlockPool::allocateChunk() -> void {
+    auto const useHugePages = hugePages.load();
+    auto const granularity = useHugePages ? HugePageSize : ChunkSize;
+    auto const size = (this->blockSize * MinChunkBlocks + granularity - 1) / granularity * granularity;
+    auto const chunkAlignment = std::max(this->alignment, useHugePages ? HugePageSize : alignof(std::max_align_t));
+    auto chunk = static_cast<std::byte *>(std::aligned_alloc(chunkAlignment, size));
+    if (!chunk) throw std::bad_alloc();
+    if (useHugePages) madvise(chunk, size, MADV_HUGEPAGE);
+    reservedBytes += size;
+    ++chunksCount;
+    this->chunkPosition = chunk;
+    this->chunkEnd = chunk + size / this->blockSize * this->blockSize;
+}
+
+
+/**
+ * @return counters summed over all pools
+ */
+auto BlockPool::GetStats() -> NodePoolStats {
+    return {reservedBytes, chunksCount, allocationsCount, reusesCount};
+}
@@ -0,0 +1,92 @@
+#ifndef SBD2_NODE_POOL_HH
+#define SBD2_NODE_POOL_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <memory>
+
+struct NodePoolStats {
+    uint64_t reservedBytes = 0; // memory of chunks taken from heap, it is never returned
+    uint64_t chunksCount = 0; // heap allocations done by pools
+    uint64_t allocationsCount = 0; // blocks handed out by pools
+    uint64_t reusesCount = 0; // blocks handed out from free lists
+};
+
+/**
+ * Free list of memory blocks of one size. Blocks are carved from chunks taken from heap (backed by transparent huge
+ * pages if they are enabled), released blocks are kept for next allocations, so once pool holds as many blocks as
+ * program uses at once, allocating them doesn't touch heap.
+ * Pools live until program exits, blocks may be released by destructors of static objects
+ */
+class BlockPool final {
+public:
+    static constexpr size_t HugePageSize = 2u << 20u;
+    static constexpr size_t ChunkSize = 64u << 10u; // used when huge pages are disabled
+    static constexpr size_t MinChunkBlocks = 8;
+
+    BlockPool(size_t blockSize, size_t alignment);
+    BlockPool(BlockPool const &) = delete;
+    BlockPool &operator=(BlockPool const &) = delete;
+
+    auto allocate() -> void *;
+    auto deallocate(void *block) -> void;
+
+    static auto UseHugePages(bool enabled) -> void { hugePages = enabled; }
+    static auto GetStats() -> NodePoolStats;
+
+private:
+    struct FreeBlock { FreeBlock *next; };
+
+    auto allocateChunk() -> void;
+
+    size_t blockSize;
+    size_t alignment;
+    std::mutex mutex; // blocks are allocated and released by all threads reading tree
+    FreeBlock *freeBlocks = nullptr;
+    std::byte *chunkPosition = nullptr; // part of the last chunk which wasn't handed out yet
+    std::byte *chunkEnd = nullptr;
+
+    inline static std::atomic<bool> hugePages = false;
+    inline static std::atomic<uint64_t> reservedBytes = 0;
+    inline static std::atomic<uint64_t> chunksCount = 0;
+    inline static std::atomic<uint64_t> allocationsCount = 0;
+    inline static std::atomic<uint64_t> reusesCount = 0;
+};
+
+
+/**
+ * Allocator taking single objects of type T from pool of its own (arrays come from heap). It is used by
+ * std::allocate_shared for nodes (object and control block are one block) and by containers changed by every
+ * operation, which rebind it to their internal nodes
+ */
+template<typename T>
+class PoolAllocator {
+public:
+    using value_type = T;
+
+    PoolAllocator() noexcept = default;
+    template<typename U> PoolAllocator(PoolAllocator<U> const &) noexcept {}
+
+    auto allocate(size_t n) -> T * {
+        if (n != 1) return std::allocator<T>().allocate(n);
+        return static_cast<T *>(Pool().allocate());
+    }
+    auto deallocate(T *object, size_t n) -> void {
+        if (n != 1) return std::allocator<T>().deallocate(object, n);
+        Pool().deallocate(object);
+    }
+
+    template<typename U> auto operator==(PoolAllocator<U> const &) const noexcept { return true; }
+
+private:
+    static auto Pool() -> BlockPool & {
+        // never destroyed, objects held by static ones may be released after pools would be destroyed
+        static auto *pool = new BlockPool(sizeof(T), alignof(T));
+        return *pool;
+    }
+};
+
+
+#endif //SBD2_NODE_POOL_HH
@@ -0,0 +1,91 @@
+#include "node_search.hh"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+
+namespace {
+    using Kernel = auto (*)(int64_t const *keys, size_t count, int64_t key) -> size_t;
+
+    template<bool TOrEqual>
+    auto countScalar(int64_t const *keys, size_t count, int64_t key) -> size_t {
+        size_t result = 0;
+        for (size_t i = 0; i < count; ++i) result += TOrEqual ? keys[i] <= key : keys[i] < key;
+        return result;
+    }
+
+#if defined(__x86_64__)
+    // kernels are compiled for given instruction set regardless of build flags, used only if CPU supports it
+    template<bool TOrEqual>
+    __attribute__((target("avx2")))
+    auto countAvx2(int64_t const *keys, size_t count, int64_t key) -> size_t {
+        auto needle = _mm256_set1_epi64x(key);
+        size_t result = 0, i = 0;
+        for (; i + 4 <= count; i += 4) {
+            auto block = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(keys + i));
+            // key <= needle is counted as !(key > needle)
+            auto mask = TOrEqual ? ~_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(block, needle))) & 0xf
+                                 : _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(needle, block)));
+            result += __builtin_popcount(mask);
+        }
+        return result + countScalar<TOrEqual>(keys + i, count - i, key);
+    }
+
+
+    template<bool TOrEqual>
+    __attribute__((target("sse4.2")))
+    auto countSse42(int64_t const *keys, size_t count, int64_t key) -> size_t {
+        auto needle = _mm_set1_epi64x(key);
+        size_t result = 0, i = 0;
+        for (; i + 2 <= count; i += 2) {
+            auto block = _mm_loadu_si128(reinterpret_cast<__m128i const *>(keys + i));
+            auto mask = TOrEqual ? ~_mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(block, needle))) & 0x3
+                                 : _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpgt_epi64(needle, block)));
+            result += __builtin_popcount(mask);
+        }
+        return result + countScalar<TOrEqual>(keys + i, count - i, key);
+    }
+#endif
+
+
+    template<bool TOrEqual>
+    auto chooseKernel() -> Kernel {
+#if defined(__x86_64__)
+        if (__builtin_cpu_supports("avx2")) return countAvx2<TOrEqual>;
+        if (__builtin_cpu_supports("sse4.2")) return countSse42<TOrEqual>;
+#endif
+        return countScalar<TOrEqual>;
+    }
+}
+
+
+/**
+ * @return number of keys less than given one
+ */
+auto NodeSearch::CountLess(int64_t const *keys, size_t count, int64_t key) -> size_t {
+    static Kernel const kernel = chooseKernel<false>();
+    return kernel(keys, count, key);
+}
+
+
+/**
+ * @return number of keys less than or equal to given one
+ */
+auto NodeSearch::CountLessOrEqual(int64_t const *keys, size_t count, int64_t key) -> size_t {
+    static Kernel const kernel = chooseKernel<true>();
+    return kernel(keys, count, key);
+}
+
+
+/**
+ * @return name of instruction set used by linear search
+ */
+auto NodeSearch::KernelName() -> char const * {
+    auto kernel = chooseKernel<false>();
+#if defined(__x86_64__)
+    if (kernel == countAvx2<false>) return "AVX2";
+    if (kernel == countSse42<false>) return "SSE4.2";
+#endif
+    return "scalar";
+}
@@ -0,0 +1,70 @@
+#ifndef SBD2_NODE_SEARCH_HH
+#define SBD2_NODE_SEARCH_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+/**
+ * Search of key position in dense, sorted array of keys of node. Small nodes of int64_t keys are searched by counting
+ * smaller keys with SIMD compares (AVX2 or SSE4.2, picked at runtime), other ones by branchless binary search.
+ * Kind of search is picked at compile time from max number of keys in node.
+ */
+namespace NodeSearch {
+    // nodes with at most this number of keys are searched linearly
+    constexpr size_t LinearSearchMaxKeys = 32;
+
+    auto CountLess(int64_t const *keys, size_t count, int64_t key) -> size_t;
+    auto CountLessOrEqual(int64_t const *keys, size_t count, int64_t key) -> size_t;
+    auto KernelName() -> char const *;
+
+
+    /**
+     * @tparam TOrEqual if true, position after keys equal to given one is searched
+     * @return index of first key not less (greater if TOrEqual) than given one, count if there is no such key
+     */
+    template<bool TOrEqual, typename TKey>
+    auto BranchlessBinarySearch(TKey const *keys, size_t count, TKey const &key) -> size_t {
+        if (count == 0) return 0;
+        auto base = keys;
+        // half of remaining range is skipped by conditional move instead of jump
+        for (auto n = count; n > 1; n -= n / 2) {
+            auto const &middle = base[n / 2];
+            base = (TOrEqual ? !(key < middle) : middle < key) ? base + n / 2 : base;
+        }
+        return (base - keys) + (TOrEqual ? !(key < *base) : *base < key);
+    }
+
+
+    template<bool TOrEqual, size_t TMaxKeys, typename TKey>
+    auto Search(TKey const *keys, size_t count, TKey const &key) -> size_t {
+        if constexpr (std::is_same_v<TKey, int64_t> && TMaxKeys <= LinearSearchMaxKeys) {
+            return TOrEqual ? CountLessOrEqual(keys, count, key) : CountLess(keys, count, key);
+        } else {
+            return BranchlessBinarySearch<TOrEqual>(keys, count, key);
+        }
+    }
+
+
+    /**
+     * Equivalent of std::lower_bound for node holding at most TMaxKeys keys
+     * @return index of first key not less than given one
+     */
+    template<size_t TMaxKeys, typename TKey>
+    auto LowerBound(TKey const *keys, size_t count, TKey const &key) -> size_t {
+        return Search<false, TMaxKeys>(keys, count, key);
+    }
+
+
+    /**
+     * Equivalent of std::upper_bound for node holding at most TMaxKeys keys
+     * @return index of first key greater than given one
+     */
+    template<size_t TMaxKeys, typename TKey>
+    auto UpperBound(TKey const *keys, size_t count, TKey const &key) -> size_t {
+        return Search<true, TMaxKeys>(keys, count, key);
+    }
+}
+
+
+#endif //SBD2_NODE_SEARCH_HH
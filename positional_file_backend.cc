@@ -0,0 +1,75 @@
+#include "positional_file_backend.hh"
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+
+PositionalFileBackend::PositionalFileBackend(fs::path const &path, std::ios::openmode const &mode, int extraFlags) {
+    auto flags = O_RDWR | O_CREAT | extraFlags;
+    if (mode & std::ios::trunc) flags |= O_TRUNC;
+    this->fd = ::open(path.c_str(), flags, 0644);
+    if (this->fd < 0) return;
+    struct stat fileStat{};
+    if (::fstat(this->fd, &fileStat) != 0) {
+        this->failed = true;
+        return;
+    }
+    this->fileSize = static_cast<size_t>(fileStat.st_size);
+}
+
+
+PositionalFileBackend::~PositionalFileBackend() {
+    if (this->fd >= 0) ::close(this->fd);
+}
+
+
+size_t PositionalFileBackend::read(size_t offset, char *data, size_t size) {
+    auto request = IoRequest{IoRequest::Type::READ, offset, data, size};
+    this->execute(request);
+    return request.result;
+}
+
+
+void PositionalFileBackend::write(size_t offset, char const *data, size_t size) {
+    auto request = IoRequest{IoRequest::Type::WRITE, offset, const_cast<char *>(data), size};
+    this->execute(request);
+}
+
+
+void PositionalFileBackend::sync() {
+    if (::fdatasync(this->fd) != 0) this->failed = true;
+}
+
+
+void PositionalFileBackend::prefetch(size_t offset, size_t size) {
+    // kernel starts reading range into page cache and returns immediately
+    ::posix_fadvise(this->fd, static_cast<off_t>(offset), static_cast<off_t>(size), POSIX_FADV_WILLNEED);
+}
+
+
+/**
+ * Synchronously executes single request, retrying on interrupts and partial transfers
+ */
+void PositionalFileBackend::execute(IoRequest &request) {
+    request.result = 0;
+    while (request.result < request.size) {
+        auto data = request.data + request.result;
+        auto size = request.size - request.result;
+        auto offset = static_cast<off_t>(request.offset + request.result);
+        auto transferred = request.type == IoRequest::Type::READ
+                           ? ::pread(this->fd, data, size, offset)
+                           : ::pwrite(this->fd, data, size, offset);
+        if (transferred < 0 && errno == EINTR) continue;
+        if (transferred < 0) this->failed = true;
+        if (transferred <= 0) break;
+        request.result += static_cast<size_t>(transferred);
+    }
+    if (request.type == IoRequest::Type::WRITE) this->updateSize(request.offset + request.result);
+}
+
+
+void PositionalFileBackend::updateSize(size_t end) {
+    auto current = this->fileSize.load();
+    while (current < end && !this->fileSize.compare_exchange_weak(current, end));
+}
@@ -0,0 +1,35 @@
+#ifndef SBD2_POSITIONAL_FILE_BACKEND_HH
+#define SBD2_POSITIONAL_FILE_BACKEND_HH
+
+#include "file.hh"
+#include <atomic>
+
+/**
+ * Backend using pread/pwrite on raw file descriptor. There is no shared file position, so reads
+ * (and writes of distinct ranges) can be executed from multiple threads concurrently.
+ */
+class PositionalFileBackend : public FileBackend {
+public:
+    PositionalFileBackend(fs::path const &path, std::ios::openmode const &mode, int extraFlags = 0);
+    PositionalFileBackend(PositionalFileBackend const &) = delete;
+    PositionalFileBackend &operator=(PositionalFileBackend const &) = delete;
+    ~PositionalFileBackend() override;
+
+    size_t read(size_t offset, char *data, size_t size) override;
+    void write(size_t offset, char const *data, size_t size) override;
+    void sync() override;
+    void prefetch(size_t offset, size_t size) override;
+    size_t size() const override { return this->fileSize; }
+    bool bad() const override { return this->fd < 0 || this->failed; }
+
+protected:
+    void execute(IoRequest &request);
+    void updateSize(size_t end);
+
+    int fd = -1;
+    std::atomic<size_t> fileSize = 0;
+    std::atomic<bool> failed = false;
+};
+
+
+#endif //SBD2_POSITIONAL_FILE_BACKEND_HH
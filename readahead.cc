@@ -0,0 +1,95 @@
+#include "readahead.hh"
+#include <algorithm>
+
+
+namespace {
+    auto alignDown(size_t offset) -> size_t { return offset / PageSize * PageSize; }
+
+    auto alignUp(size_t offset) -> size_t { return alignDown(offset + PageSize - 1); }
+}
+
+
+Readahead::Readahead(File &file, ReadaheadStats *stats, size_t maxWindow)
+        : file(file), stats(stats), maxWindow(std::max(maxWindow, MinWindow)) {}
+
+
+Readahead::~Readahead() {
+    this->drop();
+}
+
+
+/**
+ * Registers read of node done by scan, prefetches next pages if scan is sequential
+ * @param offset offset of read node
+ * @param size size of read node
+ */
+auto Readahead::access(size_t offset, size_t size) -> void {
+    if (this->stats && offset >= this->prefetchedBegin && offset + size <= this->prefetchedEnd) ++this->stats->hits;
+    if (!this->accessed || !this->sequential(offset, size)) {
+        this->drop();
+    } else if (this->direction == 0) {
+        this->direction = offset > this->lastBegin ? 1 : -1;
+    }
+    this->accessed = true;
+    this->lastBegin = offset;
+    this->lastEnd = offset + size;
+    if (this->direction != 0) this->prefetch();
+}
+
+
+/**
+ * @return true if node follows previously read one in direction of scan, gaps smaller than window
+ * (e.g. inner nodes placed between leaves) are allowed
+ */
+auto Readahead::sequential(size_t offset, size_t size) const -> bool {
+    auto maxGap = this->window * PageSize;
+    if (this->direction >= 0 && offset >= this->lastEnd && offset - this->lastEnd <= maxGap) return true;
+    return this->direction <= 0 && offset + size <= this->lastBegin && this->lastBegin - (offset + size) <= maxGap;
+}
+
+
+/**
+ * Prefetches next window of pages once less than half of window is left ahead of scan
+ */
+auto Readahead::prefetch() -> void {
+    auto empty = this->prefetchedEnd == 0;
+    size_t begin, end;
+    if (this->direction > 0) {
+        auto ahead = empty || this->prefetchedEnd <= this->lastEnd ? 0 : this->prefetchedEnd - this->lastEnd;
+        if (ahead >= this->window * PageSize / 2) return;
+        // scan reached prefetched pages, so bigger window is going to be used as well
+        if (!empty) this->window = std::min(2 * this->window, this->maxWindow);
+        begin = std::max(this->prefetchedEnd, alignUp(this->lastEnd));
+        end = std::min(begin + this->window * PageSize, alignUp(this->file.size()));
+    } else {
+        auto ahead = empty || this->prefetchedBegin >= this->lastBegin ? 0 : this->lastBegin - this->prefetchedBegin;
+        if (ahead >= this->window * PageSize / 2) return;
+        if (!empty) this->window = std::min(2 * this->window, this->maxWindow);
+        end = empty ? alignDown(this->lastBegin) : std::min(this->prefetchedBegin, alignDown(this->lastBegin));
+        begin = end > this->window * PageSize ? end - this->window * PageSize : 0;
+    }
+    if (begin >= end) return;
+    this->file.prefetch(begin, end - begin);
+    if (this->stats) this->stats->prefetchedPages += (end - begin) / PageSize;
+    this->prefetchedBegin = empty ? begin : std::min(this->prefetchedBegin, begin);
+    this->prefetchedEnd = empty ? end : std::max(this->prefetchedEnd, end);
+}
+
+
+/**
+ * Forgets prefetched pages counting ones which weren't reached by scan as wasted, window is reset
+ */
+auto Readahead::drop() -> void {
+    if (this->stats && this->prefetchedEnd != 0) {
+        if (this->direction > 0) {
+            auto reached = std::max(this->prefetchedBegin, alignUp(this->lastEnd));
+            if (this->prefetchedEnd > reached) this->stats->wastedPages += (this->prefetchedEnd - reached) / PageSize;
+        } else {
+            auto reached = std::min(this->prefetchedEnd, alignDown(this->lastBegin));
+            if (reached > this->prefetchedBegin) this->stats->wastedPages += (reached - this->prefetchedBegin) / PageSize;
+        }
+    }
+    this->prefetchedBegin = this->prefetchedEnd = 0;
+    this->window = MinWindow;
+    this->direction = 0;
+}
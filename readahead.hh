@@ -0,0 +1,48 @@
+#ifndef SBD2_READAHEAD_HH
+#define SBD2_READAHEAD_HH
+
+#include <cstdint>
+#include "file.hh"
+
+struct ReadaheadStats {
+    uint64_t prefetchedPages = 0;
+    uint64_t hits = 0; // node reads from pages which were prefetched
+    uint64_t wastedPages = 0; // prefetched pages which scan didn't reach
+};
+
+/**
+ * Recognises sequential reads of nodes done by scan and asks file to fetch pages ahead of it.
+ * Window is doubled every time scan gets close to end of prefetched pages (so they are ready before they are
+ * needed) and is reset when access is not sequential. Scans in both directions are recognised.
+ */
+class Readahead final {
+public:
+    static constexpr size_t MinWindow = 4; // pages
+
+    Readahead(File &file, ReadaheadStats *stats, size_t maxWindow);
+    Readahead(Readahead const &) = delete;
+    Readahead &operator=(Readahead const &) = delete;
+    ~Readahead();
+
+    auto access(size_t offset, size_t size) -> void;
+
+private:
+    auto sequential(size_t offset, size_t size) const -> bool;
+    auto prefetch() -> void;
+    auto drop() -> void;
+
+    File &file;
+    ReadaheadStats *stats; // nothing is counted if nullptr
+    size_t maxWindow;
+    size_t window = MinWindow;
+    int direction = 0; // 1 - forward, -1 - backward, 0 - pattern not recognised yet
+    bool accessed = false;
+    size_t lastBegin = 0;
+    size_t lastEnd = 0;
+    // page aligned range which was prefetched
+    size_t prefetchedBegin = 0;
+    size_t prefetchedEnd = 0;
+};
+
+
+#endif //SBD2_READAHEAD_HH
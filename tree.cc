@@ -0,0 +1,134 @@
+#include "tree.hh"
+#include <sstream>
+
+
+namespace {
+    // Degrees of nodes which can be used by db files, BPlusTree is instantiated for every pair of them.
+    // The largest ones make nodes fill whole page of paged file.
+    constexpr std::array InnerNodeDegrees{size_t{2}, size_t{4}, size_t{16}, size_t{64},
+                                          InnerDegreeForPage<int64_t>(PageSize)};
+    constexpr std::array LeafNodeDegrees{size_t{3}, size_t{4}, size_t{16}, size_t{64},
+                                         LeafDegreeForPage<int64_t, Record>(PageSize)};
+
+    struct Instantiation {
+        size_t innerNodeDegree;
+        size_t leafNodeDegree;
+        auto (*make)(fs::path const &filePath, OpenMode openMode, TreeOptions const &options) -> std::unique_ptr<Tree>;
+        auto (*readOlderFile)(fs::path const &filePath, Tree::RecordConsumer const &consumer) -> void;
+    };
+
+
+    template<size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+    constexpr auto MakeInstantiation() -> Instantiation {
+        using ATree = TypedTree<TInnerNodeDegree, TLeafNodeDegree>;
+        return {
+                TInnerNodeDegree, TLeafNodeDegree,
+                [](fs::path const &filePath, OpenMode openMode, TreeOptions const &options) -> std::unique_ptr<Tree> {
+                    return std::make_unique<ATree>(filePath, openMode, options);
+                },
+                [](fs::path const &filePath, Tree::RecordConsumer const &consumer) {
+                    ATree::BTreeType::ReadOlderFile(filePath, consumer);
+                }
+        };
+    }
+
+
+    template<size_t... Indices>
+    constexpr auto MakeInstantiations(std::index_sequence<Indices...>) {
+        constexpr auto LeafDegreesCount = LeafNodeDegrees.size();
+        return std::array{MakeInstantiation<InnerNodeDegrees[Indices / LeafDegreesCount],
+                LeafNodeDegrees[Indices % LeafDegreesCount]>()...};
+    }
+
+
+    constexpr auto Instantiations =
+            MakeInstantiations(std::make_index_sequence<InnerNodeDegrees.size() * LeafNodeDegrees.size()>());
+
+
+    /**
+     * @return instantiation of tree for given degrees, throws if there is no such one
+     */
+    auto FindInstantiation(size_t innerNodeDegree, size_t leafNodeDegree) -> Instantiation const & {
+        for (auto const &instantiation : Instantiations) {
+            if (instantiation.innerNodeDegree == innerNodeDegree && instantiation.leafNodeDegree == leafNodeDegree)
+                return instantiation;
+        }
+        std::stringstream ss;
+        ss << "Degrees of nodes: <" << innerNodeDegree << ", " << leafNodeDegree << "> are not supported.\n"
+           << "Supported inner node degrees:";
+        for (auto degree : InnerNodeDegrees) ss << ' ' << degree;
+        ss << "\nSupported leaf node degrees:";
+        for (auto degree : LeafNodeDegrees) ss << ' ' << degree;
+        throw std::runtime_error(ss.str());
+    }
+}
+
+
+/**
+ * Opens existing db file using tree instantiated for degrees of nodes stored in it
+ * @param filePath
+ * @param options
+ * @return opened tree
+ */
+auto Tree::Open(fs::path const &filePath, TreeOptions const &options) -> std::unique_ptr<Tree> {
+    auto [innerNodeDegree, leafNodeDegree] = ReadDegrees(filePath);
+    return FindInstantiation(innerNodeDegree, leafNodeDegree).make(filePath, OpenMode::USE_EXISTING, options);
+}
+
+
+/**
+ * Creates new db file with nodes of given degrees
+ * @param filePath
+ * @param innerNodeDegree
+ * @param leafNodeDegree
+ * @param options
+ * @return created tree
+ */
+auto Tree::Create(fs::path const &filePath, size_t innerNodeDegree, size_t leafNodeDegree,
+                  TreeOptions const &options) -> std::unique_ptr<Tree> {
+    return FindInstantiation(innerNodeDegree, leafNodeDegree).make(filePath, OpenMode::CREATE_NEW, options);
+}
+
+
+/**
+ * Reads degrees of nodes from config header of db file. Log left by interrupted session is recovered first,
+ * header of file which was just created may be only there. The first superblock of shadow file could be torn by
+ * crash, degrees are the same in the second one
+ * @param filePath
+ * @return inner and leaf node degree
+ */
+auto Tree::ReadDegrees(fs::path const &filePath) -> std::pair<size_t, size_t> {
+    if (!fs::is_regular_file(filePath))
+        throw std::runtime_error("Couldn't open file: " + fs::absolute(filePath).string() + '\n');
+    auto file = File(filePath, std::ios::binary | std::ios::out | std::ios::in | std::ios::ate, [] {}, [] {});
+    if (file.bad())
+        throw std::runtime_error("Couldn't open file: " + fs::absolute(filePath).string() + '\n');
+    if (auto recovered = WriteAheadLog::Recover(WriteAheadLog::PathFor(filePath), file))
+        std::cout << "Recovered " << recovered << " operations from log\n";
+    auto configHeader = file.read<ConfigHeader>(0);
+    if (!file.good())
+        throw std::runtime_error("File is too short to be db file: " + fs::absolute(filePath).string());
+    if (!file.read<Superblock>(0).valid()) {
+        for (auto offset : {Superblock::SlotSize, PageSize}) {
+            auto superblock = file.read<Superblock>(offset);
+            file.clear();
+            if (superblock.valid()) {
+                configHeader = superblock.configHeader;
+                break;
+            }
+        }
+    }
+    return {configHeader.innerNodeDegree, configHeader.leafNodeDegree};
+}
+
+
+/**
+ * Reads all records of db file created by older version of program, see BPlusTree::ReadOlderFile
+ * @param filePath
+ * @param consumer called for every record in order by key
+ */
+auto Tree::ReadOlderFile(fs::path const &filePath, RecordConsumer const &consumer) -> void {
+    auto [innerNodeDegree, leafNodeDegree] = ReadDegrees(filePath);
+    FindInstantiation(innerNodeDegree, leafNodeDegree).readOlderFile(filePath, consumer);
+}
+
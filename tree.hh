@@ -0,0 +1,222 @@
+#ifndef SBD2_TREE_HH
+#define SBD2_TREE_HH
+
+#include <memory>
+#include <functional>
+#include "b_plus_tree.hh"
+#include "record.hh"
+
+/**
+ * Db file opened by program, degrees of its nodes are known only at runtime. Every supported pair of degrees has
+ * its own instantiation of BPlusTree, interface only forwards calls to it, so operations on tree stay templated
+ */
+class Tree {
+public:
+    using ANode = Node<int64_t, Record>;
+    using RecordConsumer = std::function<void(int64_t const &key, Record const &value)>;
+    // returns successive records, nullopt after the last one
+    using RecordsSource = std::function<std::optional<std::pair<int64_t, Record>>()>;
+
+    virtual ~Tree() = default;
+
+    static auto Open(fs::path const &filePath, TreeOptions const &options) -> std::unique_ptr<Tree>;
+    static auto Create(fs::path const &filePath, size_t innerNodeDegree, size_t leafNodeDegree,
+                       TreeOptions const &options) -> std::unique_ptr<Tree>;
+    static auto ReadDegrees(fs::path const &filePath) -> std::pair<size_t, size_t>;
+    static auto ReadOlderFile(fs::path const &filePath, RecordConsumer const &consumer) -> void;
+
+    // CRUD operations
+    virtual auto createRecord(int64_t const &key, Record const &value) -> InsertStatus = 0;
+    virtual auto createRecords(std::span<std::pair<int64_t, Record> const> records) -> std::vector<InsertStatus> = 0;
+    virtual auto readRecord(int64_t const &key) -> std::optional<Record> = 0;
+    virtual auto updateRecord(int64_t const &key, Record const &value) -> void = 0;
+    virtual auto deleteRecord(int64_t const &key) -> void = 0;
+    virtual auto forEachRecord(RecordConsumer const &consumer) -> void = 0;
+    virtual auto forEachRecordDescending(RecordConsumer const &consumer) -> void = 0;
+    virtual auto forEachRecordInRange(int64_t const &lowKey, int64_t const &highKey, size_t limit,
+                                      RecordConsumer const &consumer) -> void = 0;
+    virtual auto bulkLoad(RecordsSource const &source, double fillFactor) -> uint64_t = 0;
+
+    // printing
+    virtual auto draw() -> void = 0;
+    virtual auto print() -> void = 0;
+    virtual auto printFile() -> void = 0;
+
+    // statistics
+    virtual auto getFilePath() const -> fs::path const & = 0;
+    virtual auto name() const -> std::string = 0;
+    virtual auto innerNodeDegree() const -> size_t = 0;
+    virtual auto leafNodeDegree() const -> size_t = 0;
+    virtual auto getSessionDiskReadsCout() const -> uint64_t = 0;
+    virtual auto getSessionDiskWritesCount() const -> uint64_t = 0;
+    virtual auto getCurrentOperationDiskReadsCount() const -> uint64_t = 0;
+    virtual auto getCurrentOperationDiskWritesCount() const -> uint64_t = 0;
+    virtual auto getSessionNodeWritesCount() const -> uint64_t = 0;
+    virtual auto getCurrentOperationNodeWritesCount() const -> uint64_t = 0;
+    virtual auto getSessionCacheHitsCount() const -> uint64_t = 0;
+    virtual auto getSessionCacheMissesCount() const -> uint64_t = 0;
+    virtual auto getCurrentOperationCacheHitsCount() const -> uint64_t = 0;
+    virtual auto getCurrentOperationCacheMissesCount() const -> uint64_t = 0;
+    virtual auto getSessionChecksumFailuresCount() const -> uint64_t = 0;
+    virtual auto getReadaheadStats() const -> ReadaheadStats const & = 0;
+    virtual auto getBufferPool() const -> BufferPool<ANode> const & = 0;
+    virtual auto getFileSize() const -> size_t = 0;
+    virtual auto getHeight() -> uint64_t = 0;
+    virtual auto getRecordsNumber() -> uint64_t = 0;
+    virtual auto getNodesCount() -> std::pair<uint64_t, uint64_t> = 0;
+    virtual auto empty() const -> bool = 0;
+    virtual auto resetOpCounters() -> void = 0;
+    virtual auto disableCounters() -> void = 0;
+    virtual auto enableCounters() -> void = 0;
+};
+
+
+/**
+ * Input iterator over records returned by source, default constructed one is end of records
+ */
+class RecordsSourceIterator final {
+public:
+    using iterator_category = std::input_iterator_tag;
+    using value_type = std::pair<int64_t, Record>;
+    using difference_type = std::ptrdiff_t;
+    using pointer = value_type const *;
+    using reference = value_type const &;
+
+    RecordsSourceIterator() = default;
+    explicit RecordsSourceIterator(Tree::RecordsSource const &source) : source(&source), record(source()) {}
+
+    auto operator*() const -> reference { return *record; }
+    auto operator->() const -> pointer { return &*record; }
+    auto operator++() -> RecordsSourceIterator & { return record = (*source)(), *this; }
+    auto operator==(RecordsSourceIterator const &other) const -> bool { return !record && !other.record; }
+    auto operator!=(RecordsSourceIterator const &other) const -> bool { return !(*this == other); }
+
+private:
+    Tree::RecordsSource const *source = nullptr;
+    std::optional<value_type> record;
+};
+
+
+/**
+ * Tree of records with given degrees of nodes
+ */
+template<size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+class TypedTree final : public Tree {
+public:
+    using BTreeType = BPlusTree<int64_t, Record, TInnerNodeDegree, TLeafNodeDegree>;
+
+    TypedTree(fs::path const &filePath, OpenMode openMode, TreeOptions const &options)
+            : tree(filePath, openMode, options) {}
+
+    auto createRecord(int64_t const &key, Record const &value) -> InsertStatus override {
+        return tree.createRecord(key, value);
+    }
+    auto createRecords(std::span<std::pair<int64_t, Record> const> records) -> std::vector<InsertStatus> override {
+        return tree.createRecords(records);
+    }
+    auto readRecord(int64_t const &key) -> std::optional<Record> override { return tree.readRecord(key); }
+    auto updateRecord(int64_t const &key, Record const &value) -> void override { tree.updateRecord(key, value); }
+    auto deleteRecord(int64_t const &key) -> void override { tree.deleteRecord(key); }
+    auto forEachRecord(RecordConsumer const &consumer) -> void override;
+    auto forEachRecordDescending(RecordConsumer const &consumer) -> void override;
+    auto forEachRecordInRange(int64_t const &lowKey, int64_t const &highKey, size_t limit,
+                              RecordConsumer const &consumer) -> void override;
+    auto bulkLoad(RecordsSource const &source, double fillFactor) -> uint64_t override {
+        return tree.bulkLoad(RecordsSourceIterator(source), RecordsSourceIterator(), fillFactor);
+    }
+
+    auto draw() -> void override { tree.draw(); }
+    auto print() -> void override { tree.print(); }
+    auto printFile() -> void override { tree.printFile(); }
+
+    auto getFilePath() const -> fs::path const & override { return tree.filePath; }
+    auto name() const -> std::string override { return tree.name(); }
+    auto innerNodeDegree() const -> size_t override { return TInnerNodeDegree; }
+    auto leafNodeDegree() const -> size_t override { return TLeafNodeDegree; }
+    auto getSessionDiskReadsCout() const -> uint64_t override { return tree.getSessionDiskReadsCout(); }
+    auto getSessionDiskWritesCount() const -> uint64_t override { return tree.getSessionDiskWritesCount(); }
+    auto getCurrentOperationDiskReadsCount() const -> uint64_t override {
+        return tree.getCurrentOperationDiskReadsCount();
+    }
+    auto getCurrentOperationDiskWritesCount() const -> uint64_t override {
+        return tree.getCurrentOperationDiskWritesCount();
+    }
+    auto getSessionNodeWritesCount() const -> uint64_t override { return tree.getSessionNodeWritesCount(); }
+    auto getCurrentOperationNodeWritesCount() const -> uint64_t override {
+        return tree.getCurrentOperationNodeWritesCount();
+    }
+    auto getSessionCacheHitsCount() const -> uint64_t override { return tree.getSessionCacheHitsCount(); }
+    auto getSessionCacheMissesCount() const -> uint64_t override { return tree.getSessionCacheMissesCount(); }
+    auto getCurrentOperationCacheHitsCount() const -> uint64_t override {
+        return tree.getCurrentOperationCacheHitsCount();
+    }
+    auto getCurrentOperationCacheMissesCount() const -> uint64_t override {
+        return tree.getCurrentOperationCacheMissesCount();
+    }
+    auto getSessionChecksumFailuresCount() const -> uint64_t override {
+        return tree.getSessionChecksumFailuresCount();
+    }
+    auto getReadaheadStats() const -> ReadaheadStats const & override { return tree.getReadaheadStats(); }
+    auto getBufferPool() const -> BufferPool<ANode> const & override { return tree.getBufferPool(); }
+    auto getFileSize() const -> size_t override { return tree.getFileSize(); }
+    auto getHeight() -> uint64_t override { return tree.getHeight(); }
+    auto getRecordsNumber() -> uint64_t override { return tree.getRecordsNumber(); }
+    auto getNodesCount() -> std::pair<uint64_t, uint64_t> override { return tree.getNodesCount(); }
+    auto empty() const -> bool override { return tree.empty(); }
+    auto resetOpCounters() -> void override { tree.resetOpCounters(); }
+    auto disableCounters() -> void override { tree.disableCounters(); }
+    auto enableCounters() -> void override { tree.enableCounters(); }
+
+private:
+    BTreeType tree;
+};
+
+
+/**
+ * Calls consumer for every record in order by key, records are read by scan threads if tree uses more than one
+ * @param consumer
+ */
+template<size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto TypedTree<TInnerNodeDegree, TLeafNodeDegree>::forEachRecord(RecordConsumer const &consumer) -> void {
+    if (tree.scanThreads > 1) return tree.forEachRecordParallel(tree.scanThreads, consumer);
+    for (auto[key, value] : tree) consumer(key, value);
+}
+
+
+/**
+ * Calls consumer for every record in descending order by key
+ * @param consumer
+ */
+template<size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto TypedTree<TInnerNodeDegree, TLeafNodeDegree>::forEachRecordDescending(RecordConsumer const &consumer) -> void {
+    for (auto it = tree.rbegin(); it != tree.rend(); ++it) {
+        auto[key, value] = *it;
+        consumer(key, value);
+    }
+}
+
+
+/**
+ * Calls consumer for records with keys from lowKey to highKey (both inclusive) in order by key, records are read
+ * from snapshot, so writes done meanwhile aren't seen
+ * @param lowKey
+ * @param highKey
+ * @param limit max number of records, 0 means no limit
+ * @param consumer
+ */
+template<size_t TInnerNodeDegree, size_t TLeafNodeDegree>
+auto TypedTree<TInnerNodeDegree, TLeafNodeDegree>::forEachRecordInRange(int64_t const &lowKey, int64_t const &highKey,
+                                                                        size_t limit,
+                                                                        RecordConsumer const &consumer) -> void {
+    size_t count = 0;
+    auto snapshot = tree.snapshot();
+    snapshot.scanRange(lowKey, highKey, [&](int64_t const &key, Record const &value) {
+        if (limit != 0 && count == limit) return false;
+        consumer(key, value);
+        ++count;
+        return true;
+    });
+}
+
+
+#endif //SBD2_TREE_HH
@@ -0,0 +1,135 @@
+#include "write_ahead_log.hh"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+
+WriteAheadLog::WriteAheadLog(fs::path const &path, Durability durability) : durability(durability) {
+    this->fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+}
+
+
+WriteAheadLog::~WriteAheadLog() {
+    if (this->fd >= 0) ::close(this->fd);
+}
+
+
+/**
+ * Appends records of single operation, log is synced according to durability level
+ * @param writes data written by operation in order of writing
+ * @param count
+ */
+auto WriteAheadLog::append(StagedWrite const *writes, size_t count) -> void {
+    if (count == 0) return;
+    this->buffer.clear();
+    auto checksum = uint64_t{0};
+    for (size_t i = 0; i < count; ++i) {
+        auto header = RecordHeader{RecordHeader::Magic, writes[i].offset, writes[i].data.size()};
+        auto begin = this->buffer.size();
+        this->buffer.insert(this->buffer.end(), reinterpret_cast<char const *>(&header),
+                            reinterpret_cast<char const *>(&header) + sizeof(header));
+        this->buffer.insert(this->buffer.end(), writes[i].data.begin(), writes[i].data.end());
+        checksum = Checksum(this->buffer.data() + begin, this->buffer.size() - begin, checksum);
+    }
+    auto commit = RecordHeader{RecordHeader::Magic, checksum, RecordHeader::CommitSize};
+    this->buffer.insert(this->buffer.end(), reinterpret_cast<char const *>(&commit),
+                        reinterpret_cast<char const *>(&commit) + sizeof(commit));
+
+    for (size_t written = 0; written < this->buffer.size();) {
+        auto result = ::pwrite(this->fd, this->buffer.data() + written, this->buffer.size() - written,
+                               static_cast<off_t>(this->logSize + written));
+        if (result < 0 && errno == EINTR) continue;
+        if (result <= 0) {
+            this->failed = true;
+            throw std::runtime_error(std::string("Write to log failed: ") + std::strerror(errno));
+        }
+        written += static_cast<size_t>(result);
+    }
+    this->logSize += this->buffer.size();
+    ++this->unsyncedOperations;
+    if (this->durability == Durability::OPERATION || this->unsyncedOperations >= GroupSize) this->sync();
+}
+
+
+/**
+ * Makes all appended operations durable
+ */
+auto WriteAheadLog::sync() -> void {
+    if (this->synced()) return;
+    if (::fdatasync(this->fd) != 0) {
+        this->failed = true;
+        throw std::runtime_error(std::string("Sync of log failed: ") + std::strerror(errno));
+    }
+    this->syncedSize = this->logSize;
+    this->unsyncedOperations = 0;
+}
+
+
+/**
+ * Drops all records, should be called only when db file contains all logged data and is synced
+ */
+auto WriteAheadLog::truncate() -> void {
+    if (::ftruncate(this->fd, 0) != 0) this->failed = true;
+    this->logSize = this->syncedSize = 0;
+    this->unsyncedOperations = 0;
+}
+
+
+/**
+ * Writes data of all committed operations found in log to db file and syncs it, log is removed afterwards
+ * @param path path of log file
+ * @param file opened db file
+ * @return number of recovered operations
+ */
+auto WriteAheadLog::Recover(fs::path const &path, File &file) -> size_t {
+    if (!fs::is_regular_file(path)) return 0;
+    std::vector<char> log(fs::file_size(path));
+    {
+        std::ifstream stream(path, std::ios::binary);
+        stream.read(log.data(), static_cast<std::streamsize>(log.size()));
+        log.resize(static_cast<size_t>(stream.gcount()));
+    }
+    size_t recovered = 0;
+    size_t operationBegin = 0;
+    auto checksum = uint64_t{0};
+    for (size_t position = 0; position + sizeof(RecordHeader) <= log.size();) {
+        RecordHeader header;
+        std::memcpy(&header, log.data() + position, sizeof(header));
+        if (header.magic != RecordHeader::Magic) break;
+        if (header.size == RecordHeader::CommitSize) {
+            if (header.offset != checksum) break;
+            // operation is complete, apply its records
+            for (auto record = operationBegin; record < position;) {
+                std::memcpy(&header, log.data() + record, sizeof(header));
+                file.writeFrom(header.offset, {log.data() + record + sizeof(header), header.size});
+                record += sizeof(header) + header.size;
+            }
+            ++recovered;
+            position += sizeof(RecordHeader);
+            operationBegin = position;
+            checksum = 0;
+            continue;
+        }
+        if (header.size > log.size() || position + sizeof(header) + header.size > log.size()) break;
+        checksum = Checksum(log.data() + position, sizeof(header) + header.size, checksum);
+        position += sizeof(header) + header.size;
+    }
+    file.sync();
+    fs::remove(path);
+    return recovered;
+}
+
+
+/**
+ * FNV-1a hash of data
+ */
+auto WriteAheadLog::Checksum(char const *data, size_t size, uint64_t seed) -> uint64_t {
+    auto hash = seed ^ 0xcbf29ce484222325u;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= static_cast<uint8_t>(data[i]);
+        hash *= 0x100000001b3u;
+    }
+    return hash;
+}
@@ -0,0 +1,57 @@
+#ifndef SBD2_WRITE_AHEAD_LOG_HH
+#define SBD2_WRITE_AHEAD_LOG_HH
+
+#include "file.hh"
+
+// NONE - writes go directly to db file, BATCH - group of operations is made durable with single fdatasync,
+// OPERATION - every operation is durable when it returns, SHADOW - log isn't used, nodes changed by operation are
+// written to new slots and committed by switching root (used only by files created with it)
+enum class Durability { NONE, BATCH, OPERATION, SHADOW };
+
+/**
+ * Redo log kept next to db file. Every operation is appended as images of all data it wrote followed by commit
+ * record with checksum, operations which have no complete commit record are ignored during recovery.
+ * Data is written to db file only after its records are durable, log is truncated after db file is synced.
+ */
+class WriteAheadLog final {
+public:
+    static constexpr size_t GroupSize = 32; // operations committed with single fdatasync in BATCH mode
+    static constexpr size_t CheckpointSize = 16u << 20u; // log size which triggers checkpoint
+
+    WriteAheadLog(fs::path const &path, Durability durability);
+    WriteAheadLog(WriteAheadLog const &) = delete;
+    WriteAheadLog &operator=(WriteAheadLog const &) = delete;
+    ~WriteAheadLog();
+
+    static auto Recover(fs::path const &path, File &file) -> size_t;
+    static auto PathFor(fs::path const &dbFilePath) -> fs::path { return fs::path(dbFilePath) += ".wal"; }
+
+    auto append(StagedWrite const *writes, size_t count) -> void;
+    auto sync() -> void;
+    auto truncate() -> void;
+    auto synced() const { return this->syncedSize == this->logSize; }
+    auto size() const { return this->logSize; }
+    auto bad() const { return this->fd < 0 || this->failed; }
+
+private:
+    struct RecordHeader {
+        static constexpr uint64_t Magic = 0x4c41573244425332; // "2SBD2WAL"
+        static constexpr uint64_t CommitSize = ~uint64_t{0};
+        uint64_t magic = Magic;
+        uint64_t offset = 0; // offset in db file, checksum of operation records in commit record
+        uint64_t size = 0; // size of data following header, CommitSize for commit record
+    };
+
+    static auto Checksum(char const *data, size_t size, uint64_t seed) -> uint64_t;
+
+    int fd = -1;
+    Durability durability;
+    size_t logSize = 0;
+    size_t syncedSize = 0;
+    size_t unsyncedOperations = 0;
+    bool failed = false;
+    std::vector<char> buffer;
+};
+
+
+#endif //SBD2_WRITE_AHEAD_LOG_HH